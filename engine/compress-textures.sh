@@ -0,0 +1,11 @@
+#!/bin/bash
+
+# Block compressed variants of every texture, picked at runtime by device support.
+# Needs compressonatorcli (AMD Compressor) on the PATH.
+
+for texture in data/textures/*.jpg; do
+  name="${texture%.*}"
+  compressonatorcli -fd BC7 -miplevels 16 "$texture" "$name.bc7.ktx2"
+  compressonatorcli -fd ETC2_RGBA -miplevels 16 "$texture" "$name.etc2.ktx2"
+  compressonatorcli -fd ASTC -BlockRate 4x4 -miplevels 16 "$texture" "$name.astc.ktx2"
+done
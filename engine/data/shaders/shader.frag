@@ -1,12 +1,40 @@
 #version 450
 
+// Built twice, with -DBINDLESS textures come from the texture table in set 1
+// (src/texture_table.hpp) indexed per instance
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+// Selected per pipeline, see FragmentPath in src/pipelines.hpp
+layout(constant_id = 0) const uint FRAGMENT_PATH = 0;
+
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
 
 layout(location = 0) out vec4 outColor;
 
+#ifdef BINDLESS
+layout(location = 2) flat in uint fragTextureIndex;
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+vec4 sampleTexture(vec2 uv) {
+    return texture(textures[nonuniformEXT(fragTextureIndex)], uv);
+}
+#else
 layout(binding = 1) uniform sampler2D texSampler;
 
+vec4 sampleTexture(vec2 uv) {
+    return texture(texSampler, uv);
+}
+#endif
+
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
+    if (FRAGMENT_PATH == 1) {
+        outColor = vec4(fragColor, 1.0);
+    } else if (FRAGMENT_PATH == 2) {
+        outColor = sampleTexture(fragTexCoord) * vec4(fragColor, 1.0);
+    } else {
+        outColor = sampleTexture(fragTexCoord);
+    }
 }
\ No newline at end of file
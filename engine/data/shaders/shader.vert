@@ -10,11 +10,21 @@ layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 
+// Per instance, see InstanceData in src/main.cpp
+layout(location = 3) in vec4 inTransform;
+layout(location = 4) in vec2 inTranslation;
+layout(location = 5) in vec4 inUvRect;
+layout(location = 6) in uint inTextureIndex;
+
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTextureIndex;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 0.0, 1.0);
+    vec2 position = mat2(inTransform.xy, inTransform.zw) * inPosition + inTranslation;
+
+    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(position, 0.0, 1.0);
     fragColor = inColor;
-    fragTexCoord = inTexCoord;
+    fragTexCoord = inUvRect.xy + inTexCoord * inUvRect.zw;
+    fragTextureIndex = inTextureIndex;
 }
\ No newline at end of file
@@ -1,20 +1,28 @@
 #version 450
 
+// Sprites from src/sprites.hpp, already expanded to quads on the CPU
 layout(set = 0, binding = 0) uniform UniformBufferObject {
     mat4 model;
     mat4 view;
     mat4 proj;
 } ubo;
 
+// Texture table slot of the batch, ignored without bindless
+layout(push_constant) uniform SpriteBatch {
+    uint textureIndex;
+} batch;
+
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTextureIndex;
 
 void main() {
     gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 0.0, 1.0);
     fragColor = inColor;
     fragTexCoord = inTexCoord;
+    fragTextureIndex = batch.textureIndex;
 }
\ No newline at end of file
@@ -0,0 +1,17 @@
+#version 450
+
+// Bilinear upscale of the scene, see src/resolution.hpp
+layout(push_constant) uniform Upscale {
+    vec2 uvScale;
+    vec2 uvMax; // Last texel centers inside the render area
+} upscale;
+
+layout(binding = 0) uniform sampler2D scene;
+
+layout(location = 0) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = texture(scene, min(fragTexCoord, upscale.uvMax));
+}
\ No newline at end of file
@@ -0,0 +1,15 @@
+#version 450
+
+// Fullscreen triangle of the upscale pass, see src/resolution.hpp
+layout(push_constant) uniform Upscale {
+    vec2 uvScale; // Part of the scene image the scene was drawn into
+    vec2 uvMax;
+} upscale;
+
+layout(location = 0) out vec2 fragTexCoord;
+
+void main() {
+    vec2 position = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+    fragTexCoord = position * upscale.uvScale;
+}
\ No newline at end of file
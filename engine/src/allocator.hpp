@@ -0,0 +1,549 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+
+#include "logger.hpp"
+
+/*
+  Engine owned device memory allocator.
+
+  Memory is reserved in large blocks per memory type and handed out in
+  aligned sub ranges, so the number of vkAllocateMemory calls stays far
+  below maxMemoryAllocationCount no matter how many assets are loaded.
+  Big images (or resources the driver asks for) get a dedicated allocation.
+  Host visible blocks are mapped once at creation and stay mapped.
+*/
+
+// First-fit free list over [0, size). Used for device memory blocks and any other
+// linear arena that needs aligned sub allocation.
+class RangeAllocator
+{
+  public:
+  static constexpr VkDeviceSize INVALID_OFFSET = std::numeric_limits<VkDeviceSize>::max();
+
+  void init(VkDeviceSize size)
+  {
+    totalSize = size;
+    usedSize = 0;
+    freeRanges.clear();
+    freeRanges.push_back({0, size});
+  }
+
+  VkDeviceSize allocate(VkDeviceSize size, VkDeviceSize alignment)
+  {
+    if(size == 0)
+    {
+      return INVALID_OFFSET;
+    }
+
+    alignment = alignment == 0 ? 1 : alignment;
+
+    for(size_t i = 0; i < freeRanges.size(); i++)
+    {
+      Range range = freeRanges[i];
+      VkDeviceSize alignedOffset = (range.offset + alignment - 1) / alignment * alignment;
+      VkDeviceSize padding = alignedOffset - range.offset;
+
+      if(padding + size > range.size)
+      {
+        continue;
+      }
+
+      VkDeviceSize remaining = range.size - padding - size;
+      freeRanges.erase(freeRanges.begin() + i);
+
+      // Leftovers stay in the list so they can be reused by smaller, less aligned requests
+      if(remaining > 0)
+      {
+        freeRanges.insert(freeRanges.begin() + i, {alignedOffset + size, remaining});
+      }
+
+      if(padding > 0)
+      {
+        freeRanges.insert(freeRanges.begin() + i, {range.offset, padding});
+      }
+
+      usedSize += size;
+      return alignedOffset;
+    }
+
+    return INVALID_OFFSET;
+  }
+
+  void free(VkDeviceSize offset, VkDeviceSize size)
+  {
+    size_t index = 0;
+    while(index < freeRanges.size() && freeRanges[index].offset < offset)
+    {
+      index++;
+    }
+
+    freeRanges.insert(freeRanges.begin() + index, {offset, size});
+    usedSize -= size;
+
+    // Merge with the next range
+    if(index + 1 < freeRanges.size() && freeRanges[index].offset + freeRanges[index].size == freeRanges[index + 1].offset)
+    {
+      freeRanges[index].size += freeRanges[index + 1].size;
+      freeRanges.erase(freeRanges.begin() + index + 1);
+    }
+
+    // Merge with the previous range
+    if(index > 0 && freeRanges[index - 1].offset + freeRanges[index - 1].size == freeRanges[index].offset)
+    {
+      freeRanges[index - 1].size += freeRanges[index].size;
+      freeRanges.erase(freeRanges.begin() + index);
+    }
+  }
+
+  VkDeviceSize getSize() const { return totalSize; }
+  VkDeviceSize getUsed() const { return usedSize; }
+  bool isEmpty() const { return usedSize == 0; }
+
+  private:
+  struct Range
+  {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+  };
+
+  std::vector<Range> freeRanges; // sorted by offset, never adjacent
+  VkDeviceSize totalSize = 0;
+  VkDeviceSize usedSize = 0;
+};
+
+struct GpuAllocation
+{
+  static constexpr uint32_t DEDICATED_BLOCK = std::numeric_limits<uint32_t>::max();
+
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  void *mapped = nullptr; // Already offset, only set for host visible memory
+  uint32_t memoryType = 0;
+  uint32_t blockIndex = DEDICATED_BLOCK;
+};
+
+struct MemoryHeapStats
+{
+  VkDeviceSize heapSize = 0;
+  VkDeviceSize reservedBytes = 0; // Bytes taken from the driver (blocks + dedicated)
+  VkDeviceSize usedBytes = 0; // Bytes handed out to resources
+  uint32_t blockCount = 0;
+  uint32_t dedicatedCount = 0;
+  uint32_t allocationCount = 0;
+};
+
+class DeviceAllocator
+{
+  public:
+  // Linear (buffers) and optimal (images) resources never share a block, so
+  // bufferImageGranularity never has to be considered between neighbours.
+  enum class ResourceKind
+  {
+    LINEAR,
+    OPTIMAL,
+  };
+
+  static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+  static constexpr VkDeviceSize DEDICATED_IMAGE_THRESHOLD = 16ull * 1024 * 1024;
+
+  void init(VkPhysicalDevice physicalDevice, VkDevice device)
+  {
+    this->device = device;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+
+    heapStats.assign(memoryProperties.memoryHeapCount, MemoryHeapStats{});
+    for(uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+      heapStats[i].heapSize = memoryProperties.memoryHeaps[i].size;
+    }
+  }
+
+  void destroy()
+  {
+    for(auto &block : blocks)
+    {
+      if(block.memory != VK_NULL_HANDLE)
+      {
+        vkFreeMemory(device, block.memory, nullptr);
+      }
+    }
+
+    if(dedicatedCount > 0)
+    {
+      LOG_DEBUG("DeviceAllocator: {} dedicated allocations were not freed", dedicatedCount);
+    }
+
+    blocks.clear();
+  }
+
+  uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+  {
+    for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+    {
+      if((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+      {
+        return i;
+      }
+    }
+
+    return std::numeric_limits<uint32_t>::max();
+  }
+
+  bool allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties, GpuAllocation &allocation)
+  {
+    VkMemoryDedicatedRequirements dedicatedRequirements{};
+    dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+    VkMemoryRequirements2 requirements{};
+    requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    requirements.pNext = &dedicatedRequirements;
+
+    VkBufferMemoryRequirementsInfo2 requirementsInfo{};
+    requirementsInfo.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+    requirementsInfo.buffer = buffer;
+
+    vkGetBufferMemoryRequirements2(device, &requirementsInfo, &requirements);
+
+    bool dedicated = dedicatedRequirements.requiresDedicatedAllocation || dedicatedRequirements.prefersDedicatedAllocation;
+
+    if(!allocate(requirements.memoryRequirements, properties, ResourceKind::LINEAR, dedicated, VK_NULL_HANDLE, buffer, allocation))
+    {
+      return false;
+    }
+
+    if(vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset) != VK_SUCCESS)
+    {
+      free(allocation);
+      return false;
+    }
+
+    return true;
+  }
+
+  bool allocateImage(VkImage image, VkMemoryPropertyFlags properties, GpuAllocation &allocation)
+  {
+    VkMemoryDedicatedRequirements dedicatedRequirements{};
+    dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+    VkMemoryRequirements2 requirements{};
+    requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    requirements.pNext = &dedicatedRequirements;
+
+    VkImageMemoryRequirementsInfo2 requirementsInfo{};
+    requirementsInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+    requirementsInfo.image = image;
+
+    vkGetImageMemoryRequirements2(device, &requirementsInfo, &requirements);
+
+    bool dedicated = dedicatedRequirements.requiresDedicatedAllocation || dedicatedRequirements.prefersDedicatedAllocation ||
+      requirements.memoryRequirements.size >= DEDICATED_IMAGE_THRESHOLD;
+
+    if(!allocate(requirements.memoryRequirements, properties, ResourceKind::OPTIMAL, dedicated, image, VK_NULL_HANDLE, allocation))
+    {
+      return false;
+    }
+
+    if(vkBindImageMemory(device, image, allocation.memory, allocation.offset) != VK_SUCCESS)
+    {
+      free(allocation);
+      return false;
+    }
+
+    return true;
+  }
+
+  void free(GpuAllocation &allocation)
+  {
+    if(allocation.memory == VK_NULL_HANDLE)
+    {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    MemoryHeapStats &stats = heapStats[memoryProperties.memoryTypes[allocation.memoryType].heapIndex];
+    stats.usedBytes -= allocation.size;
+    stats.allocationCount--;
+
+    if(allocation.blockIndex == GpuAllocation::DEDICATED_BLOCK)
+    {
+      vkFreeMemory(device, allocation.memory, nullptr);
+      stats.reservedBytes -= allocation.size;
+      stats.dedicatedCount--;
+      dedicatedCount--;
+    }
+    else
+    {
+      MemoryBlock &block = blocks[allocation.blockIndex];
+      block.ranges.free(allocation.offset, allocation.size);
+
+      if(block.ranges.isEmpty() && countBlocks(block.memoryType, block.kind) > 1)
+      {
+        releaseBlock(allocation.blockIndex);
+      }
+    }
+
+    allocation = GpuAllocation{};
+  }
+
+  std::vector<MemoryHeapStats> getHeapStats() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return heapStats;
+  }
+
+  void logStats() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for(size_t i = 0; i < heapStats.size(); i++)
+    {
+      const MemoryHeapStats &stats = heapStats[i];
+      LOG_DEBUG("Heap {}: used {} / reserved {} / size {} bytes, {} allocations in {} blocks + {} dedicated",
+        i, stats.usedBytes, stats.reservedBytes, stats.heapSize, stats.allocationCount, stats.blockCount, stats.dedicatedCount);
+    }
+  }
+
+  private:
+  struct MemoryBlock
+  {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    RangeAllocator ranges;
+    void *mapped = nullptr;
+    uint32_t memoryType = 0;
+    ResourceKind kind = ResourceKind::LINEAR;
+  };
+
+  bool allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, ResourceKind kind, bool dedicated, VkImage dedicatedImage, VkBuffer dedicatedBuffer, GpuAllocation &allocation)
+  {
+    uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+
+    if(memoryType == std::numeric_limits<uint32_t>::max())
+    {
+      LOG_DEBUG("Failed to find suitable memory type");
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    VkDeviceSize blockSize = getBlockSize(memoryType);
+
+    if(dedicated || requirements.size > blockSize / 2)
+    {
+      return allocateDedicated(requirements, memoryType, dedicatedImage, dedicatedBuffer, allocation);
+    }
+
+    for(uint32_t i = 0; i < blocks.size(); i++)
+    {
+      if(suballocate(i, memoryType, kind, requirements, allocation))
+      {
+        return true;
+      }
+    }
+
+    uint32_t blockIndex = createBlock(memoryType, kind, blockSize);
+
+    if(blockIndex == GpuAllocation::DEDICATED_BLOCK)
+    {
+      return false;
+    }
+
+    return suballocate(blockIndex, memoryType, kind, requirements, allocation);
+  }
+
+  bool suballocate(uint32_t blockIndex, uint32_t memoryType, ResourceKind kind, const VkMemoryRequirements &requirements, GpuAllocation &allocation)
+  {
+    MemoryBlock &block = blocks[blockIndex];
+
+    if(block.memory == VK_NULL_HANDLE || block.memoryType != memoryType || block.kind != kind)
+    {
+      return false;
+    }
+
+    VkDeviceSize offset = block.ranges.allocate(requirements.size, requirements.alignment);
+
+    if(offset == RangeAllocator::INVALID_OFFSET)
+    {
+      return false;
+    }
+
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.size = requirements.size;
+    allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + offset : nullptr;
+    allocation.memoryType = memoryType;
+    allocation.blockIndex = blockIndex;
+
+    MemoryHeapStats &stats = heapStats[memoryProperties.memoryTypes[memoryType].heapIndex];
+    stats.usedBytes += requirements.size;
+    stats.allocationCount++;
+
+    return true;
+  }
+
+  bool allocateDedicated(const VkMemoryRequirements &requirements, uint32_t memoryType, VkImage image, VkBuffer buffer, GpuAllocation &allocation)
+  {
+    VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+    dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicatedInfo.image = image;
+    dedicatedInfo.buffer = buffer;
+
+    VkDeviceMemory memory = allocateMemory(requirements.size, memoryType, &dedicatedInfo);
+
+    if(memory == VK_NULL_HANDLE)
+    {
+      return false;
+    }
+
+    allocation.memory = memory;
+    allocation.offset = 0;
+    allocation.size = requirements.size;
+    allocation.mapped = mapMemory(memory, memoryType);
+    allocation.memoryType = memoryType;
+    allocation.blockIndex = GpuAllocation::DEDICATED_BLOCK;
+
+    MemoryHeapStats &stats = heapStats[memoryProperties.memoryTypes[memoryType].heapIndex];
+    stats.reservedBytes += requirements.size;
+    stats.usedBytes += requirements.size;
+    stats.dedicatedCount++;
+    stats.allocationCount++;
+    dedicatedCount++;
+
+    return true;
+  }
+
+  uint32_t createBlock(uint32_t memoryType, ResourceKind kind, VkDeviceSize blockSize)
+  {
+    VkDeviceMemory memory = allocateMemory(blockSize, memoryType, nullptr);
+
+    if(memory == VK_NULL_HANDLE)
+    {
+      return GpuAllocation::DEDICATED_BLOCK;
+    }
+
+    MemoryBlock block;
+    block.memory = memory;
+    block.ranges.init(blockSize);
+    block.mapped = mapMemory(memory, memoryType);
+    block.memoryType = memoryType;
+    block.kind = kind;
+
+    MemoryHeapStats &stats = heapStats[memoryProperties.memoryTypes[memoryType].heapIndex];
+    stats.reservedBytes += blockSize;
+    stats.blockCount++;
+
+    // Reuse slots of released blocks so block indices held by live allocations stay valid
+    for(uint32_t i = 0; i < blocks.size(); i++)
+    {
+      if(blocks[i].memory == VK_NULL_HANDLE)
+      {
+        blocks[i] = block;
+        return i;
+      }
+    }
+
+    blocks.push_back(block);
+    return static_cast<uint32_t>(blocks.size() - 1);
+  }
+
+  void releaseBlock(uint32_t blockIndex)
+  {
+    MemoryBlock &block = blocks[blockIndex];
+
+    MemoryHeapStats &stats = heapStats[memoryProperties.memoryTypes[block.memoryType].heapIndex];
+    stats.reservedBytes -= block.ranges.getSize();
+    stats.blockCount--;
+
+    vkFreeMemory(device, block.memory, nullptr);
+    block = MemoryBlock{};
+  }
+
+  uint32_t countBlocks(uint32_t memoryType, ResourceKind kind) const
+  {
+    uint32_t count = 0;
+
+    for(auto &block : blocks)
+    {
+      if(block.memory != VK_NULL_HANDLE && block.memoryType == memoryType && block.kind == kind)
+      {
+        count++;
+      }
+    }
+
+    return count;
+  }
+
+  VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryType, const void *pNext)
+  {
+    uint32_t liveAllocations = dedicatedCount;
+    for(auto &block : blocks)
+    {
+      liveAllocations += block.memory != VK_NULL_HANDLE ? 1 : 0;
+    }
+
+    if(liveAllocations >= maxAllocationCount)
+    {
+      LOG_DEBUG("DeviceAllocator: maxMemoryAllocationCount ({}) reached", maxAllocationCount);
+      return VK_NULL_HANDLE;
+    }
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = pNext;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    if(vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to allocate {} bytes of device memory (type {})", size, memoryType);
+      return VK_NULL_HANDLE;
+    }
+
+    return memory;
+  }
+
+  void *mapMemory(VkDeviceMemory memory, uint32_t memoryType)
+  {
+    if(!(memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+    {
+      return nullptr;
+    }
+
+    void *mapped = nullptr;
+    if(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to map device memory");
+    }
+
+    return mapped;
+  }
+
+  // Small heaps (integrated GPUs, host visible device local windows) get smaller blocks
+  VkDeviceSize getBlockSize(uint32_t memoryType) const
+  {
+    VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    return std::min(DEFAULT_BLOCK_SIZE, heapSize / 8);
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties{};
+  uint32_t maxAllocationCount = 4096;
+  uint32_t dedicatedCount = 0;
+
+  std::vector<MemoryBlock> blocks;
+  std::vector<MemoryHeapStats> heapStats;
+  mutable std::mutex mutex;
+};
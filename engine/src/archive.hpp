@@ -0,0 +1,260 @@
+#pragma once
+
+#ifdef __ANDROID__
+#include <android/asset_manager.h>
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+#include "logger.hpp"
+
+/*
+  Read only view over the packed asset archive written by tools/pack_assets.py.
+
+  Layout (little endian):
+    header  { char magic[4] = "PAK1"; uint32_t version; uint32_t entryCount; uint32_t reserved; }
+    entries { uint64_t hash; uint64_t offset; uint64_t size; uint32_t pathOffset; uint32_t pathSize; } x entryCount, sorted by hash
+    paths   the entries' paths back to back, not terminated
+    data    each entry starts on a 16 byte boundary
+
+  hash is the 64 bit FNV-1a of the path relative to engine/data using '/'.
+  find() compares the stored path as well, two paths that hash alike never
+  return each other's data.
+  The whole file is memory mapped (AAsset_getBuffer on Android, the APK must
+  store it uncompressed), so find() returns views straight into the mapping.
+  Views stay valid until close(); the archive is safe to read from any thread.
+*/
+class AssetArchive
+{
+  public:
+  static constexpr uint32_t VERSION = 2;
+  static constexpr uint64_t DATA_ALIGNMENT = 16;
+
+  static uint64_t hashPath(std::string_view path)
+  {
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for(char c : path)
+    {
+      hash ^= static_cast<uint8_t>(c);
+      hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+  }
+
+  #ifdef __ANDROID__
+  bool open(AAssetManager *assetManager, const char *filename)
+  {
+    asset = AAssetManager_open(assetManager, filename, AASSET_MODE_BUFFER);
+
+    if(!asset)
+    {
+      LOG_DEBUG("Could not open asset archive {}", filename);
+      return false;
+    }
+
+    data = static_cast<const char*>(AAsset_getBuffer(asset));
+    size = static_cast<size_t>(AAsset_getLength64(asset));
+
+    return data && parse();
+  }
+  #else
+  bool open(const char *filename)
+  {
+    #ifdef _WIN32
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if(file == INVALID_HANDLE_VALUE)
+    {
+      LOG_DEBUG("Could not open asset archive {}", filename);
+      return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    size = static_cast<size_t>(fileSize.QuadPart);
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    data = mapping ? static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+    #else
+    file = ::open(filename, O_RDONLY);
+
+    if(file < 0)
+    {
+      LOG_DEBUG("Could not open asset archive {}", filename);
+      return false;
+    }
+
+    struct stat fileStat;
+    fstat(file, &fileStat);
+    size = static_cast<size_t>(fileStat.st_size);
+
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+    data = mapped == MAP_FAILED ? nullptr : static_cast<const char*>(mapped);
+    #endif
+
+    if(!data)
+    {
+      LOG_DEBUG("Could not map asset archive {}", filename);
+      close();
+      return false;
+    }
+
+    return parse();
+  }
+  #endif
+
+  void close()
+  {
+    #ifdef __ANDROID__
+    if(asset)
+    {
+      AAsset_close(asset);
+      asset = nullptr;
+    }
+    #elif defined(_WIN32)
+    if(data)
+    {
+      UnmapViewOfFile(data);
+    }
+
+    if(mapping)
+    {
+      CloseHandle(mapping);
+      mapping = nullptr;
+    }
+
+    if(file != INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(file);
+      file = INVALID_HANDLE_VALUE;
+    }
+    #else
+    if(data)
+    {
+      munmap(const_cast<char*>(data), size);
+    }
+
+    if(file >= 0)
+    {
+      ::close(file);
+      file = -1;
+    }
+    #endif
+
+    data = nullptr;
+    size = 0;
+    entries = {};
+  }
+
+  bool isOpen() const
+  {
+    return !entries.empty();
+  }
+
+  // Empty span when the archive has no such file
+  std::span<const char> find(std::string_view path) const
+  {
+    uint64_t hash = hashPath(path);
+
+    auto entry = std::lower_bound(entries.begin(), entries.end(), hash, [](const Entry &entry, uint64_t hash) {
+      return entry.hash < hash;
+    });
+
+    for(; entry != entries.end() && entry->hash == hash; entry++)
+    {
+      if(std::string_view(data + entry->pathOffset, entry->pathSize) == path)
+      {
+        return {data + entry->offset, static_cast<size_t>(entry->size)};
+      }
+    }
+
+    return {};
+  }
+
+  private:
+  struct Header
+  {
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+  };
+
+  struct Entry
+  {
+    uint64_t hash;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t pathOffset;
+    uint32_t pathSize;
+  };
+
+  bool parse()
+  {
+    Header header;
+    if(size < sizeof(Header))
+    {
+      LOG_DEBUG("Asset archive is truncated");
+      return false;
+    }
+
+    memcpy(&header, data, sizeof(Header));
+
+    if(memcmp(header.magic, "PAK1", 4) != 0 || header.version != VERSION)
+    {
+      LOG_DEBUG("Asset archive has an unknown format");
+      return false;
+    }
+
+    if(sizeof(Header) + header.entryCount * sizeof(Entry) > size)
+    {
+      LOG_DEBUG("Asset archive table is truncated");
+      return false;
+    }
+
+    // The table is 8 byte aligned in the file and the mapping is page aligned
+    std::span<const Entry> table(reinterpret_cast<const Entry*>(data + sizeof(Header)), header.entryCount);
+
+    for(const Entry &entry : table)
+    {
+      if(entry.offset + entry.size > size || entry.pathOffset + static_cast<uint64_t>(entry.pathSize) > size)
+      {
+        LOG_DEBUG("Asset archive entry {} is out of bounds", entry.hash);
+        return false;
+      }
+    }
+
+    entries = table;
+    LOG_DEBUG("Asset archive mapped, {} files in {} bytes", header.entryCount, size);
+
+    return true;
+  }
+
+  const char *data = nullptr;
+  size_t size = 0;
+  std::span<const Entry> entries;
+
+  #ifdef __ANDROID__
+  AAsset *asset = nullptr;
+  #elif defined(_WIN32)
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+  #else
+  int file = -1;
+  #endif
+};
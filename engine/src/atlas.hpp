@@ -0,0 +1,413 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <vector>
+
+/*
+  Runtime texture atlas for small RGBA8 images.
+
+  SkylinePacker places rectangles on a page by tracking the top edge of
+  everything placed so far as a list of horizontal segments. A rectangle goes
+  where its top ends lowest, ties broken by the area it would leave unusable
+  underneath. Insertion is incremental and never moves what was placed
+  before.
+
+  TextureAtlas keeps one packer per page and turns each image into a block
+  ready to be copied: the image extruded by `padding` texels of its own
+  edges, so filtering and lower mips never pull in a neighbour, followed by
+  every mip level of that block. Blocks are aligned to 2^(mipLevels - 1)
+  texels so each level of a block covers whole texels of the same level of
+  the page. Building the levels per block instead of re-mipmapping the page
+  means inserting never writes texels that earlier blocks own. Pages in an
+  sRGB format get their colour averaged in linear space.
+
+  The packer never frees, but the most recent insert can be taken back when
+  its block could not be uploaded.
+
+  Everything here runs on the CPU; the caller owns the page images and
+  uploads the blocks.
+*/
+class SkylinePacker
+{
+  public:
+  struct Rect
+  {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+  };
+
+  void init(uint32_t width, uint32_t height)
+  {
+    this->width = width;
+    this->height = height;
+    usedArea = 0;
+
+    skyline.clear();
+    skyline.push_back({0, 0, width});
+  }
+
+  // False when no spot on the page is left for a width x height rectangle
+  bool insert(uint32_t rectWidth, uint32_t rectHeight, Rect &rect)
+  {
+    size_t bestIndex = std::numeric_limits<size_t>::max();
+    uint32_t bestTop = std::numeric_limits<uint32_t>::max();
+    uint64_t bestWaste = std::numeric_limits<uint64_t>::max();
+    uint32_t bestY = 0;
+
+    for(size_t i = 0; i < skyline.size(); i++)
+    {
+      uint32_t y;
+      uint64_t waste;
+
+      if(!fit(i, rectWidth, rectHeight, y, waste))
+      {
+        continue;
+      }
+
+      uint32_t top = y + rectHeight;
+      if(top < bestTop || (top == bestTop && waste < bestWaste))
+      {
+        bestIndex = i;
+        bestTop = top;
+        bestWaste = waste;
+        bestY = y;
+      }
+    }
+
+    if(bestIndex == std::numeric_limits<size_t>::max())
+    {
+      return false;
+    }
+
+    rect = {skyline[bestIndex].x, bestY, rectWidth, rectHeight};
+    place(bestIndex, rect);
+    usedArea += uint64_t(rectWidth) * rectHeight;
+
+    return true;
+  }
+
+  // Fraction of the page covered by rectangles
+  float getOccupancy() const
+  {
+    return width == 0 ? 0.0f : static_cast<float>(double(usedArea) / (double(width) * height));
+  }
+
+  private:
+  struct Segment
+  {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+  };
+
+  // Lowest y a rectangle starting at segment index can sit at, and the area
+  // left under it
+  bool fit(size_t index, uint32_t rectWidth, uint32_t rectHeight, uint32_t &y, uint64_t &waste) const
+  {
+    uint32_t x = skyline[index].x;
+
+    if(x + rectWidth > width)
+    {
+      return false;
+    }
+
+    y = 0;
+    for(size_t i = index; i < skyline.size() && skyline[i].x < x + rectWidth; i++)
+    {
+      y = std::max(y, skyline[i].y);
+    }
+
+    if(y + rectHeight > height)
+    {
+      return false;
+    }
+
+    waste = 0;
+    for(size_t i = index; i < skyline.size() && skyline[i].x < x + rectWidth; i++)
+    {
+      uint32_t overlap = std::min(skyline[i].x + skyline[i].width, x + rectWidth) - skyline[i].x;
+      waste += uint64_t(y - skyline[i].y) * overlap;
+    }
+
+    return true;
+  }
+
+  void place(size_t index, const Rect &rect)
+  {
+    skyline.insert(skyline.begin() + index, {rect.x, rect.y + rect.height, rect.width});
+
+    // Trim or drop the segments the new one now covers
+    uint32_t right = rect.x + rect.width;
+    size_t i = index + 1;
+
+    while(i < skyline.size() && skyline[i].x < right)
+    {
+      uint32_t segmentRight = skyline[i].x + skyline[i].width;
+
+      if(segmentRight <= right)
+      {
+        skyline.erase(skyline.begin() + i);
+        continue;
+      }
+
+      skyline[i].width = segmentRight - right;
+      skyline[i].x = right;
+      break;
+    }
+
+    // Neighbours at the same height become one segment
+    for(size_t j = 0; j + 1 < skyline.size();)
+    {
+      if(skyline[j].y == skyline[j + 1].y)
+      {
+        skyline[j].width += skyline[j + 1].width;
+        skyline.erase(skyline.begin() + j + 1);
+      }
+      else
+      {
+        j++;
+      }
+    }
+  }
+
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint64_t usedArea = 0;
+  std::vector<Segment> skyline;
+};
+
+class TextureAtlas
+{
+  public:
+  // One mip level of a block, in texels of that level of the page
+  struct Level
+  {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+    size_t offset; // Into Block::pixels
+  };
+
+  struct Block
+  {
+    uint32_t page;
+    glm::vec4 uvRect; // Where the image landed on its page, offset in xy, size in zw
+    std::vector<Level> levels;
+    std::vector<uint8_t> pixels; // RGBA8, every level tightly packed
+  };
+
+  // padding is in level 0 texels, levels get half as much each. srgb when
+  // the pages sample as sRGB, the pixels are then sRGB encoded too.
+  void init(uint32_t pageSize, uint32_t padding, uint32_t mipLevels, uint32_t maxPages, bool srgb)
+  {
+    this->pageSize = pageSize;
+    this->padding = padding;
+    this->mipLevels = std::max(mipLevels, 1u);
+    this->maxPages = maxPages;
+    this->srgb = srgb;
+    alignment = 1u << (this->mipLevels - 1);
+
+    pages.clear();
+    lastInsert.reset();
+  }
+
+  uint32_t getPageSize() const { return pageSize; }
+  uint32_t getMipLevels() const { return mipLevels; }
+  uint32_t getPageCount() const { return static_cast<uint32_t>(pages.size()); }
+  float getOccupancy(uint32_t page) const { return pages[page].getOccupancy(); }
+
+  // Places a width x height RGBA8 image, opening a new page when the others
+  // are full. block.page may be a page that did not exist before.
+  bool insert(const uint8_t *pixels, uint32_t width, uint32_t height, Block &block)
+  {
+    uint32_t blockWidth = alignUp(width + 2 * padding);
+    uint32_t blockHeight = alignUp(height + 2 * padding);
+
+    if(blockWidth > pageSize || blockHeight > pageSize)
+    {
+      return false;
+    }
+
+    SkylinePacker::Rect rect;
+    uint32_t page = 0;
+    lastInsert.reset();
+
+    for(; page < pages.size(); page++)
+    {
+      SkylinePacker before = pages[page];
+
+      if(pages[page].insert(blockWidth, blockHeight, rect))
+      {
+        lastInsert = LastInsert{page, std::move(before)};
+        break;
+      }
+    }
+
+    if(page == pages.size())
+    {
+      if(pages.size() == maxPages)
+      {
+        return false;
+      }
+
+      pages.emplace_back();
+      pages.back().init(pageSize, pageSize);
+      pages.back().insert(blockWidth, blockHeight, rect);
+      lastInsert = LastInsert{page, std::nullopt};
+    }
+
+    block.page = page;
+    block.uvRect = glm::vec4(
+      float(rect.x + padding) / pageSize, float(rect.y + padding) / pageSize,
+      float(width) / pageSize, float(height) / pageSize
+    );
+
+    buildLevels(pixels, width, height, rect, block);
+    return true;
+  }
+
+  // Frees the block of the last insert(), closing its page again if that
+  // opened one. Only the most recent insert can be taken back.
+  void revertLastInsert()
+  {
+    if(!lastInsert)
+    {
+      return;
+    }
+
+    if(lastInsert->before)
+    {
+      pages[lastInsert->page] = std::move(*lastInsert->before);
+    }
+    else
+    {
+      pages.pop_back();
+    }
+
+    lastInsert.reset();
+  }
+
+  // uvRect (offset, size) of a part of an image, moved onto the image's place in the atlas
+  static glm::vec4 remap(const glm::vec4 &atlasRect, const glm::vec4 &uvRect)
+  {
+    return glm::vec4(
+      atlasRect.x + uvRect.x * atlasRect.z, atlasRect.y + uvRect.y * atlasRect.w,
+      uvRect.z * atlasRect.z, uvRect.w * atlasRect.w
+    );
+  }
+
+  private:
+  struct LastInsert
+  {
+    uint32_t page;
+    std::optional<SkylinePacker> before; // The page's packer before the insert, none when it opened the page
+  };
+
+  uint32_t alignUp(uint32_t value) const
+  {
+    return (value + alignment - 1) & ~(alignment - 1);
+  }
+
+  static float srgbToLinear(uint8_t value)
+  {
+    static const std::array<float, 256> table = [] {
+      std::array<float, 256> table;
+      for(uint32_t i = 0; i < 256; i++)
+      {
+        float c = i / 255.0f;
+        table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+      }
+      return table;
+    }();
+
+    return table[value];
+  }
+
+  static uint8_t linearToSrgb(float value)
+  {
+    float c = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+    return static_cast<uint8_t>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+  }
+
+  // Average of four texels' channel c, alpha and UNORM pages average as stored
+  uint8_t average(const uint8_t *a, const uint8_t *b, const uint8_t *c, const uint8_t *d, uint32_t channel) const
+  {
+    if(srgb && channel < 3)
+    {
+      return linearToSrgb((srgbToLinear(a[channel]) + srgbToLinear(b[channel]) + srgbToLinear(c[channel]) + srgbToLinear(d[channel])) * 0.25f);
+    }
+
+    return static_cast<uint8_t>((a[channel] + b[channel] + c[channel] + d[channel] + 2) / 4);
+  }
+
+  // Level 0 is the image with its edges extruded, each further level a 2x2
+  // box filter of the one before
+  void buildLevels(const uint8_t *pixels, uint32_t width, uint32_t height, const SkylinePacker::Rect &rect, Block &block) const
+  {
+    block.levels.clear();
+
+    size_t size = 0;
+    for(uint32_t level = 0; level < mipLevels; level++)
+    {
+      Level levelInfo{rect.x >> level, rect.y >> level, rect.width >> level, rect.height >> level, size};
+      block.levels.push_back(levelInfo);
+      size += size_t(levelInfo.width) * levelInfo.height * 4;
+    }
+
+    block.pixels.resize(size);
+
+    uint8_t *level0 = block.pixels.data();
+    for(uint32_t y = 0; y < rect.height; y++)
+    {
+      uint32_t sourceY = std::min(uint32_t(std::max(int64_t(y) - padding, int64_t(0))), height - 1);
+
+      for(uint32_t x = 0; x < rect.width; x++)
+      {
+        uint32_t sourceX = std::min(uint32_t(std::max(int64_t(x) - padding, int64_t(0))), width - 1);
+        memcpy(level0 + (size_t(y) * rect.width + x) * 4, pixels + (size_t(sourceY) * width + sourceX) * 4, 4);
+      }
+    }
+
+    for(uint32_t level = 1; level < mipLevels; level++)
+    {
+      const Level &source = block.levels[level - 1];
+      const Level &target = block.levels[level];
+      const uint8_t *in = block.pixels.data() + source.offset;
+      uint8_t *out = block.pixels.data() + target.offset;
+
+      for(uint32_t y = 0; y < target.height; y++)
+      {
+        for(uint32_t x = 0; x < target.width; x++)
+        {
+          const uint8_t *a = in + ((size_t(y) * 2) * source.width + x * 2) * 4;
+          const uint8_t *b = a + size_t(source.width) * 4;
+
+          for(uint32_t c = 0; c < 4; c++)
+          {
+            out[(size_t(y) * target.width + x) * 4 + c] = average(a, a + 4, b, b + 4, c);
+          }
+        }
+      }
+    }
+  }
+
+  uint32_t pageSize = 0;
+  uint32_t padding = 0;
+  uint32_t mipLevels = 1;
+  uint32_t maxPages = 0;
+  uint32_t alignment = 1;
+  bool srgb = false;
+  std::vector<SkylinePacker> pages;
+  std::optional<LastInsert> lastInsert;
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+#include "logger.hpp"
+
+/*
+  Pipeline barriers with or without synchronization2.
+
+  Barriers are always built as VkDependencyInfo with the *2 barrier structs.
+  With synchronization2 (core in 1.3, VK_KHR_synchronization2 before that)
+  record() hands them to vkCmdPipelineBarrier2 as they are. Otherwise every
+  barrier is translated to its 1.0 struct and they go out as one
+  vkCmdPipelineBarrier whose stage masks are the union of all of them: the
+  same dependencies, only less precise about which stages wait on which.
+
+  The entry point is loaded once per device, every recorder shares it.
+*/
+class PipelineBarriers
+{
+  public:
+  // entryPoint is "vkCmdPipelineBarrier2", "vkCmdPipelineBarrier2KHR", or
+  // null when the device has no synchronization2
+  static void init(VkDevice device, const char *entryPoint)
+  {
+    pipelineBarrier2 = nullptr;
+
+    if(entryPoint != nullptr)
+    {
+      pipelineBarrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2>(vkGetDeviceProcAddr(device, entryPoint));
+
+      if(pipelineBarrier2 == nullptr)
+      {
+        LOG_DEBUG("{} not found, translating barriers", entryPoint);
+      }
+    }
+  }
+
+  static bool isSynchronization2() { return pipelineBarrier2 != nullptr; }
+
+  static void record(VkCommandBuffer commandBuffer, const VkDependencyInfo &dependencyInfo)
+  {
+    if(pipelineBarrier2 != nullptr)
+    {
+      pipelineBarrier2(commandBuffer, &dependencyInfo);
+      return;
+    }
+
+    VkPipelineStageFlags2 srcStages = 0;
+    VkPipelineStageFlags2 dstStages = 0;
+
+    std::vector<VkMemoryBarrier> memoryBarriers(dependencyInfo.memoryBarrierCount);
+    for(uint32_t i = 0; i < dependencyInfo.memoryBarrierCount; i++)
+    {
+      const VkMemoryBarrier2 &barrier = dependencyInfo.pMemoryBarriers[i];
+      srcStages |= barrier.srcStageMask;
+      dstStages |= barrier.dstStageMask;
+
+      memoryBarriers[i].sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      memoryBarriers[i].pNext = nullptr;
+      memoryBarriers[i].srcAccessMask = toAccess(barrier.srcAccessMask);
+      memoryBarriers[i].dstAccessMask = toAccess(barrier.dstAccessMask);
+    }
+
+    std::vector<VkBufferMemoryBarrier> bufferBarriers(dependencyInfo.bufferMemoryBarrierCount);
+    for(uint32_t i = 0; i < dependencyInfo.bufferMemoryBarrierCount; i++)
+    {
+      const VkBufferMemoryBarrier2 &barrier = dependencyInfo.pBufferMemoryBarriers[i];
+      srcStages |= barrier.srcStageMask;
+      dstStages |= barrier.dstStageMask;
+
+      bufferBarriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      bufferBarriers[i].pNext = nullptr;
+      bufferBarriers[i].srcAccessMask = toAccess(barrier.srcAccessMask);
+      bufferBarriers[i].dstAccessMask = toAccess(barrier.dstAccessMask);
+      bufferBarriers[i].srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+      bufferBarriers[i].dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+      bufferBarriers[i].buffer = barrier.buffer;
+      bufferBarriers[i].offset = barrier.offset;
+      bufferBarriers[i].size = barrier.size;
+    }
+
+    std::vector<VkImageMemoryBarrier> imageBarriers(dependencyInfo.imageMemoryBarrierCount);
+    for(uint32_t i = 0; i < dependencyInfo.imageMemoryBarrierCount; i++)
+    {
+      const VkImageMemoryBarrier2 &barrier = dependencyInfo.pImageMemoryBarriers[i];
+      srcStages |= barrier.srcStageMask;
+      dstStages |= barrier.dstStageMask;
+
+      imageBarriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      imageBarriers[i].pNext = nullptr;
+      imageBarriers[i].srcAccessMask = toAccess(barrier.srcAccessMask);
+      imageBarriers[i].dstAccessMask = toAccess(barrier.dstAccessMask);
+      imageBarriers[i].oldLayout = barrier.oldLayout;
+      imageBarriers[i].newLayout = barrier.newLayout;
+      imageBarriers[i].srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+      imageBarriers[i].dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+      imageBarriers[i].image = barrier.image;
+      imageBarriers[i].subresourceRange = barrier.subresourceRange;
+    }
+
+    // NONE has no 1.0 equivalent, these wait on nothing and block nothing
+    VkPipelineStageFlags srcStageMask = srcStages != 0 ? toStages(srcStages) : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    VkPipelineStageFlags dstStageMask = dstStages != 0 ? toStages(dstStages) : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+
+    vkCmdPipelineBarrier(
+      commandBuffer, srcStageMask, dstStageMask, dependencyInfo.dependencyFlags,
+      static_cast<uint32_t>(memoryBarriers.size()), memoryBarriers.data(),
+      static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+      static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data()
+    );
+  }
+
+  private:
+  // The 1.0 stages keep their bit values, the split ones fold back into the stage they came from
+  static VkPipelineStageFlags toStages(VkPipelineStageFlags2 stages)
+  {
+    VkPipelineStageFlags legacy = static_cast<VkPipelineStageFlags>(stages & 0xFFFFFFFFull);
+
+    if(stages & (VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_BLIT_BIT | VK_PIPELINE_STAGE_2_RESOLVE_BIT | VK_PIPELINE_STAGE_2_CLEAR_BIT))
+    {
+      legacy |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+
+    if(stages & (VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT))
+    {
+      legacy |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    }
+
+    if(stages & VK_PIPELINE_STAGE_2_PRE_RASTERIZATION_SHADERS_BIT)
+    {
+      legacy |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+    }
+
+    return legacy;
+  }
+
+  static VkAccessFlags toAccess(VkAccessFlags2 access)
+  {
+    VkAccessFlags legacy = static_cast<VkAccessFlags>(access & 0xFFFFFFFFull);
+
+    if(access & (VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT))
+    {
+      legacy |= VK_ACCESS_SHADER_READ_BIT;
+    }
+
+    if(access & VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT)
+    {
+      legacy |= VK_ACCESS_SHADER_WRITE_BIT;
+    }
+
+    return legacy;
+  }
+
+  static inline PFN_vkCmdPipelineBarrier2 pipelineBarrier2 = nullptr;
+};
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include "logger.hpp"
+#include "threadpool.hpp"
+
+/*
+  Records secondary command buffers for one render pass on several threads.
+
+  Every frame in flight owns one command pool and one secondary per slice,
+  slices being at most the thread pool's workers plus the calling thread.
+  A pool is only ever recorded into by the thread that claimed its slice, so
+  no locking is needed around Vulkan calls, and resetFrame() recycles a whole
+  frame with one vkResetCommandPool per pool once its fence has signalled.
+
+  record() offers the slices to the workers and claims them itself as well,
+  so a pool busy with long tasks (texture decodes) slows recording down to
+  single threaded instead of stalling it.
+*/
+class ParallelRecorder
+{
+  public:
+  using RecordFunction = std::function<void(VkCommandBuffer commandBuffer, uint32_t slice)>;
+
+  void init(VkDevice device, uint32_t queueFamily, ThreadPool &threadPool, uint32_t frameCount)
+  {
+    this->device = device;
+    this->threadPool = &threadPool;
+    maxSlices = threadPool.getThreadCount() + 1;
+
+    frames.resize(frameCount);
+
+    for(Frame &frame : frames)
+    {
+      frame.pools.resize(maxSlices, VK_NULL_HANDLE);
+      frame.buffers.resize(maxSlices, VK_NULL_HANDLE);
+
+      for(uint32_t slice = 0; slice < maxSlices; slice++)
+      {
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = queueFamily;
+
+        if(vkCreateCommandPool(device, &poolInfo, nullptr, &frame.pools[slice]) != VK_SUCCESS)
+        {
+          LOG_DEBUG("Failed to create secondary command pool");
+          continue;
+        }
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = frame.pools[slice];
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+
+        if(vkAllocateCommandBuffers(device, &allocInfo, &frame.buffers[slice]) != VK_SUCCESS)
+        {
+          LOG_DEBUG("Failed to allocate secondary command buffer");
+        }
+      }
+    }
+
+    LOG_DEBUG("Recording secondaries in up to {} slices", maxSlices);
+  }
+
+  // No recording may be in progress
+  void destroy()
+  {
+    for(Frame &frame : frames)
+    {
+      for(VkCommandPool pool : frame.pools)
+      {
+        vkDestroyCommandPool(device, pool, nullptr);
+      }
+    }
+
+    frames.clear();
+  }
+
+  uint32_t getMaxSlices() const { return maxSlices; }
+
+  // Once the frame's previous submission has finished
+  void resetFrame(uint32_t frameIndex)
+  {
+    for(VkCommandPool pool : frames[frameIndex].pools)
+    {
+      vkResetCommandPool(device, pool, 0);
+    }
+  }
+
+  // Records sliceCount secondaries, slice i through recordSlice(buffer, i), and
+  // returns them in slice order once all are done
+  std::span<const VkCommandBuffer> record(uint32_t frameIndex, uint32_t sliceCount, const VkCommandBufferInheritanceInfo &inheritance, const RecordFunction &recordSlice)
+  {
+    Frame &frame = frames[frameIndex];
+    sliceCount = std::min(sliceCount, maxSlices);
+
+    if(sliceCount == 0)
+    {
+      return {};
+    }
+
+    // Shared with the worker tasks, a task that starts after every slice was
+    // claimed finds nothing left and drops its reference
+    auto job = std::make_shared<Job>();
+    job->recordSlice = recordSlice;
+    job->inheritance = inheritance;
+    job->buffers = frame.buffers.data();
+    job->sliceCount = sliceCount;
+    job->remaining = sliceCount;
+
+    for(uint32_t i = 1; i < sliceCount; i++)
+    {
+      threadPool->submit([job]() { run(*job); });
+    }
+
+    run(*job);
+
+    {
+      std::unique_lock<std::mutex> lock(job->mutex);
+      job->done.wait(lock, [&job]() { return job->remaining == 0; });
+    }
+
+    return {frame.buffers.data(), sliceCount};
+  }
+
+  private:
+  struct Frame
+  {
+    std::vector<VkCommandPool> pools;
+    std::vector<VkCommandBuffer> buffers;
+  };
+
+  struct Job
+  {
+    RecordFunction recordSlice;
+    VkCommandBufferInheritanceInfo inheritance;
+    VkCommandBuffer *buffers;
+    uint32_t sliceCount;
+    std::atomic<uint32_t> nextSlice{0};
+
+    std::mutex mutex;
+    std::condition_variable done;
+    uint32_t remaining;
+  };
+
+  static void run(Job &job)
+  {
+    for(uint32_t slice = job.nextSlice++; slice < job.sliceCount; slice = job.nextSlice++)
+    {
+      VkCommandBuffer commandBuffer = job.buffers[slice];
+
+      VkCommandBufferBeginInfo beginInfo{};
+      beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+      beginInfo.pInheritanceInfo = &job.inheritance;
+
+      if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+      {
+        LOG_DEBUG("Failed to begin recording secondary command buffer {}", slice);
+      }
+
+      job.recordSlice(commandBuffer, slice);
+
+      if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+      {
+        LOG_DEBUG("Failed to end recording secondary command buffer {}", slice);
+      }
+
+      std::lock_guard<std::mutex> lock(job.mutex);
+      if(--job.remaining == 0)
+      {
+        job.done.notify_all();
+      }
+    }
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  ThreadPool *threadPool = nullptr;
+  uint32_t maxSlices = 1;
+  std::vector<Frame> frames;
+};
@@ -0,0 +1,543 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <vector>
+
+#include "allocator.hpp"
+#include "barriers.hpp"
+#include "logger.hpp"
+#include "resources.hpp"
+
+/*
+  Frustum culling on the GPU with an indirect draw.
+
+  cull.comp reads the per-instance stream as a storage buffer, bounds every
+  instance with a circle around its translation, and copies the visible ones
+  to the front of a device local instance buffer. draw() binds that buffer as
+  the instance stream and issues a single VkDrawIndexedIndirectCommand with
+  vkCmdDrawIndexedIndirect, so neither multiDrawIndirect nor
+  drawIndirectCount is needed and the CPU cost per frame is the same for any
+  instance count.
+
+  The copy keeps the instances in submission order, the instanced pipelines
+  blend and depth test with LESS_OR_EQUAL and overlapping instances would
+  flicker otherwise. That takes three passes of the same shader: one marks
+  the visible instances of every workgroup in a bit mask, a single workgroup
+  scans the mask counts into offsets and writes the draw command, and the
+  last copies every visible instance to its offset plus the visible ones
+  ahead of it in its mask.
+
+  The frustum and instance count live in a per-frame parameter buffer, and
+  the workgroup count of the first and last pass in a per-frame
+  VkDispatchIndirectCommand, both written by update(). The commands from
+  record() and draw() never change and can be kept in command buffers that
+  are recorded once.
+
+  The scan pass's count is also copied to a host visible buffer, so debug
+  builds can compare it against a CPU reference built on isVisible() once
+  the frame's fence has signalled.
+*/
+class GpuCuller
+{
+  public:
+  struct Frustum
+  {
+    glm::vec4 planes[6]; // Normalized, inside where dot(xyz, p) + w >= 0
+  };
+
+  // Planes of clip space (Vulkan depth range) in the space matrix maps from
+  static Frustum extractFrustum(const glm::mat4 &matrix)
+  {
+    glm::vec4 row0(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0]);
+    glm::vec4 row1(matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1]);
+    glm::vec4 row2(matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2]);
+    glm::vec4 row3(matrix[0][3], matrix[1][3], matrix[2][3], matrix[3][3]);
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0;
+    frustum.planes[1] = row3 - row0;
+    frustum.planes[2] = row3 + row1;
+    frustum.planes[3] = row3 - row1;
+    frustum.planes[4] = row2;
+    frustum.planes[5] = row3 - row2;
+
+    for(glm::vec4 &plane : frustum.planes)
+    {
+      plane /= glm::length(glm::vec3(plane));
+    }
+
+    return frustum;
+  }
+
+  // Same test as cull.comp, a circle in the z = 0 plane against every plane
+  static bool isVisible(const Frustum &frustum, glm::vec2 center, float radius)
+  {
+    for(const glm::vec4 &plane : frustum.planes)
+    {
+      if(plane.x * center.x + plane.y * center.y + plane.w < -radius)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // Bounding radius of a mesh within [-extent, extent] squared after a 2x2 transform
+  static float boundingRadius(glm::vec4 transform, float extent)
+  {
+    return extent * (glm::length(glm::vec2(transform.x, transform.y)) + glm::length(glm::vec2(transform.z, transform.w)));
+  }
+
+  // instanceBuffers holds one instance stream per frame in flight, instanceStride is in bytes
+  bool init(
+    VkDevice device, DeviceAllocator &allocator, DeletionQueue &deletionQueue, VkPipelineCache pipelineCache, std::span<const char> computeShaderCode,
+    std::span<const VkBuffer> instanceBuffers, uint32_t instanceStride, uint32_t maxInstances
+  )
+  {
+    this->device = device;
+    this->allocator = &allocator;
+    this->deletionQueue = &deletionQueue;
+    this->instanceStride = instanceStride;
+    this->maxInstances = maxInstances;
+
+    if(computeShaderCode.empty())
+    {
+      LOG_DEBUG("Cull compute shader missing, culling stays on the CPU");
+      return false;
+    }
+
+    if(!createPipeline(pipelineCache, computeShaderCode, instanceStride))
+    {
+      return false;
+    }
+
+    frames.resize(instanceBuffers.size());
+
+    if(!createDescriptorPool(static_cast<uint32_t>(frames.size())))
+    {
+      return false;
+    }
+
+    for(size_t i = 0; i < frames.size(); i++)
+    {
+      if(!createFrame(frames[i], instanceBuffers[i]))
+      {
+        return false;
+      }
+    }
+
+    enabled = true;
+    LOG_DEBUG("GPU culling enabled for up to {} instances", maxInstances);
+
+    return true;
+  }
+
+  // Buffers, pool and pipeline go to the deletion queue. The layouts go
+  // now, recorded commands don't need them.
+  void destroy()
+  {
+    frames.clear();
+
+    descriptorPool.reset();
+    for(Pipeline &passPipeline : pipelines)
+    {
+      passPipeline.reset();
+    }
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+
+    pipelineLayout = VK_NULL_HANDLE;
+    descriptorSetLayout = VK_NULL_HANDLE;
+    enabled = false;
+  }
+
+  bool isEnabled() const { return enabled; }
+
+  // Every frame before submitting its commands, once its fence has signalled
+  void update(uint32_t frameIndex, const Frustum &frustum, uint32_t instanceCount, uint32_t indexCount, uint32_t firstIndex, int32_t vertexOffset, float meshExtent)
+  {
+    Frame &frame = frames[frameIndex];
+    frame.frustum = frustum;
+    frame.instanceCount = std::min(instanceCount, maxInstances);
+    frame.updated = true;
+
+    Params params{};
+    for(int i = 0; i < 6; i++)
+    {
+      params.planes[i] = frustum.planes[i];
+    }
+    params.instanceCount = frame.instanceCount;
+    params.indexCount = indexCount;
+    params.capacity = maxInstances;
+    params.meshExtent = meshExtent;
+    params.firstIndex = firstIndex;
+    params.vertexOffset = vertexOffset;
+
+    memcpy(frame.paramsBuffer.getAllocation().mapped, &params, sizeof(params));
+
+    VkDispatchIndirectCommand dispatch{};
+    dispatch.x = (params.instanceCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+    dispatch.y = 1;
+    dispatch.z = 1;
+
+    memcpy(frame.dispatchBuffer.getAllocation().mapped, &dispatch, sizeof(dispatch));
+  }
+
+  // Outside a render pass, before draw() for the same frame
+  void record(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+  {
+    Frame &frame = frames[frameIndex];
+
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[MARK_PASS].get());
+    vkCmdDispatchIndirect(commandBuffer, frame.dispatchBuffer.get(), 0);
+
+    barrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT
+    );
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[SCAN_PASS].get());
+    vkCmdDispatch(commandBuffer, 1, 1, 1);
+
+    barrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_TRANSFER_READ_BIT
+    );
+
+    VkBufferCopy countCopy{};
+    countCopy.srcOffset = offsetof(VkDrawIndexedIndirectCommand, instanceCount);
+    countCopy.size = sizeof(uint32_t);
+    vkCmdCopyBuffer(commandBuffer, frame.commandBuffer.get(), frame.countBuffer.get(), 1, &countCopy);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[COPY_PASS].get());
+    vkCmdDispatchIndirect(commandBuffer, frame.dispatchBuffer.get(), 0);
+
+    barrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT
+    );
+
+    barrier(
+      commandBuffer,
+      VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT
+    );
+  }
+
+  // Inside the render pass, with the pipeline and buffers of the instanced draw
+  // bound. Rebinds instanceBinding to the visible instances.
+  void draw(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t instanceBinding)
+  {
+    Frame &frame = frames[frameIndex];
+
+    VkDeviceSize offset = 0;
+    VkBuffer visibleBuffer = frame.visibleBuffer.get();
+    vkCmdBindVertexBuffers(commandBuffer, instanceBinding, 1, &visibleBuffer, &offset);
+    vkCmdDrawIndexedIndirect(commandBuffer, frame.commandBuffer.get(), 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+  }
+
+  // Visible instances the last submission of this frame found, only valid once its fence signalled
+  uint32_t getVisibleCount(uint32_t frameIndex) const
+  {
+    return *static_cast<const uint32_t*>(frames[frameIndex].countBuffer.getAllocation().mapped);
+  }
+
+  bool hasResult(uint32_t frameIndex) const { return enabled && frames[frameIndex].updated; }
+  const Frustum &getFrustum(uint32_t frameIndex) const { return frames[frameIndex].frustum; }
+  uint32_t getInstanceCount(uint32_t frameIndex) const { return frames[frameIndex].instanceCount; }
+
+  private:
+  static constexpr uint32_t WORKGROUP_SIZE = 64;
+
+  // constant_id 1 PASS in cull.comp
+  enum Pass
+  {
+    MARK_PASS,
+    SCAN_PASS,
+    COPY_PASS,
+    PASS_COUNT
+  };
+
+  // Instances, visible instances, command, params, groups
+  static constexpr uint32_t BINDING_COUNT = 5;
+  static constexpr VkDescriptorType descriptorTypes[BINDING_COUNT] = {
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+  };
+
+  // Matches a uvec4 of the Groups buffer in cull.comp
+  struct Group
+  {
+    uint32_t visibleMask[2];
+    uint32_t offset;
+    uint32_t padding;
+  };
+
+  // Matches the Params uniform block in cull.comp
+  struct Params
+  {
+    glm::vec4 planes[6];
+    uint32_t instanceCount;
+    uint32_t indexCount;
+    uint32_t capacity;
+    float meshExtent;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+  };
+
+  struct Frame
+  {
+    Buffer visibleBuffer;
+    Buffer commandBuffer;
+    Buffer paramsBuffer;
+    Buffer dispatchBuffer;
+    Buffer groupsBuffer;
+    Buffer countBuffer;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+    Frustum frustum{};
+    uint32_t instanceCount = 0;
+    bool updated = false;
+  };
+
+  static void barrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess)
+  {
+    VkMemoryBarrier2 memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    memoryBarrier.srcStageMask = srcStage;
+    memoryBarrier.srcAccessMask = srcAccess;
+    memoryBarrier.dstStageMask = dstStage;
+    memoryBarrier.dstAccessMask = dstAccess;
+
+    VkDependencyInfo dependencyInfo{};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.memoryBarrierCount = 1;
+    dependencyInfo.pMemoryBarriers = &memoryBarrier;
+
+    PipelineBarriers::record(commandBuffer, dependencyInfo);
+  }
+
+  bool createPipeline(VkPipelineCache pipelineCache, std::span<const char> computeShaderCode, uint32_t instanceStride)
+  {
+    VkDescriptorSetLayoutBinding bindings[BINDING_COUNT]{};
+    for(uint32_t i = 0; i < BINDING_COUNT; i++)
+    {
+      bindings[i].binding = i;
+      bindings[i].descriptorType = descriptorTypes[i];
+      bindings[i].descriptorCount = 1;
+      bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = BINDING_COUNT;
+    layoutInfo.pBindings = bindings;
+
+    if(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create cull descriptor set layout");
+      return false;
+    }
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+
+    if(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create cull pipeline layout");
+      return false;
+    }
+
+    VkShaderModuleCreateInfo moduleInfo{};
+    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleInfo.codeSize = computeShaderCode.size();
+    moduleInfo.pCode = reinterpret_cast<const uint32_t*>(computeShaderCode.data());
+
+    VkShaderModule shaderModule;
+    if(vkCreateShaderModule(device, &moduleInfo, nullptr, &shaderModule) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create cull shader module");
+      return false;
+    }
+
+    // constant_id 0 INSTANCE_STRIDE in 32 bit words, 1 PASS
+    VkSpecializationMapEntry mapEntries[2]{};
+    for(uint32_t i = 0; i < 2; i++)
+    {
+      mapEntries[i].constantID = i;
+      mapEntries[i].offset = i * sizeof(uint32_t);
+      mapEntries[i].size = sizeof(uint32_t);
+    }
+
+    for(uint32_t pass = 0; pass < PASS_COUNT; pass++)
+    {
+      uint32_t specializationData[2] = {instanceStride / static_cast<uint32_t>(sizeof(uint32_t)), pass};
+
+      VkSpecializationInfo specialization{};
+      specialization.mapEntryCount = 2;
+      specialization.pMapEntries = mapEntries;
+      specialization.dataSize = sizeof(specializationData);
+      specialization.pData = specializationData;
+
+      VkComputePipelineCreateInfo pipelineInfo{};
+      pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+      pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+      pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+      pipelineInfo.stage.module = shaderModule;
+      pipelineInfo.stage.pName = "main";
+      pipelineInfo.stage.pSpecializationInfo = &specialization;
+      pipelineInfo.layout = pipelineLayout;
+
+      VkPipeline computePipeline;
+      if(vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS)
+      {
+        LOG_DEBUG("Failed to create cull compute pipeline for pass {}", pass);
+        vkDestroyShaderModule(device, shaderModule, nullptr);
+        return false;
+      }
+
+      pipelines[pass] = Pipeline(*deletionQueue, computePipeline);
+    }
+
+    vkDestroyShaderModule(device, shaderModule, nullptr);
+    return true;
+  }
+
+  bool createDescriptorPool(uint32_t frameCount)
+  {
+    VkDescriptorPoolSize poolSizes[2]{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[0].descriptorCount = 4 * frameCount;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[1].descriptorCount = frameCount;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = frameCount;
+
+    VkDescriptorPool pool;
+    if(vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create cull descriptor pool");
+      return false;
+    }
+
+    descriptorPool = DescriptorPool(*deletionQueue, pool);
+    return true;
+  }
+
+  bool createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, Buffer &buffer)
+  {
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkBuffer handle;
+    if(vkCreateBuffer(device, &bufferInfo, nullptr, &handle) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create cull buffer");
+      return false;
+    }
+
+    GpuAllocation allocation;
+    bool allocated = allocator->allocateBuffer(handle, properties, allocation);
+    buffer = Buffer(*deletionQueue, handle, allocation);
+
+    if(!allocated)
+    {
+      LOG_DEBUG("Failed to allocate cull buffer memory");
+      return false;
+    }
+
+    return true;
+  }
+
+  bool createFrame(Frame &frame, VkBuffer instanceBuffer)
+  {
+    if(
+      !createBuffer(VkDeviceSize(instanceStride) * maxInstances, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.visibleBuffer) ||
+      !createBuffer(sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.commandBuffer) ||
+      !createBuffer(sizeof(Params), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.paramsBuffer) ||
+      !createBuffer(sizeof(VkDispatchIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.dispatchBuffer) ||
+      !createBuffer(sizeof(Group) * VkDeviceSize((maxInstances + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.groupsBuffer) ||
+      !createBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.countBuffer)
+    )
+    {
+      return false;
+    }
+
+    // Nothing to cull until the first update()
+    memset(frame.paramsBuffer.getAllocation().mapped, 0, sizeof(Params));
+    memset(frame.dispatchBuffer.getAllocation().mapped, 0, sizeof(VkDispatchIndirectCommand));
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool.get();
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &descriptorSetLayout;
+
+    if(vkAllocateDescriptorSets(device, &allocInfo, &frame.descriptorSet) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to allocate cull descriptor set");
+      return false;
+    }
+
+    VkDescriptorBufferInfo bufferInfos[BINDING_COUNT]{};
+    bufferInfos[0] = {instanceBuffer, 0, VK_WHOLE_SIZE};
+    bufferInfos[1] = {frame.visibleBuffer.get(), 0, VK_WHOLE_SIZE};
+    bufferInfos[2] = {frame.commandBuffer.get(), 0, VK_WHOLE_SIZE};
+    bufferInfos[3] = {frame.paramsBuffer.get(), 0, VK_WHOLE_SIZE};
+    bufferInfos[4] = {frame.groupsBuffer.get(), 0, VK_WHOLE_SIZE};
+
+    VkWriteDescriptorSet descriptorWrites[BINDING_COUNT]{};
+    for(uint32_t i = 0; i < BINDING_COUNT; i++)
+    {
+      descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[i].dstSet = frame.descriptorSet;
+      descriptorWrites[i].dstBinding = i;
+      descriptorWrites[i].descriptorType = descriptorTypes[i];
+      descriptorWrites[i].descriptorCount = 1;
+      descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+    }
+
+    vkUpdateDescriptorSets(device, BINDING_COUNT, descriptorWrites, 0, nullptr);
+
+    return true;
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator *allocator = nullptr;
+  DeletionQueue *deletionQueue = nullptr;
+  bool enabled = false;
+  uint32_t instanceStride = 0;
+  uint32_t maxInstances = 0;
+
+  VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  Pipeline pipelines[PASS_COUNT];
+  DescriptorPool descriptorPool;
+
+  std::vector<Frame> frames;
+};
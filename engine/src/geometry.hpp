@@ -0,0 +1,250 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "allocator.hpp"
+
+/*
+  Shared vertex and index arena for every mesh.
+
+  The caller owns one vertex buffer and one index buffer sized for
+  maxVertices and maxIndices; GeometryArena only does the bookkeeping. Each
+  mesh is a range of vertices and a range of indices sub allocated with
+  RangeAllocator, drawn with vkCmdDrawIndexed(indexCount, ..., firstIndex,
+  firstVertex) after one bind of both buffers. Indices stay local to their
+  mesh, vertexOffset moves them onto its vertices.
+
+  Freed ranges are only reused once every frame in flight that could still
+  read them has finished. compact() moves meshes into lower holes so free
+  space merges back into large ranges; it returns the copies for the caller
+  to record and bumps the generation, since recorded draws bake the offsets.
+*/
+class GeometryArena
+{
+  public:
+  static constexpr uint32_t INVALID_MESH = UINT32_MAX;
+
+  struct Mesh
+  {
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+  };
+
+  // In vertices or indices, source and target never overlap
+  struct Copy
+  {
+    uint32_t source;
+    uint32_t target;
+    uint32_t count;
+  };
+
+  void init(uint32_t maxVertices, uint32_t maxIndices, uint32_t framesInFlight)
+  {
+    this->framesInFlight = framesInFlight;
+
+    vertexRanges.init(maxVertices);
+    indexRanges.init(maxIndices);
+
+    meshes.clear();
+    live.clear();
+    freeMeshes.clear();
+    releasedMeshes.clear();
+    fragmented = false;
+  }
+
+  // INVALID_MESH when either arena has no range left that fits
+  uint32_t allocate(uint32_t vertexCount, uint32_t indexCount)
+  {
+    VkDeviceSize firstVertex = vertexRanges.allocate(vertexCount, 1);
+    if(firstVertex == RangeAllocator::INVALID_OFFSET)
+    {
+      return INVALID_MESH;
+    }
+
+    VkDeviceSize firstIndex = indexRanges.allocate(indexCount, 1);
+    if(firstIndex == RangeAllocator::INVALID_OFFSET)
+    {
+      vertexRanges.free(firstVertex, vertexCount);
+      return INVALID_MESH;
+    }
+
+    uint32_t mesh;
+    if(freeMeshes.empty())
+    {
+      mesh = static_cast<uint32_t>(meshes.size());
+      meshes.emplace_back();
+      live.push_back(false);
+    }
+    else
+    {
+      mesh = freeMeshes.back();
+      freeMeshes.pop_back();
+    }
+
+    meshes[mesh] = {static_cast<uint32_t>(firstVertex), vertexCount, static_cast<uint32_t>(firstIndex), indexCount};
+    live[mesh] = true;
+
+    return mesh;
+  }
+
+  // The ranges stay reserved until frame frameNumber + framesInFlight begins
+  void free(uint32_t mesh, uint64_t frameNumber)
+  {
+    if(mesh == INVALID_MESH || !live[mesh])
+    {
+      return;
+    }
+
+    const Mesh &ranges = meshes[mesh];
+    release(ranges.firstVertex, ranges.vertexCount, ranges.firstIndex, ranges.indexCount, frameNumber);
+
+    live[mesh] = false;
+    freeMeshes.push_back(mesh);
+  }
+
+  // Call at the start of every frame, after its fence has signalled, with the
+  // number of frames submitted so far
+  void beginFrame(uint64_t frameNumber)
+  {
+    while(!releasedMeshes.empty() && releasedMeshes.front().reusableFrame <= frameNumber)
+    {
+      const ReleasedMesh &released = releasedMeshes.front();
+
+      if(released.vertexCount > 0)
+      {
+        vertexRanges.free(released.firstVertex, released.vertexCount);
+      }
+
+      if(released.indexCount > 0)
+      {
+        indexRanges.free(released.firstIndex, released.indexCount);
+      }
+
+      fragmented = true;
+
+      releasedMeshes.pop_front();
+    }
+  }
+
+  const Mesh &getMesh(uint32_t mesh) const { return meshes[mesh]; }
+
+  // Whether freed ranges left holes compact() may be able to close
+  bool isFragmented() const { return fragmented; }
+
+  // Changes whenever a mesh moved
+  uint64_t getGeneration() const { return generation; }
+
+  // Moves every mesh that fits into a lower hole there, appending the copies
+  // the caller must record before any draw using the new offsets. The ranges
+  // moved out of are released like free() does, so space one mesh vacates
+  // is only filled by a later compact(). False when nothing moved.
+  bool compact(uint64_t frameNumber, std::vector<Copy> &vertexCopies, std::vector<Copy> &indexCopies)
+  {
+    fragmented = false;
+
+    std::vector<uint32_t> order;
+    for(uint32_t mesh = 0; mesh < meshes.size(); mesh++)
+    {
+      if(live[mesh])
+      {
+        order.push_back(mesh);
+      }
+    }
+
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+      return meshes[a].firstVertex < meshes[b].firstVertex;
+    });
+
+    bool moved = false;
+
+    for(uint32_t mesh : order)
+    {
+      Mesh &ranges = meshes[mesh];
+      Mesh previous = ranges;
+
+      // First fit hands out the lowest hole, free space never overlaps a live mesh
+      moved |= moveDown(vertexRanges, ranges.firstVertex, ranges.vertexCount, vertexCopies);
+      moved |= moveDown(indexRanges, ranges.firstIndex, ranges.indexCount, indexCopies);
+
+      if(ranges.firstVertex != previous.firstVertex || ranges.firstIndex != previous.firstIndex)
+      {
+        // Each range is only released when it actually moved
+        release(
+          previous.firstVertex, ranges.firstVertex != previous.firstVertex ? previous.vertexCount : 0,
+          previous.firstIndex, ranges.firstIndex != previous.firstIndex ? previous.indexCount : 0,
+          frameNumber
+        );
+      }
+    }
+
+    if(moved)
+    {
+      generation++;
+    }
+
+    return moved;
+  }
+
+  VkDeviceSize getUsedVertices() const { return vertexRanges.getUsed(); }
+  VkDeviceSize getUsedIndices() const { return indexRanges.getUsed(); }
+
+  private:
+  struct ReleasedMesh
+  {
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint64_t reusableFrame;
+  };
+
+  void release(uint32_t firstVertex, uint32_t vertexCount, uint32_t firstIndex, uint32_t indexCount, uint64_t frameNumber)
+  {
+    releasedMeshes.push_back({firstVertex, vertexCount, firstIndex, indexCount, frameNumber + framesInFlight});
+  }
+
+  static bool moveDown(RangeAllocator &ranges, uint32_t &first, uint32_t count, std::vector<Copy> &copies)
+  {
+    if(count == 0)
+    {
+      return false;
+    }
+
+    VkDeviceSize target = ranges.allocate(count, 1);
+
+    if(target == RangeAllocator::INVALID_OFFSET)
+    {
+      return false;
+    }
+
+    if(target > first)
+    {
+      ranges.free(target, count);
+      return false;
+    }
+
+    copies.push_back({first, static_cast<uint32_t>(target), count});
+    first = static_cast<uint32_t>(target);
+
+    return true;
+  }
+
+  uint32_t framesInFlight = 0;
+  bool fragmented = false;
+  uint64_t generation = 0;
+
+  RangeAllocator vertexRanges;
+  RangeAllocator indexRanges;
+
+  std::vector<Mesh> meshes;
+  std::vector<bool> live;
+  std::vector<uint32_t> freeMeshes;
+  std::deque<ReleasedMesh> releasedMeshes;
+};
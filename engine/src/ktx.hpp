@@ -0,0 +1,263 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "logger.hpp"
+
+/*
+  Minimal KTX2 reader for textures that are already block compressed
+  (BC, ETC2, ASTC). The level data is left where it is in the file so it can
+  be copied to staging memory in one go; levels are stored smallest first and
+  contiguous, aligned to the texel block size.
+
+  Basis Universal payloads (vkFormat UNDEFINED) and supercompressed files are
+  rejected, the caller falls back to decoding a regular image instead. So
+  are files whose level count or level sizes don't match the mip chain of
+  their extent, those would turn into copies past the staged data.
+*/
+struct KtxLevel
+{
+  uint64_t offset; // From the start of the file
+  uint64_t size;
+};
+
+struct KtxTexture
+{
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<KtxLevel> levels; // levels[0] is the full resolution image
+
+  // Byte range holding every level
+  uint64_t dataOffset = 0;
+  uint64_t dataSize = 0;
+};
+
+struct KtxBlock
+{
+  uint32_t width;
+  uint32_t height;
+  uint32_t bytes;
+};
+
+// Block layout of the compressed formats parseKtx2() accepts, false for any other
+inline bool getKtxBlock(VkFormat format, KtxBlock &block)
+{
+  switch(format)
+  {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+    case VK_FORMAT_EAC_R11_UNORM_BLOCK:
+    case VK_FORMAT_EAC_R11_SNORM_BLOCK:
+    block = {4, 4, 8};
+    return true;
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC5_SNORM_BLOCK:
+    case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+    case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+    case VK_FORMAT_EAC_R11G11_UNORM_BLOCK:
+    case VK_FORMAT_EAC_R11G11_SNORM_BLOCK:
+    case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+    block = {4, 4, 16};
+    return true;
+    case VK_FORMAT_ASTC_5x4_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_5x4_SRGB_BLOCK:
+    block = {5, 4, 16};
+    return true;
+    case VK_FORMAT_ASTC_5x5_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_5x5_SRGB_BLOCK:
+    block = {5, 5, 16};
+    return true;
+    case VK_FORMAT_ASTC_6x5_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_6x5_SRGB_BLOCK:
+    block = {6, 5, 16};
+    return true;
+    case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
+    block = {6, 6, 16};
+    return true;
+    case VK_FORMAT_ASTC_8x5_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_8x5_SRGB_BLOCK:
+    block = {8, 5, 16};
+    return true;
+    case VK_FORMAT_ASTC_8x6_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_8x6_SRGB_BLOCK:
+    block = {8, 6, 16};
+    return true;
+    case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
+    block = {8, 8, 16};
+    return true;
+    case VK_FORMAT_ASTC_10x5_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_10x5_SRGB_BLOCK:
+    block = {10, 5, 16};
+    return true;
+    case VK_FORMAT_ASTC_10x6_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_10x6_SRGB_BLOCK:
+    block = {10, 6, 16};
+    return true;
+    case VK_FORMAT_ASTC_10x8_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_10x8_SRGB_BLOCK:
+    block = {10, 8, 16};
+    return true;
+    case VK_FORMAT_ASTC_10x10_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_10x10_SRGB_BLOCK:
+    block = {10, 10, 16};
+    return true;
+    case VK_FORMAT_ASTC_12x10_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_12x10_SRGB_BLOCK:
+    block = {12, 10, 16};
+    return true;
+    case VK_FORMAT_ASTC_12x12_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_12x12_SRGB_BLOCK:
+    block = {12, 12, 16};
+    return true;
+    default:
+    return false;
+  }
+}
+
+inline bool parseKtx2(const void *data, size_t size, KtxTexture &texture)
+{
+  static const uint8_t identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+  struct Header
+  {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+  };
+
+  const uint8_t *bytes = static_cast<const uint8_t*>(data);
+
+  Header header;
+  if(size < sizeof(Header))
+  {
+    return false;
+  }
+
+  memcpy(&header, bytes, sizeof(Header));
+
+  if(memcmp(header.identifier, identifier, sizeof(identifier)) != 0)
+  {
+    LOG_DEBUG("Not a KTX2 file");
+    return false;
+  }
+
+  if(header.vkFormat == VK_FORMAT_UNDEFINED || header.supercompressionScheme != 0)
+  {
+    LOG_DEBUG("KTX2 file needs transcoding or decompression, not supported");
+    return false;
+  }
+
+  if(header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1)
+  {
+    LOG_DEBUG("Only 2D KTX2 textures are supported");
+    return false;
+  }
+
+  KtxBlock block;
+  if(!getKtxBlock(static_cast<VkFormat>(header.vkFormat), block))
+  {
+    LOG_DEBUG("KTX2 format {} is not a supported block compressed format", header.vkFormat);
+    return false;
+  }
+
+  if(header.pixelWidth == 0 || header.pixelHeight == 0)
+  {
+    LOG_DEBUG("KTX2 texture has no extent");
+    return false;
+  }
+
+  uint32_t maxLevels = 1;
+  while((std::max(header.pixelWidth, header.pixelHeight) >> maxLevels) != 0)
+  {
+    maxLevels++;
+  }
+
+  uint32_t levelCount = header.levelCount == 0 ? 1 : header.levelCount;
+  if(levelCount > maxLevels)
+  {
+    LOG_DEBUG("KTX2 file has {} levels, a {}x{} image has at most {}", levelCount, header.pixelWidth, header.pixelHeight, maxLevels);
+    return false;
+  }
+
+  if(size < sizeof(Header) + levelCount * sizeof(uint64_t) * 3)
+  {
+    return false;
+  }
+
+  texture.format = static_cast<VkFormat>(header.vkFormat);
+  texture.width = header.pixelWidth;
+  texture.height = header.pixelHeight;
+  texture.levels.resize(levelCount);
+
+  uint64_t begin = UINT64_MAX;
+  uint64_t end = 0;
+
+  for(uint32_t i = 0; i < levelCount; i++)
+  {
+    uint64_t entry[3]; // byteOffset, byteLength, uncompressedByteLength
+    memcpy(entry, bytes + sizeof(Header) + i * sizeof(entry), sizeof(entry));
+
+    // Without adding them, a corrupt offset could wrap around
+    if(entry[0] > size || entry[1] > size - entry[0])
+    {
+      LOG_DEBUG("KTX2 level {} is out of bounds", i);
+      return false;
+    }
+
+    uint64_t blocksX = (std::max(header.pixelWidth >> i, 1u) + block.width - 1) / block.width;
+    uint64_t blocksY = (std::max(header.pixelHeight >> i, 1u) + block.height - 1) / block.height;
+
+    if(entry[1] != blocksX * blocksY * block.bytes)
+    {
+      LOG_DEBUG("KTX2 level {} holds {} bytes, its extent needs {}", i, entry[1], blocksX * blocksY * block.bytes);
+      return false;
+    }
+
+    texture.levels[i] = {entry[0], entry[1]};
+    begin = std::min(begin, entry[0]);
+    end = std::max(end, entry[0] + entry[1]);
+  }
+
+  texture.dataOffset = begin;
+  texture.dataSize = end - begin;
+
+  return true;
+}
@@ -21,49 +21,59 @@ struct android_app;
 #include <set>
 #include <limits>
 #include <algorithm>
-#include <fstream>
+#include <span>
 #include <array>
+#include <cstring>
+#include <utility>
 
 #include <chrono>
 
 #include "logger.hpp"
-
-struct Vertex {
-  glm::vec2 pos;
-  glm::vec3 color;
-  glm::vec2 texCoord;
+#include "allocator.hpp"
+#include "barriers.hpp"
+#include "staging.hpp"
+#include "upload.hpp"
+#include "mipmap.hpp"
+#include "ktx.hpp"
+#include "threadpool.hpp"
+#include "texture_loader.hpp"
+#include "archive.hpp"
+#include "pipeline_cache.hpp"
+#include "pipelines.hpp"
+#include "culling.hpp"
+#include "command_recorder.hpp"
+#include "texture_table.hpp"
+#include "vertex.hpp"
+#include "sprites.hpp"
+#include "atlas.hpp"
+#include "geometry.hpp"
+#include "resolution.hpp"
+#include "pacing.hpp"
+#include "resources.hpp"
+#include "settings.hpp"
+
+// Per instance 2D affine transform applied before the UBO matrices, plus the
+// rectangle of the texture the instance samples (offset in xy, size in zw)
+struct InstanceData {
+  glm::vec4 transform; // Columns of a 2x2 matrix
+  glm::vec2 translation;
+  glm::vec4 uvRect;
+  uint32_t textureIndex; // Slot in the bindless texture table, ignored without one
+
+  using Layout = VertexLayout<Float4Attribute, Float2Attribute, Float4Attribute, UintAttribute>;
 
   static VkVertexInputBindingDescription getBindingDescription() {
-    VkVertexInputBindingDescription bindingDescription{};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-    return bindingDescription;
+    return Layout::getBindingDescription(1, VK_VERTEX_INPUT_RATE_INSTANCE);
   }
 
-  static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
-    std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
-
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(Vertex, pos);
-
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(Vertex, color);
-
-    attributeDescriptions[2].binding = 0;
-    attributeDescriptions[2].location = 2;
-    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
-
-    return attributeDescriptions;
+  // Locations 0 to 2 belong to PackedVertex
+  static std::array<VkVertexInputAttributeDescription, Layout::attributeCount> getAttributeDescriptions() {
+    return Layout::getAttributeDescriptions(1, 3);
   }
 };
 
+static_assert(sizeof(InstanceData) == InstanceData::Layout::stride, "InstanceData members must match its layout");
+
 const std::vector<Vertex> vertices = {
   {{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}, {1.0f, 0.0f}},
   {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f}},
@@ -75,6 +85,9 @@ const std::vector<uint16_t> indices = {
   0, 1, 2, 2, 3, 0
 };
 
+// The quad above fits in [-meshExtent, meshExtent] squared, instances are culled against that
+const float meshExtent = 0.5f;
+
 struct UniformBufferObject {
   alignas(16) glm::mat4 model;
   alignas(16) glm::mat4 view;
@@ -89,7 +102,22 @@ std::vector<const char*> validationLayers = {
   "VK_LAYER_KHRONOS_validation"
 };
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
+const int MAX_FRAMES_IN_FLIGHT = 3; // Per frame resources are made for this many, the latency mode may use fewer
+const uint32_t MAX_INSTANCES = 262144;
+const uint32_t INSTANCE_GRID_SIZE = 100; // The quad is drawn as a grid of this many tiles squared
+const uint32_t MIN_INSTANCES_PER_SLICE = 1024; // Smaller slices cost more to hand out than to record
+const uint32_t MAX_SPRITES = 100000;
+const uint32_t SPRITE_RING_SIZE = 64; // Sprites circling the grid
+const uint32_t ATLAS_PAGE_SIZE = 2048;
+const uint32_t ATLAS_PADDING = 8; // Bleed around every image, one texel left at the last level
+const uint32_t ATLAS_MIP_LEVELS = 4;
+const uint32_t ATLAS_MAX_PAGES = 8;
+const uint32_t ATLAS_MAX_IMAGE_SIZE = 512; // Larger images get an image of their own
+const uint32_t GEOMETRY_MAX_VERTICES = 1 << 20;
+const uint32_t GEOMETRY_MAX_INDICES = 1 << 22;
+const float TARGET_FRAME_MILLISECONDS = 1000.0f / 60.0f; // GPU budget dynamic resolution aims for
+const float MIN_RENDER_SCALE = 0.5f;
+const uint64_t PRESENT_WAIT_TIMEOUT = 100000000; // ns, a hidden window never presents
 
 #ifdef NDEBUG
 bool enableValidationLayers = false;
@@ -97,10 +125,39 @@ bool enableValidationLayers = false;
 bool enableValidationLayers = true;
 #endif
 
+// Render straight into the swapchain image views when the device can,
+// false keeps the render pass and framebuffers. Setting dynamic_rendering.
+bool preferDynamicRendering = true;
+
+// Replay each swapchain image's command buffer while nothing changed instead
+// of re-recording it. Low end phone cores gain most from not recording at
+// all, desktops from recording wide. Setting cache_command_buffers.
+#ifdef __ANDROID__
+bool cacheCommandBuffers = true;
+#else
+bool cacheCommandBuffers = false;
+#endif
+
+// Highest MSAA sample count to render with, lowered to what the device supports
+VkSampleCountFlagBits preferredSampleCount = VK_SAMPLE_COUNT_4_BIT;
+
+// Lower the render resolution while the GPU misses the frame budget, needs timestamps
+bool enableDynamicResolution = true;
+
+// Present mode, swapchain image count and frames in flight, see pacing.hpp.
+// Setting latency_mode, the L key cycles through the modes on desktop.
+LatencyMode latencyMode = LatencyMode::Throughput;
+
+// Frames per second the CPU is capped at, 0 leaves pacing to the present mode.
+// Setting frame_rate_limit, the F key cycles through FRAME_RATE_LIMITS on desktop.
+uint32_t frameRateLimit = 0;
+const uint32_t FRAME_RATE_LIMITS[] = {0, 30, 60};
+
 struct QueueFamilyIndices
 {
   std::optional<uint32_t> graphicsFamily;
   std::optional<uint32_t> presentFamily;
+  std::optional<uint32_t> transferFamily; // Transfer only family (DMA engine), when the device has one
 };
 
 struct SwapChainSupportDetails {
@@ -109,6 +166,29 @@ struct SwapChainSupportDetails {
   std::vector<VkPresentModeKHR> presentModes;
 };
 
+struct AtlasPage
+{
+  Image image;
+  ImageView view;
+  uint32_t slot = 0;
+};
+
+// Depth or multisampled color image that only lives for the duration of a
+// render pass, never loaded or stored
+struct TransientAttachment
+{
+  Image image;
+  ImageView view;
+  VkDeviceSize size = 0; // Bytes one full write or read of the image moves
+  bool lazilyAllocated = false;
+};
+
+struct CachedCommandBuffer
+{
+  VkCommandBuffer buffer = VK_NULL_HANDLE;
+  uint64_t generation = 0; // commandGeneration when it was recorded, 0 for never
+};
+
 struct VulkanConfig
 {
   VkInstance instance;
@@ -117,35 +197,110 @@ struct VulkanConfig
   VkDevice device;
   VkQueue graphicsQueue;
   VkQueue presentQueue;
+  VkQueue transferQueue;
+  QueueFamilyIndices queueFamilyIndices;
   VkSurfaceKHR surface;
-  VkSwapchainKHR swapChain;
+  DeletionQueue deletionQueue; // Ahead of every Resource member, they push into it when destroyed
+  SwapChain swapChain;
   std::vector<VkImage> swapChainImages;
   VkFormat swapChainImageFormat;
   VkExtent2D swapChainExtent;
-  std::vector<VkImageView> swapChainImageViews;
-  VkRenderPass renderPass;
+  std::vector<ImageView> swapChainImageViews;
+  uint32_t swapChainRecreations = 0;
+  float slowestSwapChainRecreation = 0.0f; // ms
+  uint32_t framesInFlight = MAX_FRAMES_IN_FLIGHT; // Set by the latency mode with the swapchain
+  bool presentWaitSupported = false; // VK_KHR_present_id and VK_KHR_present_wait
+  bool timelineSemaphores = false; // Otherwise uploads are fenced and share the graphics queue
+  bool pipelineCreationFeedback = false; // 1.3 or VK_EXT_pipeline_creation_feedback
+  PresentWaiter presentWaiter;
+  FrameLimiter frameLimiter;
+  bool dynamicRendering = false; // No renderPass or swapChainFramebuffers, see beginRendering()
+  PFN_vkCmdBeginRendering cmdBeginRendering = nullptr; // Core or KHR entry points, see createLogicalDevice()
+  PFN_vkCmdEndRendering cmdEndRendering = nullptr;
+  VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+  VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+  TransientAttachment colorAttachment; // Only with msaaSamples above 1, resolved into the swapchain image
+  TransientAttachment depthAttachment;
+  bool dynamicResolution = false; // Scene drawn into sceneImage, then upscaled into the swapchain image
+  VkExtent2D renderExtent; // Part of the scene target the draws cover, swapChainExtent without dynamic resolution
+  Image sceneImage;
+  ImageView sceneImageView;
+  Framebuffer sceneFramebuffer;
+  VkRenderPass upscaleRenderPass = VK_NULL_HANDLE; // Into swapChainFramebuffers with dynamic resolution
+  Upscaler upscaler;
+  FrameTimer frameTimer;
+  ResolutionController resolution;
+  VkRenderPass renderPass = VK_NULL_HANDLE;
   VkDescriptorSetLayout descriptorSetLayout;
   VkPipelineLayout pipelineLayout;
-  VkPipeline graphicsPipeline;
-  std::vector<VkFramebuffer> swapChainFramebuffers;
-  VkImage textureImage;
-  VkDeviceMemory textureImageMemory;
-  VkCommandPool commandPool;
+  VkPipeline graphicsPipeline; // Default variant, owned by pipelines
+  PipelineState pipelineState;
+  std::vector<Framebuffer> swapChainFramebuffers;
+  Image textureImage;
+  uint32_t textureMipLevels = 1;
+  VkFormat textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
+  Image placeholderImage;
+  ImageView placeholderImageView;
+  std::vector<CommandPool> commandPools; // One per frame in flight, reset as a whole
   std::vector<VkCommandBuffer> commandBuffers;
+  ParallelRecorder recorder;
+  bool cacheCommandBuffers;
+  CommandPool cachedCommandPool; // One per swapchain, destroying it frees the cached command buffers
+  std::vector<std::vector<CachedCommandBuffer>> cachedCommandBuffers; // [frame][swapchain image]
+  uint64_t commandGeneration = 0;
+  VkPipeline recordedPipeline = VK_NULL_HANDLE;
+  uint32_t recordedInstanceCount = 0;
+  uint64_t recordedSpriteGeneration = 0;
+  uint32_t recordedSpritePending = 0;
   std::vector<VkSemaphore> imageAvailableSemaphores;
   std::vector<VkSemaphore> renderFinishedSemaphores;
   std::vector<VkFence> inFlightFences;
-  VkBuffer vertexBuffer;
-  VkDeviceMemory vertexBufferMemory;
-  VkBuffer indexBuffer;
-  VkDeviceMemory indexBufferMemory;
-  std::vector<VkBuffer> uniformBuffers;
-  std::vector<VkDeviceMemory> uniformBuffersMemory;
+  Buffer vertexBuffer;
+  Buffer indexBuffer;
+  GeometryArena geometry; // Where each mesh lives in vertexBuffer and indexBuffer
+  uint32_t quadMesh = GeometryArena::INVALID_MESH;
+  uint64_t recordedGeometryGeneration = 0;
+  std::vector<Buffer> uniformBuffers;
   std::vector<void*> uniformBuffersMapped;
-  VkDescriptorPool descriptorPool;
+  std::vector<Buffer> instanceBuffers;
+  std::vector<InstanceData*> instanceBuffersMapped;
+  std::vector<uint32_t> instanceCounts;
+  uint64_t instanceGeneration = 1; // Bumped whenever what updateInstanceBuffer() writes changes
+  std::vector<uint64_t> instanceBufferGenerations; // instanceGeneration each buffer was last written at
+  UniformBufferObject uniforms;
+  GpuCuller culler;
+  DescriptorPool descriptorPool;
   std::vector<VkDescriptorSet> descriptorSets;
-  VkImageView textureImageView;
-  VkSampler textureSampler;
+  ImageView textureImageView;
+  std::vector<bool> textureDescriptorStale;
+  bool bindlessSupported = false;
+  bool bindless = false; // Textures come from textureTable instead of binding 1 of descriptorSets
+  TextureTable textureTable;
+  uint32_t placeholderSlot = 0;
+  uint32_t textureSlot = TextureTable::INVALID_SLOT;
+  uint32_t textureImageSlot = TextureTable::INVALID_SLOT; // textureImageView's, textureSlot may point into the atlas instead
+  glm::vec4 textureUvRect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f); // Part of textureSlot the texture covers
+  TextureAtlas atlas;
+  std::vector<AtlasPage> atlasPages;
+  uint64_t frameNumber = 0; // Frames submitted, slots and ranges are retired against it
+  Sampler textureSampler;
+  DeviceAllocator allocator;
+  StagingRing stagingRing;
+  UploadQueue uploadQueue;
+  UploadTicket pendingUploads;
+  UploadQueue mipmapQueue; // Graphics queue lane, blits need graphics capability
+  MipmapGenerator mipmapGenerator;
+  UploadTicket pendingMipmaps;
+  ThreadPool threadPool;
+  TextureLoader textureLoader;
+  PipelineCache pipelineCache;
+  PipelineManager pipelines;
+  bool spritesEnabled = false;
+  SpriteBatcher sprites;
+  Buffer spriteIndexBuffer;
+  PipelineManager spritePipelines;
+  std::vector<PipelineState> spriteMaterials; // Indexed by SpriteBatcher::Sprite::material
+  VkPipeline spritePipeline = VK_NULL_HANDLE; // Material 0, drawn with until the others are built
 };
 
 VulkanConfig vulkanConfig = {};
@@ -157,6 +312,9 @@ uint32_t currentFrame = 0;
 
 GLFWwindow *glfwWindow = nullptr;
 android_app *androidApp = nullptr;
+AssetArchive assetArchive;
+Settings settings;
+std::vector<std::string> commandLineArguments;
 
 #ifndef __ANDROID__
 void framebufferResizeCallback(GLFWwindow *window, int width, int height)
@@ -332,12 +490,17 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device)
 
   for(int i = 0; i < queueFamilyProperties.size(); i++)
   {
-    if(indices.graphicsFamily.has_value() && indices.presentFamily.has_value())
+    VkQueueFamilyProperties queueFamily = queueFamilyProperties[i];
+
+    if(!indices.transferFamily.has_value() && (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
     {
-      break;
+      indices.transferFamily = i;
     }
 
-    VkQueueFamilyProperties queueFamily = queueFamilyProperties[i];
+    if(indices.graphicsFamily.has_value() && indices.presentFamily.has_value())
+    {
+      continue;
+    }
 
     VkBool32 presentSupport = false;
     vkGetPhysicalDeviceSurfaceSupportKHR(device, i, vulkanConfig.surface, &presentSupport);
@@ -374,6 +537,25 @@ bool checkDeviceExtensionsSupport(VkPhysicalDevice device)
   return requiredExtensions.empty();
 }
 
+bool isDeviceExtensionSupported(VkPhysicalDevice device, const char *name)
+{
+  uint32_t extensionsCount;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionsCount, nullptr);
+
+  std::vector<VkExtensionProperties> extensionProperties(extensionsCount);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionsCount, extensionProperties.data());
+
+  for(const auto &extension : extensionProperties)
+  {
+    if(strcmp(extension.extensionName, name) == 0)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device) {
   SwapChainSupportDetails details;
 
@@ -406,6 +588,14 @@ SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device) {
   return details;
 }
 
+uint32_t getDeviceApiVersion(VkPhysicalDevice device)
+{
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device, &properties);
+
+  return properties.apiVersion;
+}
+
 bool isDeviceSuitable(VkPhysicalDevice device)
 {
   QueueFamilyIndices indices = findQueueFamilies(device);
@@ -421,6 +611,7 @@ bool isDeviceSuitable(VkPhysicalDevice device)
   VkPhysicalDeviceFeatures supportedFeatures;
   vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
+  // Timeline semaphores and synchronization2 are optional, see createLogicalDevice()
   return indices.graphicsFamily.has_value() && indices.presentFamily.has_value() && swapChainAdequate && supportedFeatures.samplerAnisotropy;
 }
 
@@ -452,10 +643,223 @@ void pickPhysicalDevice()
 void createLogicalDevice()
 {
   QueueFamilyIndices indices = findQueueFamilies(vulkanConfig.physicalDevice);
+  uint32_t apiVersion = getDeviceApiVersion(vulkanConfig.physicalDevice);
+
+  VkDeviceCreateInfo deviceCreateInfo = {};
+  deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  deviceCreateInfo.pNext = nullptr;
+  // deviceCreateInfo.flags;
+  // deviceCreateInfo.enabledLayerCount;
+  // deviceCreateInfo.ppEnabledLayerNames;
+  // Required ones, plus whichever optional ones the device has
+  std::vector<const char*> extensions = deviceExtensions;
+
+  // Core from 1.3 on, only enabled below when its feature is there too
+  bool synchronization2Extension = apiVersion < VK_API_VERSION_1_3 && isDeviceExtensionSupported(vulkanConfig.physicalDevice, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+
+  // Likewise, on 1.2 devices only: the depth stencil resolve it builds on is core there
+  bool dynamicRenderingExtension = preferDynamicRendering && apiVersion >= VK_API_VERSION_1_2 && apiVersion < VK_API_VERSION_1_3 && isDeviceExtensionSupported(vulkanConfig.physicalDevice, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+
+  // Pipeline cache hit statistics, core from 1.3 on and without a feature to enable
+  vulkanConfig.pipelineCreationFeedback = apiVersion >= VK_API_VERSION_1_3;
+  if(!vulkanConfig.pipelineCreationFeedback && isDeviceExtensionSupported(vulkanConfig.physicalDevice, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME))
+  {
+    extensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+    vulkanConfig.pipelineCreationFeedback = true;
+  }
+
+  bool presentWaitExtensions = isDeviceExtensionSupported(vulkanConfig.physicalDevice, VK_KHR_PRESENT_ID_EXTENSION_NAME) && isDeviceExtensionSupported(vulkanConfig.physicalDevice, VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+  if(presentWaitExtensions)
+  {
+    extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+    extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+  }
+
+  VkPhysicalDeviceFeatures deviceFeatures = {};
+  deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+  deviceFeatures.samplerAnisotropy = VK_TRUE;
+
+  // Whatever block compression the device has, the texture loader picks among them
+  VkPhysicalDeviceFeatures supportedFeatures;
+  vkGetPhysicalDeviceFeatures(vulkanConfig.physicalDevice, &supportedFeatures);
+  deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+  deviceFeatures.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;
+  deviceFeatures.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
+
+  VkPhysicalDeviceVulkan12Features supportedFeatures12{};
+  supportedFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+  VkPhysicalDeviceVulkan13Features supportedFeatures13{};
+  supportedFeatures13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+
+  VkPhysicalDevicePresentIdFeaturesKHR supportedPresentId{};
+  supportedPresentId.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+
+  VkPhysicalDevicePresentWaitFeaturesKHR supportedPresentWait{};
+  supportedPresentWait.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+  supportedPresentId.pNext = &supportedPresentWait;
+
+  VkPhysicalDeviceSynchronization2FeaturesKHR supportedSynchronization2{};
+  supportedSynchronization2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+
+  VkPhysicalDeviceDynamicRenderingFeaturesKHR supportedDynamicRendering{};
+  supportedDynamicRendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+
+  // Built back to front. Extension feature structs may only be chained when
+  // their extensions exist, core ones on devices of their version; whatever
+  // an older device lacks stays zeroed.
+  void *supportedChain = presentWaitExtensions ? &supportedPresentId : nullptr;
+
+  if(synchronization2Extension)
+  {
+    supportedSynchronization2.pNext = supportedChain;
+    supportedChain = &supportedSynchronization2;
+  }
+
+  if(dynamicRenderingExtension)
+  {
+    supportedDynamicRendering.pNext = supportedChain;
+    supportedChain = &supportedDynamicRendering;
+  }
+
+  if(apiVersion >= VK_API_VERSION_1_3)
+  {
+    supportedFeatures13.pNext = supportedChain;
+    supportedChain = &supportedFeatures13;
+  }
+
+  if(apiVersion >= VK_API_VERSION_1_2)
+  {
+    supportedFeatures12.pNext = supportedChain;
+    supportedChain = &supportedFeatures12;
+  }
+
+  VkPhysicalDeviceFeatures2 supportedFeatures2{};
+  supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  supportedFeatures2.pNext = supportedChain;
+  vkGetPhysicalDeviceFeatures2(vulkanConfig.physicalDevice, &supportedFeatures2);
+
+  // Without timeline semaphores upload batches are tracked with fences, and
+  // there is nothing to make the graphics queue wait on a transfer queue, so
+  // uploads stay on the graphics queue where submission order covers it
+  vulkanConfig.timelineSemaphores = supportedFeatures12.timelineSemaphore;
+  if(!vulkanConfig.timelineSemaphores)
+  {
+    indices.transferFamily.reset();
+  }
+
+  VkPhysicalDeviceVulkan12Features deviceFeatures12{};
+  deviceFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  deviceFeatures12.timelineSemaphore = supportedFeatures12.timelineSemaphore;
+
+  if (TextureTable::isSupported(supportedFeatures12))
+  {
+    deviceFeatures12.runtimeDescriptorArray = VK_TRUE;
+    deviceFeatures12.descriptorBindingPartiallyBound = VK_TRUE;
+    deviceFeatures12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    deviceFeatures12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    deviceFeatures12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    vulkanConfig.bindlessSupported = true;
+  }
+
+  VkPhysicalDeviceVulkan13Features deviceFeatures13{};
+  deviceFeatures13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+  deviceFeatures13.synchronization2 = supportedFeatures13.synchronization2;
+  deviceFeatures13.dynamicRendering = preferDynamicRendering && supportedFeatures13.dynamicRendering;
+
+  VkPhysicalDeviceDynamicRenderingFeaturesKHR deviceDynamicRendering{};
+  deviceDynamicRendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+  deviceDynamicRendering.dynamicRendering = VK_TRUE;
+
+  // The KHR structs and entry points are aliases of the core ones, only the names differ
+  bool dynamicRenderingFeature = dynamicRenderingExtension && supportedDynamicRendering.dynamicRendering;
+  const char *beginRendering = nullptr;
+  const char *endRendering = nullptr;
+  if(deviceFeatures13.dynamicRendering)
+  {
+    beginRendering = "vkCmdBeginRendering";
+    endRendering = "vkCmdEndRendering";
+  }
+  else if(dynamicRenderingFeature)
+  {
+    beginRendering = "vkCmdBeginRenderingKHR";
+    endRendering = "vkCmdEndRenderingKHR";
+    extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+  }
+
+  // Lets the low latency and power saving modes wait until a frame is on screen
+  VkPhysicalDevicePresentIdFeaturesKHR devicePresentId{};
+  devicePresentId.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+  devicePresentId.presentId = VK_TRUE;
+
+  VkPhysicalDevicePresentWaitFeaturesKHR devicePresentWait{};
+  devicePresentWait.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+  devicePresentWait.presentWait = VK_TRUE;
+  devicePresentId.pNext = &devicePresentWait;
+
+  vulkanConfig.presentWaitSupported = presentWaitExtensions && supportedPresentId.presentId && supportedPresentWait.presentWait;
+
+  if(presentWaitExtensions && !vulkanConfig.presentWaitSupported)
+  {
+    // Enabled without their features they'd be of no use
+    extensions.resize(extensions.size() - 2);
+  }
+
+  // Without either, PipelineBarriers translates every barrier to vkCmdPipelineBarrier
+  VkPhysicalDeviceSynchronization2FeaturesKHR deviceSynchronization2{};
+  deviceSynchronization2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+  deviceSynchronization2.synchronization2 = VK_TRUE;
+
+  const char *pipelineBarrier2 = nullptr;
+  if(deviceFeatures13.synchronization2)
+  {
+    pipelineBarrier2 = "vkCmdPipelineBarrier2";
+  }
+  else if(synchronization2Extension && supportedSynchronization2.synchronization2)
+  {
+    pipelineBarrier2 = "vkCmdPipelineBarrier2KHR";
+    extensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+  }
+
+  deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+  deviceCreateInfo.ppEnabledExtensionNames = extensions.data();
+
+  void *deviceChain = vulkanConfig.presentWaitSupported ? &devicePresentId : nullptr;
+
+  if(synchronization2Extension && supportedSynchronization2.synchronization2)
+  {
+    deviceSynchronization2.pNext = deviceChain;
+    deviceChain = &deviceSynchronization2;
+  }
+
+  if(dynamicRenderingFeature)
+  {
+    deviceDynamicRendering.pNext = deviceChain;
+    deviceChain = &deviceDynamicRendering;
+  }
+
+  if(apiVersion >= VK_API_VERSION_1_3)
+  {
+    deviceFeatures13.pNext = deviceChain;
+    deviceChain = &deviceFeatures13;
+  }
+
+  if(apiVersion >= VK_API_VERSION_1_2)
+  {
+    deviceFeatures12.pNext = deviceChain;
+    deviceChain = &deviceFeatures12;
+  }
+
+  deviceCreateInfo.pNext = deviceChain;
 
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
   std::set<uint32_t> uniqueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
 
+  if(indices.transferFamily.has_value())
+  {
+    uniqueFamilies.insert(indices.transferFamily.value());
+  }
+
   float queuePriority = 1.0f;
   for(auto familyIndex : uniqueFamilies)
   {
@@ -469,28 +873,44 @@ void createLogicalDevice()
     queueCreateInfos.push_back(queueCreateInfo);
   }
 
-  VkDeviceCreateInfo deviceCreateInfo = {};
-  deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-  deviceCreateInfo.pNext = nullptr;
-  // deviceCreateInfo.flags;
   deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
   deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
-  // deviceCreateInfo.enabledLayerCount;
-  // deviceCreateInfo.ppEnabledLayerNames;
-  deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-  deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
-
-  VkPhysicalDeviceFeatures deviceFeatures = {};
-  deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
-  deviceFeatures.samplerAnisotropy = VK_TRUE;
 
   if(vkCreateDevice(vulkanConfig.physicalDevice, &deviceCreateInfo, nullptr, &vulkanConfig.device) != VK_SUCCESS)
   {
     LOG_DEBUG("Failed to create logical device");
   }
 
+  PipelineBarriers::init(vulkanConfig.device, pipelineBarrier2);
+
+  // Without them the render pass is created as on devices without the feature
+  vulkanConfig.dynamicRendering = false;
+  if(beginRendering != nullptr)
+  {
+    vulkanConfig.cmdBeginRendering = reinterpret_cast<PFN_vkCmdBeginRendering>(vkGetDeviceProcAddr(vulkanConfig.device, beginRendering));
+    vulkanConfig.cmdEndRendering = reinterpret_cast<PFN_vkCmdEndRendering>(vkGetDeviceProcAddr(vulkanConfig.device, endRendering));
+    vulkanConfig.dynamicRendering = vulkanConfig.cmdBeginRendering != nullptr && vulkanConfig.cmdEndRendering != nullptr;
+
+    if(!vulkanConfig.dynamicRendering)
+    {
+      LOG_DEBUG("{} not found, rendering with a render pass", beginRendering);
+    }
+  }
+
+  LOG_DEBUG("Rendering with {}", vulkanConfig.dynamicRendering ? "dynamic rendering" : "a render pass");
+  LOG_DEBUG("Barriers use {}", PipelineBarriers::isSynchronization2() ? "synchronization2" : "vkCmdPipelineBarrier");
+
   vkGetDeviceQueue(vulkanConfig.device, indices.graphicsFamily.value(), 0, &vulkanConfig.graphicsQueue);
   vkGetDeviceQueue(vulkanConfig.device, indices.presentFamily.value(), 0, &vulkanConfig.presentQueue);
+
+  // Without a transfer only family uploads go through the graphics queue
+  uint32_t transferFamily = indices.transferFamily.value_or(indices.graphicsFamily.value());
+  vkGetDeviceQueue(vulkanConfig.device, transferFamily, 0, &vulkanConfig.transferQueue);
+
+  vulkanConfig.queueFamilyIndices = indices;
+
+  vulkanConfig.allocator.init(vulkanConfig.physicalDevice, vulkanConfig.device);
+  vulkanConfig.deletionQueue.init(vulkanConfig.device, vulkanConfig.allocator, MAX_FRAMES_IN_FLIGHT);
 }
 
 VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
@@ -506,19 +926,6 @@ VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>
   return availableFormats[0];
 }
 
-VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes)
-{
-  for (const auto& availablePresentMode : availablePresentModes)
-  {
-    if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
-    {
-      return availablePresentMode;
-    }
-  }
-
-  return VK_PRESENT_MODE_FIFO_KHR;
-}
-
 VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
 {
   if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
@@ -552,16 +959,17 @@ void createSwapChain()
   SwapChainSupportDetails swapChainSupport = querySwapChainSupport(vulkanConfig.physicalDevice);
 
   VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
-  VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+  PacingPolicy policy = getPacingPolicy(latencyMode, MAX_FRAMES_IN_FLIGHT);
+  VkPresentModeKHR presentMode = choosePresentMode(policy, swapChainSupport.presentModes);
   VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
 
-  uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+  uint32_t imageCount = chooseImageCount(policy, swapChainSupport.capabilities);
 
-  // Make sure not to exceed number of images while adding +1 to minImageCount
-  if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
-  {
-    imageCount = swapChainSupport.capabilities.maxImageCount;
-  }
+  // Slots left out keep their fence and drawFrame() waits on it before
+  // using a slot again, so the frame count can change without idling
+  vulkanConfig.framesInFlight = policy.framesInFlight;
+  currentFrame %= vulkanConfig.framesInFlight;
+  vulkanConfig.presentWaiter.reset();
 
   VkSwapchainCreateInfoKHR swapchainCreateInfo = {};
   swapchainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -599,30 +1007,42 @@ void createSwapChain()
   swapchainCreateInfo.compositeAlpha = compositeAlpha;
   swapchainCreateInfo.presentMode = presentMode;
   swapchainCreateInfo.clipped = VK_TRUE;
-  swapchainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
+  swapchainCreateInfo.oldSwapchain = vulkanConfig.swapChain.get();
 
-  if(vkCreateSwapchainKHR(vulkanConfig.device, &swapchainCreateInfo, nullptr, &vulkanConfig.swapChain) != VK_SUCCESS)
+  VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+  if(vkCreateSwapchainKHR(vulkanConfig.device, &swapchainCreateInfo, nullptr, &swapChain) != VK_SUCCESS)
   {
     LOG_DEBUG("Failed to create swapchain");
   }
 
-  vkGetSwapchainImagesKHR(vulkanConfig.device, vulkanConfig.swapChain, &imageCount, nullptr);
+  // The old one goes to the deletion queue, frames in flight still present to it
+  vulkanConfig.swapChain = SwapChain(vulkanConfig.deletionQueue, swapChain);
+
+  vkGetSwapchainImagesKHR(vulkanConfig.device, vulkanConfig.swapChain.get(), &imageCount, nullptr);
   vulkanConfig.swapChainImages.resize(imageCount);
-  vkGetSwapchainImagesKHR(vulkanConfig.device, vulkanConfig.swapChain, &imageCount, vulkanConfig.swapChainImages.data());
+  vkGetSwapchainImagesKHR(vulkanConfig.device, vulkanConfig.swapChain.get(), &imageCount, vulkanConfig.swapChainImages.data());
 
   vulkanConfig.swapChainImageFormat = surfaceFormat.format;
   vulkanConfig.swapChainExtent = extent;
+
+  LOG_DEBUG("Pacing for {}: present mode {}, {} images, {} frames in flight", getLatencyModeName(latencyMode), static_cast<int>(presentMode), imageCount, vulkanConfig.framesInFlight);
 }
 
-VkImageView createImageView(VkImage image, VkFormat format) {
+// usage narrows what the view is used for, 0 keeps all of the image's usage
+VkImageView createImageView(VkImage image, VkFormat format, uint32_t mipLevels, VkImageUsageFlags usage = 0) {
+  VkImageViewUsageCreateInfo usageInfo{};
+  usageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO;
+  usageInfo.usage = usage;
+
   VkImageViewCreateInfo viewInfo{};
   viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.pNext = usage != 0 ? &usageInfo : nullptr;
   viewInfo.image = image;
   viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
   viewInfo.format = format;
   viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
   viewInfo.subresourceRange.baseMipLevel = 0;
-  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.levelCount = mipLevels;
   viewInfo.subresourceRange.baseArrayLayer = 0;
   viewInfo.subresourceRange.layerCount = 1;
 
@@ -636,210 +1056,451 @@ VkImageView createImageView(VkImage image, VkFormat format) {
 
 void createImageViews()
 {
-  vulkanConfig.swapChainImageViews.resize(vulkanConfig.swapChainImages.size());
+  vulkanConfig.swapChainImageViews.clear();
   for(size_t i = 0; i < vulkanConfig.swapChainImages.size(); i++)
   {
-    vulkanConfig.swapChainImageViews[i] = createImageView(vulkanConfig.swapChainImages[i], vulkanConfig.swapChainImageFormat);
+    vulkanConfig.swapChainImageViews.emplace_back(vulkanConfig.deletionQueue, createImageView(vulkanConfig.swapChainImages[i], vulkanConfig.swapChainImageFormat, 1));
   }
 }
 
-std::vector<char> readFile(const std::string &filename)
+// MSAA sample count and depth format of the transient attachments
+void selectAttachmentFormats()
 {
-  #ifdef __ANDROID__
-  AAssetManager *am = androidApp->activity->assetManager;
-  AAsset *asset = AAssetManager_open(am, filename.c_str(), AASSET_MODE_STREAMING);
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(vulkanConfig.physicalDevice, &properties);
+
+  VkSampleCountFlags supportedCounts = properties.limits.framebufferColorSampleCounts & properties.limits.framebufferDepthSampleCounts;
+  vulkanConfig.msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+
+  for(uint32_t count = preferredSampleCount; count > VK_SAMPLE_COUNT_1_BIT; count >>= 1)
+  {
+    if(supportedCounts & count)
+    {
+      vulkanConfig.msaaSamples = static_cast<VkSampleCountFlagBits>(count);
+      break;
+    }
+  }
 
-  if(!asset)
+  // Smallest first, the depth buffer only ever lives in tile memory
+  for(VkFormat format : {VK_FORMAT_D16_UNORM, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT})
   {
-    LOG_DEBUG("Could not open file {}", filename);
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(vulkanConfig.physicalDevice, format, &formatProperties);
+
+    if(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+    {
+      vulkanConfig.depthFormat = format;
+      break;
+    }
   }
 
-  size_t size = static_cast<size_t>(AAsset_getLength(asset));
-  std::vector<char> buffer(size);
+  LOG_DEBUG("Rendering with {}x MSAA, depth format {}", static_cast<int>(vulkanConfig.msaaSamples), static_cast<int>(vulkanConfig.depthFormat));
+}
+
+VkImageAspectFlags getDepthAspect(VkFormat format)
+{
+  return format == VK_FORMAT_D24_UNORM_S8_UINT ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_DEPTH_BIT;
+}
 
-  AAsset_read(asset, buffer.data(), size);
-  AAsset_close(asset);
+// Bytes per sample, for the bandwidth report
+uint32_t getTexelSize(VkFormat format)
+{
+  return format == VK_FORMAT_D16_UNORM ? 2 : 4;
+}
 
-  #else
-  std::ifstream file(filename, std::ios::ate | std::ios::binary);
+// Backed by lazily allocated memory when the device has it, which tilers
+// may never commit since the image never leaves tile memory
+void createTransientAttachment(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, TransientAttachment &attachment)
+{
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.extent.width = vulkanConfig.swapChainExtent.width;
+  imageInfo.extent.height = vulkanConfig.swapChainExtent.height;
+  imageInfo.extent.depth = 1;
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.format = format;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage = usage | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+  imageInfo.samples = vulkanConfig.msaaSamples;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-  if(!file.is_open())
+  VkImage image;
+  if(vkCreateImage(vulkanConfig.device, &imageInfo, nullptr, &image) != VK_SUCCESS)
   {
-    LOG_DEBUG("Could not open file {}", filename);
+    LOG_DEBUG("Failed to create transient attachment");
+    return;
   }
 
-  size_t size = static_cast<size_t>(file.tellg());
-  std::vector<char> buffer(size);
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(vulkanConfig.device, image, &requirements);
 
-  file.seekg(0);
-  file.read(buffer.data(), size);
+  VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+  attachment.lazilyAllocated = vulkanConfig.allocator.findMemoryType(requirements.memoryTypeBits, properties) != std::numeric_limits<uint32_t>::max();
 
-  file.close();
-  #endif
+  if(!attachment.lazilyAllocated)
+  {
+    properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+  }
 
-  return buffer;
-}
+  GpuAllocation allocation;
+  if(!vulkanConfig.allocator.allocateImage(image, properties, allocation))
+  {
+    LOG_DEBUG("Failed to allocate transient attachment memory");
+  }
 
-VkShaderModule createShaderModule(const std::vector<char> &code)
-{
-  VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
-  shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  shaderModuleCreateInfo.pNext = nullptr;
-  // shaderModuleCreateInfo.flags;
-  shaderModuleCreateInfo.codeSize = code.size();
-  shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+  attachment.image = Image(vulkanConfig.deletionQueue, image, allocation);
 
-  VkShaderModule shaderModule;
-  if(vkCreateShaderModule(vulkanConfig.device, &shaderModuleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS)
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = format;
+  viewInfo.subresourceRange.aspectMask = aspect;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = 1;
+
+  VkImageView view = VK_NULL_HANDLE;
+  if(vkCreateImageView(vulkanConfig.device, &viewInfo, nullptr, &view) != VK_SUCCESS)
   {
-    LOG_DEBUG("Failed to create shader module");
+    LOG_DEBUG("Failed to create transient attachment view");
   }
 
-  return shaderModule;
+  attachment.view = ImageView(vulkanConfig.deletionQueue, view);
+
+  attachment.size = VkDeviceSize(imageInfo.extent.width) * imageInfo.extent.height * getTexelSize(format) * vulkanConfig.msaaSamples;
 }
 
-void createGraphicsPipeline()
+// Sized to the swapchain, recreated with it
+void createTransientAttachments()
 {
-  std::vector<char> vertShaderCode = readFile("shaders/vert.spv");
-  std::vector<char> fragShaderCode = readFile("shaders/frag.spv");
-
-  VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-  VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-
-  VkPipelineShaderStageCreateInfo vertStageCreateInfo = {};
-  vertStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  vertStageCreateInfo.pNext = nullptr;
-  // vertStageCreateInfo.flags;
-  vertStageCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-  vertStageCreateInfo.module = vertShaderModule;
-  vertStageCreateInfo.pName = "main";
-  // vertStageCreateInfo.pSpecializationInfo;
-
-  VkPipelineShaderStageCreateInfo fragStageCreateInfo = {};
-  fragStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  fragStageCreateInfo.pNext = nullptr;
-  fragStageCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  fragStageCreateInfo.module = fragShaderModule;
-  fragStageCreateInfo.pName = "main";
-
-  VkPipelineShaderStageCreateInfo shaderStages[] = {vertStageCreateInfo, fragStageCreateInfo};
-
-  auto bindingDescription = Vertex::getBindingDescription();
-  auto attributeDescriptions = Vertex::getAttributeDescriptions();
-
-  VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-  vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  vertexInputInfo.vertexBindingDescriptionCount = 1;
-  vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-  vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-  vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-
-  VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-  inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-  inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-  VkPipelineViewportStateCreateInfo viewportState{};
-  viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  viewportState.viewportCount = 1;
-  viewportState.scissorCount = 1;
-
-  VkPipelineRasterizationStateCreateInfo rasterizer{};
-  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-  rasterizer.depthClampEnable = VK_FALSE;
-  rasterizer.rasterizerDiscardEnable = VK_FALSE;
-  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-  rasterizer.lineWidth = 1.0f;
-  rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-  rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-  rasterizer.depthBiasEnable = VK_FALSE;
-
-  VkPipelineMultisampleStateCreateInfo multisampling{};
-  multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-  multisampling.sampleShadingEnable = VK_FALSE;
-  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-
-  VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-  colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-  colorBlendAttachment.blendEnable = VK_FALSE;
-
-  VkPipelineColorBlendStateCreateInfo colorBlending{};
-  colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-  colorBlending.logicOpEnable = VK_FALSE;
-  colorBlending.logicOp = VK_LOGIC_OP_COPY;
-  colorBlending.attachmentCount = 1;
-  colorBlending.pAttachments = &colorBlendAttachment;
-  colorBlending.blendConstants[0] = 0.0f;
-  colorBlending.blendConstants[1] = 0.0f;
-  colorBlending.blendConstants[2] = 0.0f;
-  colorBlending.blendConstants[3] = 0.0f;
-
-  std::vector<VkDynamicState> dynamicStates = {
-    VK_DYNAMIC_STATE_VIEWPORT,
-    VK_DYNAMIC_STATE_SCISSOR
-  };
+  if(vulkanConfig.msaaSamples != VK_SAMPLE_COUNT_1_BIT)
+  {
+    createTransientAttachment(vulkanConfig.swapChainImageFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT, vulkanConfig.colorAttachment);
+  }
 
-  VkPipelineDynamicStateCreateInfo dynamicState{};
-  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-  dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
-  dynamicState.pDynamicStates = dynamicStates.data();
+  createTransientAttachment(vulkanConfig.depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, getDepthAspect(vulkanConfig.depthFormat), vulkanConfig.depthAttachment);
 
-  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  pipelineLayoutInfo.setLayoutCount = 1;
-  pipelineLayoutInfo.pSetLayouts = &vulkanConfig.descriptorSetLayout;
-  pipelineLayoutInfo.pushConstantRangeCount = 0;
+  // Stored attachments would write all of this out every frame
+  VkDeviceSize skippedBytes = 0;
+  VkDeviceSize lazyBytes = 0;
 
-  if(vkCreatePipelineLayout(vulkanConfig.device, &pipelineLayoutInfo, nullptr, &vulkanConfig.pipelineLayout) != VK_SUCCESS)
+  for(const TransientAttachment *attachment : {&vulkanConfig.colorAttachment, &vulkanConfig.depthAttachment})
   {
-    LOG_DEBUG("Failed to create pipelineLayout");
+    skippedBytes += attachment->size;
+    lazyBytes += attachment->lazilyAllocated ? attachment->size : 0;
   }
 
-  VkGraphicsPipelineCreateInfo pipelineInfo{};
-  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipelineInfo.stageCount = 2;
-  pipelineInfo.pStages = shaderStages;
+  LOG_DEBUG("Transient attachments skip {} KiB of stores per frame, {} KiB of them lazily allocated", skippedBytes / 1024, lazyBytes / 1024);
+}
 
-  pipelineInfo.pVertexInputState = &vertexInputInfo;
-  pipelineInfo.pInputAssemblyState = &inputAssembly;
-  pipelineInfo.pViewportState = &viewportState;
-  pipelineInfo.pRasterizationState = &rasterizer;
-  pipelineInfo.pMultisampleState = &multisampling;
-  pipelineInfo.pDepthStencilState = nullptr; // Optional
-  pipelineInfo.pColorBlendState = &colorBlending;
-  pipelineInfo.pDynamicState = &dynamicState;
-  pipelineInfo.layout = vulkanConfig.pipelineLayout;
-  pipelineInfo.renderPass = vulkanConfig.renderPass;
-  pipelineInfo.subpass = 0;
+// The view ahead of its image
+void releaseTransientAttachment(TransientAttachment &attachment)
+{
+  attachment.view.reset();
+  attachment.image.reset();
+  attachment = {};
+}
 
-  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
-  pipelineInfo.basePipelineIndex = -1; // Optional
+// Zero copy view into the asset archive, empty when the file isn't packed
+std::span<const char> loadAsset(const std::string &filename)
+{
+  std::span<const char> asset = assetArchive.find(filename);
 
-  if (vkCreateGraphicsPipelines(vulkanConfig.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &vulkanConfig.graphicsPipeline) != VK_SUCCESS)
+  if(asset.empty())
   {
-    LOG_DEBUG("Failed to create graphics pipeline");
+    LOG_DEBUG("Could not find asset {}", filename);
   }
 
-  vkDestroyShaderModule(vulkanConfig.device, fragShaderModule, nullptr);
-  vkDestroyShaderModule(vulkanConfig.device, vertShaderModule, nullptr);
+  return asset;
 }
 
-void createRenderPass()
+void openAssetArchive()
 {
-  VkAttachmentDescription colorAttachment{};
-  // colorAttachment.flags;
-  colorAttachment.format = vulkanConfig.swapChainImageFormat;
-  colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // Images to be presented in the swap chain
-
-  VkAttachmentReference colorAttachmentRef{};
-  colorAttachmentRef.attachment = 0;
-  colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  #ifdef __ANDROID__
+  assetArchive.open(androidApp->activity->assetManager, "assets.pak");
+  #else
+  assetArchive.open("assets.pak");
+  #endif
+}
+
+// VK_NULL_HANDLE when code is empty, loadAsset() has logged the missing file
+VkShaderModule createShaderModule(std::span<const char> code)
+{
+  if(code.empty())
+  {
+    return VK_NULL_HANDLE;
+  }
+
+  VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
+  shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  shaderModuleCreateInfo.pNext = nullptr;
+  // shaderModuleCreateInfo.flags;
+  shaderModuleCreateInfo.codeSize = code.size();
+  shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+  VkShaderModule shaderModule = VK_NULL_HANDLE;
+  if(vkCreateShaderModule(vulkanConfig.device, &shaderModuleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS)
+  {
+    LOG_DEBUG("Failed to create shader module");
+  }
+
+  return shaderModule;
+}
+
+void createThreadPool()
+{
+  vulkanConfig.threadPool.init();
+
+  LOG_DEBUG("Started {} worker threads", vulkanConfig.threadPool.getThreadCount());
+}
+
+void createPipelineCache()
+{
+  #ifdef __ANDROID__
+  std::string path = std::string(androidApp->activity->internalDataPath) + "/pipeline.cache";
+  #else
+  std::string path = "pipeline.cache";
+  #endif
+
+  vulkanConfig.pipelineCache.init(vulkanConfig.physicalDevice, vulkanConfig.device, path, vulkanConfig.pipelineCreationFeedback);
+}
+
+void createTextureTable()
+{
+  if(!vulkanConfig.bindlessSupported)
+  {
+    LOG_DEBUG("No descriptor indexing, binding textures per frame");
+    return;
+  }
+
+  if(assetArchive.find("shaders/frag_bindless.spv").empty())
+  {
+    LOG_DEBUG("Bindless fragment shader missing, binding textures per frame");
+    return;
+  }
+
+  vulkanConfig.bindless = vulkanConfig.textureTable.init(vulkanConfig.physicalDevice, vulkanConfig.device, MAX_FRAMES_IN_FLIGHT);
+}
+
+// Slot for view in the texture table, 0 without one
+uint32_t registerTexture(VkImageView view, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+{
+  if(!vulkanConfig.bindless)
+  {
+    return 0;
+  }
+
+  return vulkanConfig.textureTable.registerTexture(view, vulkanConfig.textureSampler.get(), layout);
+}
+
+void createGraphicsPipeline()
+{
+  // Set 1 is the bindless texture table
+  VkDescriptorSetLayout setLayouts[] = {vulkanConfig.descriptorSetLayout, vulkanConfig.textureTable.getLayout()};
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = vulkanConfig.bindless ? 2 : 1;
+  pipelineLayoutInfo.pSetLayouts = setLayouts;
+  // Sprite batches pass their texture slot to sprite.vert
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(uint32_t);
+
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+  if(vkCreatePipelineLayout(vulkanConfig.device, &pipelineLayoutInfo, nullptr, &vulkanConfig.pipelineLayout) != VK_SUCCESS)
+  {
+    LOG_DEBUG("Failed to create pipelineLayout");
+  }
+
+  auto bindingDescription = PackedVertex::getBindingDescription();
+  auto attributeDescriptions = PackedVertex::getAttributeDescriptions();
+
+  auto instanceBindingDescription = InstanceData::getBindingDescription();
+  auto instanceAttributeDescriptions = InstanceData::getAttributeDescriptions();
+
+  PipelineManager::Description description{};
+  description.vertexShader = createShaderModule(loadAsset("shaders/vert.spv"));
+  description.fragmentShader = createShaderModule(loadAsset(vulkanConfig.bindless ? "shaders/frag_bindless.spv" : "shaders/frag.spv"));
+  description.layout = vulkanConfig.pipelineLayout;
+  description.renderPass = vulkanConfig.renderPass;
+  description.subpass = 0;
+  description.colorFormat = vulkanConfig.swapChainImageFormat;
+  description.depthFormat = vulkanConfig.depthFormat;
+  description.samples = vulkanConfig.msaaSamples;
+  description.bindings = {bindingDescription, instanceBindingDescription};
+  description.attributes.assign(attributeDescriptions.begin(), attributeDescriptions.end());
+  description.attributes.insert(description.attributes.end(), instanceAttributeDescriptions.begin(), instanceAttributeDescriptions.end());
+
+  vulkanConfig.pipelines.init(vulkanConfig.device, vulkanConfig.pipelineCache, vulkanConfig.threadPool, description);
+
+  // The first frame can't wait for a worker, every other variant can
+  vulkanConfig.graphicsPipeline = vulkanConfig.pipelines.buildNow(PipelineState{});
+
+  if(vulkanConfig.graphicsPipeline == VK_NULL_HANDLE)
+  {
+    LOG_DEBUG("Failed to create graphics pipeline");
+  }
+
+  PipelineState blended{};
+  blended.blend = true;
+  blended.fragmentPath = FRAGMENT_PATH_TEXTURED_TINTED;
+  vulkanConfig.pipelines.request(blended);
+
+  if(assetArchive.find("shaders/sprite_vert.spv").empty())
+  {
+    LOG_DEBUG("Sprite vertex shader missing, sprites are not drawn");
+    return;
+  }
+
+  // Sprites come as plain quads in binding 0, rotated sprites may face either way
+  PipelineManager::Description spriteDescription = description;
+  spriteDescription.vertexShader = createShaderModule(loadAsset("shaders/sprite_vert.spv"));
+  spriteDescription.fragmentShader = createShaderModule(loadAsset(vulkanConfig.bindless ? "shaders/frag_bindless.spv" : "shaders/frag.spv"));
+  spriteDescription.bindings = {bindingDescription};
+  spriteDescription.attributes.assign(attributeDescriptions.begin(), attributeDescriptions.end());
+
+  vulkanConfig.spritePipelines.init(vulkanConfig.device, vulkanConfig.pipelineCache, vulkanConfig.threadPool, spriteDescription);
+
+  PipelineState tintedSprite = blended;
+  tintedSprite.cullMode = VK_CULL_MODE_NONE;
+  vulkanConfig.spriteMaterials = {tintedSprite};
+
+  vulkanConfig.spritePipeline = vulkanConfig.spritePipelines.buildNow(vulkanConfig.spriteMaterials[0]);
+  vulkanConfig.spritesEnabled = vulkanConfig.spritePipeline != VK_NULL_HANDLE;
+}
+
+void createRenderPass()
+{
+  if(vulkanConfig.dynamicRendering)
+  {
+    return;
+  }
+
+  bool msaa = vulkanConfig.msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+
+  // Images to be presented in the swap chain, or sampled by the upscale pass
+  VkImageLayout targetLayout = vulkanConfig.dynamicResolution ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+  // With MSAA this is the transient multisampled image, resolved at the end
+  // of the subpass, and only the resolve target leaves tile memory
+  VkAttachmentDescription colorAttachment{};
+  // colorAttachment.flags;
+  colorAttachment.format = vulkanConfig.swapChainImageFormat;
+  colorAttachment.samples = vulkanConfig.msaaSamples;
+  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  colorAttachment.storeOp = msaa ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  colorAttachment.finalLayout = msaa ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : targetLayout;
+
+  VkAttachmentDescription depthAttachment{};
+  depthAttachment.format = vulkanConfig.depthFormat;
+  depthAttachment.samples = vulkanConfig.msaaSamples;
+  depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  // Fully written by the resolve, nothing to load
+  VkAttachmentDescription resolveAttachment{};
+  resolveAttachment.format = vulkanConfig.swapChainImageFormat;
+  resolveAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  resolveAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  resolveAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  resolveAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  resolveAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  resolveAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  resolveAttachment.finalLayout = targetLayout;
+
+  VkAttachmentReference colorAttachmentRef{};
+  colorAttachmentRef.attachment = 0;
+  colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentReference depthAttachmentRef{};
+  depthAttachmentRef.attachment = 1;
+  depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentReference resolveAttachmentRef{};
+  resolveAttachmentRef.attachment = 2;
+  resolveAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpass{};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &colorAttachmentRef;
+  subpass.pResolveAttachments = msaa ? &resolveAttachmentRef : nullptr;
+  subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+  // The transient attachments and the scene image are shared by the frames
+  // in flight, so this also orders against the previous frame's writes to
+  // them and its upscale pass reading the scene
+  VkSubpassDependency dependencies[2]{};
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+  dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+  // The upscale pass samples what the subpass wrote
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  VkAttachmentDescription attachments[] = {colorAttachment, depthAttachment, resolveAttachment};
+
+  VkRenderPassCreateInfo renderPassInfo{};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassInfo.attachmentCount = msaa ? 3 : 2;
+  renderPassInfo.pAttachments = attachments;
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+  renderPassInfo.dependencyCount = vulkanConfig.dynamicResolution ? 2 : 1;
+  renderPassInfo.pDependencies = dependencies;
+
+  if(vkCreateRenderPass(vulkanConfig.device, &renderPassInfo, nullptr, &vulkanConfig.renderPass) != VK_SUCCESS)
+  {
+    LOG_DEBUG("Failed to create render pass");
+  }
+}
+
+// Writes every pixel of the swapchain image, nothing to load or clear
+void createUpscaleRenderPass()
+{
+  if(vulkanConfig.dynamicRendering || !vulkanConfig.dynamicResolution)
+  {
+    return;
+  }
+
+  VkAttachmentDescription colorAttachment{};
+  colorAttachment.format = vulkanConfig.swapChainImageFormat;
+  colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+  VkAttachmentReference colorAttachmentRef{};
+  colorAttachmentRef.attachment = 0;
+  colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
   VkSubpassDescription subpass{};
   subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
@@ -849,7 +1510,6 @@ void createRenderPass()
   VkSubpassDependency dependency{};
   dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
   dependency.dstSubpass = 0;
-
   dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
   dependency.srcAccessMask = 0;
   dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
@@ -864,34 +1524,67 @@ void createRenderPass()
   renderPassInfo.dependencyCount = 1;
   renderPassInfo.pDependencies = &dependency;
 
-  if(vkCreateRenderPass(vulkanConfig.device, &renderPassInfo, nullptr, &vulkanConfig.renderPass) != VK_SUCCESS)
+  if(vkCreateRenderPass(vulkanConfig.device, &renderPassInfo, nullptr, &vulkanConfig.upscaleRenderPass) != VK_SUCCESS)
   {
-    LOG_DEBUG("Failed to create render pass");
+    LOG_DEBUG("Failed to create upscale render pass");
+  }
+}
+
+Framebuffer createFramebuffer(VkRenderPass renderPass, std::span<const VkImageView> attachments)
+{
+  VkFramebufferCreateInfo framebufferInfo{};
+  framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebufferInfo.renderPass = renderPass;
+  framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+  framebufferInfo.pAttachments = attachments.data();
+  framebufferInfo.width = vulkanConfig.swapChainExtent.width;
+  framebufferInfo.height = vulkanConfig.swapChainExtent.height;
+  framebufferInfo.layers = 1;
+
+  VkFramebuffer framebuffer = VK_NULL_HANDLE;
+  if (vkCreateFramebuffer(vulkanConfig.device, &framebufferInfo, nullptr, &framebuffer) != VK_SUCCESS)
+  {
+    LOG_DEBUG("Failed to create framebuffer");
   }
+
+  return Framebuffer(vulkanConfig.deletionQueue, framebuffer);
 }
 
 void createFramebuffers()
 {
-  vulkanConfig.swapChainFramebuffers.resize(vulkanConfig.swapChainImageViews.size());
+  if(vulkanConfig.dynamicRendering)
+  {
+    return;
+  }
+
+  // Matches the attachment order of createRenderPass(), target is where the scene ends up
+  auto sceneAttachments = [](VkImageView target) -> std::vector<VkImageView> {
+    if(vulkanConfig.msaaSamples != VK_SAMPLE_COUNT_1_BIT)
+    {
+      return {vulkanConfig.colorAttachment.view.get(), vulkanConfig.depthAttachment.view.get(), target};
+    }
+
+    return {target, vulkanConfig.depthAttachment.view.get()};
+  };
 
-  for (size_t i = 0; i < vulkanConfig.swapChainImageViews.size(); i++)
+  if(vulkanConfig.dynamicResolution)
   {
-    VkImageView attachments[] = {
-      vulkanConfig.swapChainImageViews[i]
-    };
+    vulkanConfig.sceneFramebuffer = createFramebuffer(vulkanConfig.renderPass, sceneAttachments(vulkanConfig.sceneImageView.get()));
+  }
 
-    VkFramebufferCreateInfo framebufferInfo{};
-    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    framebufferInfo.renderPass = vulkanConfig.renderPass;
-    framebufferInfo.attachmentCount = 1;
-    framebufferInfo.pAttachments = attachments;
-    framebufferInfo.width = vulkanConfig.swapChainExtent.width;
-    framebufferInfo.height = vulkanConfig.swapChainExtent.height;
-    framebufferInfo.layers = 1;
+  vulkanConfig.swapChainFramebuffers.clear();
+
+  for (const ImageView &imageView : vulkanConfig.swapChainImageViews)
+  {
+    VkImageView target = imageView.get();
 
-    if (vkCreateFramebuffer(vulkanConfig.device, &framebufferInfo, nullptr, &vulkanConfig.swapChainFramebuffers[i]) != VK_SUCCESS)
+    if(vulkanConfig.dynamicResolution)
     {
-      LOG_DEBUG("Failed to create framebuffer");
+      vulkanConfig.swapChainFramebuffers.push_back(createFramebuffer(vulkanConfig.upscaleRenderPass, {&target, 1}));
+    }
+    else
+    {
+      vulkanConfig.swapChainFramebuffers.push_back(createFramebuffer(vulkanConfig.renderPass, sceneAttachments(target)));
     }
   }
 }
@@ -902,258 +1595,758 @@ void createCommandPool()
 
   VkCommandPoolCreateInfo poolInfo{};
   poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
   poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
 
-  if (vkCreateCommandPool(vulkanConfig.device, &poolInfo, nullptr, &vulkanConfig.commandPool) != VK_SUCCESS)
+  vulkanConfig.commandPools.clear();
+
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
   {
-    LOG_DEBUG("Failed to create command pool");
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    if (vkCreateCommandPool(vulkanConfig.device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create command pool");
+    }
+
+    vulkanConfig.commandPools.emplace_back(vulkanConfig.deletionQueue, commandPool);
   }
+
+  vulkanConfig.recorder.init(vulkanConfig.device, queueFamilyIndices.graphicsFamily.value(), vulkanConfig.threadPool, MAX_FRAMES_IN_FLIGHT);
 }
 
-void createCommandBuffer()
+// Cached command buffers recorded before this are re-recorded before their next use
+void markCommandBuffersDirty()
 {
-  vulkanConfig.commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  vulkanConfig.commandGeneration++;
+}
 
-  VkCommandBufferAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.commandPool = vulkanConfig.commandPool;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandBufferCount = static_cast<uint32_t>(vulkanConfig.commandBuffers.size());
+// One cached command buffer per frame in flight and swapchain image, the
+// swapchain image and the per-frame buffers being the only differences
+void createCachedCommandBuffers()
+{
+  // Command buffers in here are re-recorded one at a time
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.queueFamilyIndex = vulkanConfig.queueFamilyIndices.graphicsFamily.value();
 
-  if (vkAllocateCommandBuffers(vulkanConfig.device, &allocInfo, vulkanConfig.commandBuffers.data()) != VK_SUCCESS)
+  VkCommandPool commandPool = VK_NULL_HANDLE;
+  if (vkCreateCommandPool(vulkanConfig.device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
   {
-    LOG_DEBUG("Failed to create command buffer");
+    LOG_DEBUG("Failed to create cached command pool");
   }
-}
 
-void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
-  VkCommandBufferBeginInfo beginInfo{};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = 0; // Optional
-  beginInfo.pInheritanceInfo = nullptr; // Optional
+  // The previous pool, if any, goes with its swapchain and takes its command buffers along
+  vulkanConfig.cachedCommandPool = CommandPool(vulkanConfig.deletionQueue, commandPool);
 
-  if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+  vulkanConfig.cachedCommandBuffers.assign(MAX_FRAMES_IN_FLIGHT, std::vector<CachedCommandBuffer>(vulkanConfig.swapChainImages.size()));
+
+  for (auto &frameBuffers : vulkanConfig.cachedCommandBuffers)
   {
-    LOG_DEBUG("Failed to begin recording the command buffer");
+    for (auto &cached : frameBuffers)
+    {
+      VkCommandBufferAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.commandPool = commandPool;
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      allocInfo.commandBufferCount = 1;
+
+      if (vkAllocateCommandBuffers(vulkanConfig.device, &allocInfo, &cached.buffer) != VK_SUCCESS)
+      {
+        LOG_DEBUG("Failed to create cached command buffer");
+      }
+    }
   }
 
-  VkRenderPassBeginInfo renderPassInfo{};
-  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-  renderPassInfo.renderPass = vulkanConfig.renderPass;
-  renderPassInfo.framebuffer = vulkanConfig.swapChainFramebuffers[imageIndex];
+  markCommandBuffersDirty();
+}
 
-  renderPassInfo.renderArea.offset = {0, 0};
-  renderPassInfo.renderArea.extent = vulkanConfig.swapChainExtent;
+void createCommandBuffer()
+{
+  vulkanConfig.commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
 
-  VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-  renderPassInfo.clearValueCount = 1;
-  renderPassInfo.pClearValues = &clearColor;
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+  {
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = vulkanConfig.commandPools[i].get();
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
 
-  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    if (vkAllocateCommandBuffers(vulkanConfig.device, &allocInfo, &vulkanConfig.commandBuffers[i]) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create command buffer");
+    }
+  }
+
+  vulkanConfig.cacheCommandBuffers = cacheCommandBuffers;
+
+  createCachedCommandBuffers();
+}
 
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkanConfig.graphicsPipeline);
+// The variant the frame asked for, or the default one until it is built
+VkPipeline selectPipeline()
+{
+  VkPipeline pipeline = vulkanConfig.pipelines.get(vulkanConfig.pipelineState);
+  return pipeline != VK_NULL_HANDLE ? pipeline : vulkanConfig.graphicsPipeline;
+}
+
+// Binds everything the draws need and draws instances [firstInstance, firstInstance + instanceCount),
+// or the culled indirect draws. Only reads state the render thread leaves alone while recording.
+void recordDraws(VkCommandBuffer commandBuffer, uint32_t frame, VkPipeline pipeline, uint32_t firstInstance, uint32_t instanceCount)
+{
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
   VkViewport viewport{};
   viewport.x = 0.0f;
   viewport.y = 0.0f;
-  viewport.width = static_cast<float>(vulkanConfig.swapChainExtent.width);
-  viewport.height = static_cast<float>(vulkanConfig.swapChainExtent.height);
+  viewport.width = static_cast<float>(vulkanConfig.renderExtent.width);
+  viewport.height = static_cast<float>(vulkanConfig.renderExtent.height);
   viewport.minDepth = 0.0f;
   viewport.maxDepth = 1.0f;
   vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
   VkRect2D scissor{};
   scissor.offset = {0, 0};
-  scissor.extent = vulkanConfig.swapChainExtent;
+  scissor.extent = vulkanConfig.renderExtent;
   vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-  VkBuffer vertexBuffers[] = {vulkanConfig.vertexBuffer};
-  VkDeviceSize offsets[] = {0};
-  vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+  VkBuffer vertexBuffers[] = {vulkanConfig.vertexBuffer.get(), vulkanConfig.instanceBuffers[frame].get()};
+  VkDeviceSize offsets[] = {0, 0};
+  vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
 
-  vkCmdBindIndexBuffer(commandBuffer, vulkanConfig.indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+  vkCmdBindIndexBuffer(commandBuffer, vulkanConfig.indexBuffer.get(), 0, VK_INDEX_TYPE_UINT16);
 
-  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkanConfig.pipelineLayout, 0, 1, &vulkanConfig.descriptorSets[currentFrame], 0, nullptr);
-  vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+  VkDescriptorSet descriptorSets[] = {vulkanConfig.descriptorSets[frame], vulkanConfig.textureTable.getDescriptorSet()};
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkanConfig.pipelineLayout, 0, vulkanConfig.bindless ? 2 : 1, descriptorSets, 0, nullptr);
 
-  vkCmdEndRenderPass(commandBuffer);
+  if(vulkanConfig.quadMesh == GeometryArena::INVALID_MESH)
+  {
+    return;
+  }
 
-  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+  if(vulkanConfig.culler.isEnabled())
   {
-    LOG_DEBUG("Failed to end recording the command buffer");
+    vulkanConfig.culler.draw(commandBuffer, frame, InstanceData::getBindingDescription().binding);
+  }
+  else if(instanceCount > 0)
+  {
+    const GeometryArena::Mesh &quad = vulkanConfig.geometry.getMesh(vulkanConfig.quadMesh);
+    vkCmdDrawIndexed(commandBuffer, quad.indexCount, instanceCount, quad.firstIndex, static_cast<int32_t>(quad.firstVertex), firstInstance);
   }
 }
 
-uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+// Draws this frame's sprite batches after the instances, recordDraws() must
+// have bound the descriptor sets and dynamic state into commandBuffer
+void recordSprites(VkCommandBuffer commandBuffer, uint32_t frame)
 {
-  VkPhysicalDeviceMemoryProperties memProperties;
-  vkGetPhysicalDeviceMemoryProperties(vulkanConfig.physicalDevice, &memProperties);
+  if(!vulkanConfig.spritesEnabled)
+  {
+    return;
+  }
 
-  uint32_t memoryType = std::numeric_limits<uint32_t>::max();
+  auto bind = [](VkCommandBuffer commandBuffer, uint32_t material, uint32_t texture) {
+    VkPipeline pipeline = VK_NULL_HANDLE;
 
-  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-    if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-      memoryType = i;
+    if(material < vulkanConfig.spriteMaterials.size())
+    {
+      pipeline = vulkanConfig.spritePipelines.get(vulkanConfig.spriteMaterials[material]);
     }
-  }
 
-  if(memoryType == std::numeric_limits<uint32_t>::max())
-  {
-    LOG_DEBUG("Failed to find suitable memory type");
-  }
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline != VK_NULL_HANDLE ? pipeline : vulkanConfig.spritePipeline);
+    vkCmdPushConstants(commandBuffer, vulkanConfig.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &texture);
+  };
 
-  return memoryType;
+  vulkanConfig.sprites.draw(commandBuffer, frame, bind);
 }
 
-void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-  VkBufferCreateInfo bufferInfo{};
-  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferInfo.size = size;
-  bufferInfo.usage = usage;
-  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+// Moves the swapchain image between presenting and being rendered to, the
+// render pass does the same through its attachment layouts and dependency
+void transitionSwapChainImage(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool toAttachment)
+{
+  VkImageMemoryBarrier2 barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = vulkanConfig.swapChainImages[imageIndex];
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
 
-  if (vkCreateBuffer(vulkanConfig.device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-    LOG_DEBUG("failed to create buffer!");
+  if(toAttachment)
+  {
+    // Ordered after the acquire semaphore wait, which is at this stage too
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    barrier.srcAccessMask = 0;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  }
+  else
+  {
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
   }
 
-  VkMemoryRequirements memRequirements;
-  vkGetBufferMemoryRequirements(vulkanConfig.device, buffer, &memRequirements);
+  VkDependencyInfo dependencyInfo{};
+  dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dependencyInfo.imageMemoryBarrierCount = 1;
+  dependencyInfo.pImageMemoryBarriers = &barrier;
 
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+  PipelineBarriers::record(commandBuffer, dependencyInfo);
+}
 
-  if (vkAllocateMemory(vulkanConfig.device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-    LOG_DEBUG("failed to allocate buffer memory!");
+// Moves the scene image between being sampled by the upscale pass and being
+// rendered to, for dynamic rendering. The previous frame's upscale pass may
+// still be reading it.
+void transitionSceneImage(VkCommandBuffer commandBuffer, bool toAttachment)
+{
+  VkImageMemoryBarrier2 barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = vulkanConfig.sceneImage.get();
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.layerCount = 1;
+
+  if(toAttachment)
+  {
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    barrier.srcAccessMask = 0;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  }
+  else
+  {
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
   }
 
-  vkBindBufferMemory(vulkanConfig.device, buffer, bufferMemory, 0);
-}
+  VkDependencyInfo dependencyInfo{};
+  dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dependencyInfo.imageMemoryBarrierCount = 1;
+  dependencyInfo.pImageMemoryBarriers = &barrier;
 
-VkCommandBuffer beginSingleTimeCommands() {
-  VkCommandBufferAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandPool = vulkanConfig.commandPool;
-  allocInfo.commandBufferCount = 1;
+  PipelineBarriers::record(commandBuffer, dependencyInfo);
+}
 
-  VkCommandBuffer commandBuffer;
-  vkAllocateCommandBuffers(vulkanConfig.device, &allocInfo, &commandBuffer);
+// Dynamic rendering has no render pass to discard the transient attachments,
+// they start every frame undefined. The frames in flight share them, so the
+// barriers also order against the previous frame's writes.
+void transitionTransientAttachments(VkCommandBuffer commandBuffer)
+{
+  VkImageMemoryBarrier2 barriers[2]{};
+  uint32_t barrierCount = 0;
 
-  VkCommandBufferBeginInfo beginInfo{};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  if(vulkanConfig.colorAttachment.image)
+  {
+    VkImageMemoryBarrier2 &barrier = barriers[barrierCount++];
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    barrier.image = vulkanConfig.colorAttachment.image.get();
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+
+  VkImageMemoryBarrier2 &barrier = barriers[barrierCount++];
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+  barrier.srcStageMask = VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+  barrier.srcAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  barrier.dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT;
+  barrier.dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  barrier.image = vulkanConfig.depthAttachment.image.get();
+  barrier.subresourceRange.aspectMask = getDepthAspect(vulkanConfig.depthFormat);
+
+  for(uint32_t i = 0; i < barrierCount; i++)
+  {
+    barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[i].subresourceRange.levelCount = 1;
+    barriers[i].subresourceRange.layerCount = 1;
+  }
 
-  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  VkDependencyInfo dependencyInfo{};
+  dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dependencyInfo.imageMemoryBarrierCount = barrierCount;
+  dependencyInfo.pImageMemoryBarriers = barriers;
 
-  return commandBuffer;
+  PipelineBarriers::record(commandBuffer, dependencyInfo);
 }
 
-void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-  vkEndCommandBuffer(commandBuffer);
+// Starts drawing into swapchain image imageIndex, through the render pass or
+// dynamic rendering. secondaries says whether the draws come from vkCmdExecuteCommands.
+void beginRendering(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool secondaries)
+{
+  VkClearValue clearValues[2]{};
+  clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+  clearValues[1].depthStencil = {1.0f, 0};
 
-  VkSubmitInfo submitInfo{};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffer;
+  bool msaa = vulkanConfig.msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+
+  if(vulkanConfig.dynamicRendering)
+  {
+    if(vulkanConfig.dynamicResolution)
+    {
+      transitionSceneImage(commandBuffer, true);
+    }
+    else
+    {
+      transitionSwapChainImage(commandBuffer, imageIndex, true);
+    }
+
+    transitionTransientAttachments(commandBuffer);
+
+    // The scene image with dynamic resolution, the swapchain image otherwise
+    VkImageView target = vulkanConfig.dynamicResolution ? vulkanConfig.sceneImageView.get() : vulkanConfig.swapChainImageViews[imageIndex].get();
+
+    // With MSAA the target is only written by the resolve
+    VkRenderingAttachmentInfo colorAttachment{};
+    colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    colorAttachment.imageView = msaa ? vulkanConfig.colorAttachment.view.get() : target;
+    colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = msaa ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.clearValue = clearValues[0];
+
+    if(msaa)
+    {
+      colorAttachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+      colorAttachment.resolveImageView = target;
+      colorAttachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
+
+    VkRenderingAttachmentInfo depthAttachment{};
+    depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    depthAttachment.imageView = vulkanConfig.depthAttachment.view.get();
+    depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.clearValue = clearValues[1];
+
+    VkRenderingInfo renderingInfo{};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    renderingInfo.flags = secondaries ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+    renderingInfo.renderArea.offset = {0, 0};
+    renderingInfo.renderArea.extent = vulkanConfig.renderExtent;
+    renderingInfo.layerCount = 1;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachments = &colorAttachment;
+    renderingInfo.pDepthAttachment = &depthAttachment;
+
+    vulkanConfig.cmdBeginRendering(commandBuffer, &renderingInfo);
+    return;
+  }
+
+  VkRenderPassBeginInfo renderPassInfo{};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  renderPassInfo.renderPass = vulkanConfig.renderPass;
+  renderPassInfo.framebuffer = vulkanConfig.dynamicResolution ? vulkanConfig.sceneFramebuffer.get() : vulkanConfig.swapChainFramebuffers[imageIndex].get();
+
+  renderPassInfo.renderArea.offset = {0, 0};
+  renderPassInfo.renderArea.extent = vulkanConfig.renderExtent;
 
-  vkQueueSubmit(vulkanConfig.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(vulkanConfig.graphicsQueue);
+  // The resolve attachment isn't cleared
+  renderPassInfo.clearValueCount = 2;
+  renderPassInfo.pClearValues = clearValues;
 
-  vkFreeCommandBuffers(vulkanConfig.device, vulkanConfig.commandPool, 1, &commandBuffer);
+  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, secondaries ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
 }
 
-void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout) {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+// Stretches the rendered part of the scene image over swapchain image
+// imageIndex, leaving it ready to present
+void recordUpscale(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+  if(vulkanConfig.dynamicRendering)
+  {
+    transitionSceneImage(commandBuffer, false);
+    transitionSwapChainImage(commandBuffer, imageIndex, true);
 
-  VkImageMemoryBarrier barrier{};
-  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  barrier.oldLayout = oldLayout;
-  barrier.newLayout = newLayout;
+    // Every pixel is written, nothing to load
+    VkRenderingAttachmentInfo colorAttachment{};
+    colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    colorAttachment.imageView = vulkanConfig.swapChainImageViews[imageIndex].get();
+    colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 
-  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    VkRenderingInfo renderingInfo{};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    renderingInfo.renderArea.offset = {0, 0};
+    renderingInfo.renderArea.extent = vulkanConfig.swapChainExtent;
+    renderingInfo.layerCount = 1;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachments = &colorAttachment;
 
-  barrier.image = image;
-  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  barrier.subresourceRange.baseMipLevel = 0;
-  barrier.subresourceRange.levelCount = 1;
-  barrier.subresourceRange.baseArrayLayer = 0;
-  barrier.subresourceRange.layerCount = 1;
+    vulkanConfig.cmdBeginRendering(commandBuffer, &renderingInfo);
+    vulkanConfig.upscaler.draw(commandBuffer, vulkanConfig.renderExtent, vulkanConfig.swapChainExtent);
+    vulkanConfig.cmdEndRendering(commandBuffer);
 
-  VkPipelineStageFlags sourceStage;
-  VkPipelineStageFlags destinationStage;
+    transitionSwapChainImage(commandBuffer, imageIndex, false);
+    return;
+  }
 
-  if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  VkRenderPassBeginInfo renderPassInfo{};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  renderPassInfo.renderPass = vulkanConfig.upscaleRenderPass;
+  renderPassInfo.framebuffer = vulkanConfig.swapChainFramebuffers[imageIndex].get();
+  renderPassInfo.renderArea.offset = {0, 0};
+  renderPassInfo.renderArea.extent = vulkanConfig.swapChainExtent;
 
-    sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-  } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+  vulkanConfig.upscaler.draw(commandBuffer, vulkanConfig.renderExtent, vulkanConfig.swapChainExtent);
+  vkCmdEndRenderPass(commandBuffer);
+}
 
-    sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-  } else {
-    LOG_DEBUG("unsupported layout transition!");
+// Leaves swapchain image imageIndex ready to present
+void endRendering(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+  if(vulkanConfig.dynamicRendering)
+  {
+    vulkanConfig.cmdEndRendering(commandBuffer);
+
+    if(!vulkanConfig.dynamicResolution)
+    {
+      transitionSwapChainImage(commandBuffer, imageIndex, false);
+    }
+  }
+  else
+  {
+    vkCmdEndRenderPass(commandBuffer);
   }
 
-  vkCmdPipelineBarrier(
-    commandBuffer,
-    sourceStage, destinationStage,
-    0,
-    0, nullptr,
-    0, nullptr,
-    1, &barrier
-  );
+  if(vulkanConfig.dynamicResolution)
+  {
+    recordUpscale(commandBuffer, imageIndex);
+  }
+}
+
+// cached command buffers are submitted many times and draw inline, the
+// others are recorded for one submission with the draws split across threads
+void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool cached) {
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = cached ? 0 : VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  beginInfo.pInheritanceInfo = nullptr; // Optional
+
+  if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+  {
+    LOG_DEBUG("Failed to begin recording the command buffer");
+  }
+
+  if(vulkanConfig.dynamicResolution)
+  {
+    vulkanConfig.frameTimer.begin(commandBuffer, currentFrame);
+  }
+
+  if(vulkanConfig.culler.isEnabled())
+  {
+    vulkanConfig.culler.record(commandBuffer, currentFrame);
+  }
+
+  VkPipeline pipeline = selectPipeline();
+  uint32_t frame = currentFrame;
+  uint32_t instanceCount = vulkanConfig.instanceCounts[frame];
+
+  if(cached)
+  {
+    beginRendering(commandBuffer, imageIndex, false);
+    recordDraws(commandBuffer, frame, pipeline, 0, instanceCount);
+    recordSprites(commandBuffer, frame);
+    endRendering(commandBuffer, imageIndex);
+  }
+  else
+  {
+    beginRendering(commandBuffer, imageIndex, true);
+
+    // Indirect draws come as one command, direct ones are split by instance range
+    uint32_t sliceCount = 1;
+    if(!vulkanConfig.culler.isEnabled())
+    {
+      sliceCount = (instanceCount + MIN_INSTANCES_PER_SLICE - 1) / MIN_INSTANCES_PER_SLICE;
+      sliceCount = std::min(sliceCount, vulkanConfig.recorder.getMaxSlices());
+    }
+
+    // Secondaries inside dynamic rendering get the attachment formats instead of a render pass
+    VkCommandBufferInheritanceRenderingInfo inheritanceRendering{};
+    inheritanceRendering.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+    inheritanceRendering.colorAttachmentCount = 1;
+    inheritanceRendering.pColorAttachmentFormats = &vulkanConfig.swapChainImageFormat;
+    inheritanceRendering.depthAttachmentFormat = vulkanConfig.depthFormat;
+    inheritanceRendering.rasterizationSamples = vulkanConfig.msaaSamples;
+
+    VkCommandBufferInheritanceInfo inheritance{};
+    inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+
+    if(vulkanConfig.dynamicRendering)
+    {
+      inheritance.pNext = &inheritanceRendering;
+    }
+    else
+    {
+      inheritance.renderPass = vulkanConfig.renderPass;
+      inheritance.subpass = 0;
+      inheritance.framebuffer = vulkanConfig.dynamicResolution ? vulkanConfig.sceneFramebuffer.get() : vulkanConfig.swapChainFramebuffers[imageIndex].get();
+    }
+
+    auto recordSlice = [pipeline, frame, instanceCount, sliceCount](VkCommandBuffer commandBuffer, uint32_t slice) {
+      uint32_t firstInstance = static_cast<uint32_t>(uint64_t(instanceCount) * slice / sliceCount);
+      uint32_t endInstance = static_cast<uint32_t>(uint64_t(instanceCount) * (slice + 1) / sliceCount);
+      recordDraws(commandBuffer, frame, pipeline, firstInstance, endInstance - firstInstance);
+
+      // Sprites keep their batch order, so they go after the last slice's instances
+      if(slice == sliceCount - 1)
+      {
+        recordSprites(commandBuffer, frame);
+      }
+    };
+
+    std::span<const VkCommandBuffer> secondaries = vulkanConfig.recorder.record(frame, sliceCount, inheritance, recordSlice);
+
+    if(!secondaries.empty())
+    {
+      vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+    }
 
-  endSingleTimeCommands(commandBuffer);
+    endRendering(commandBuffer, imageIndex);
+  }
+
+  if(vulkanConfig.dynamicResolution)
+  {
+    vulkanConfig.frameTimer.end(commandBuffer, currentFrame);
+  }
+
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+  {
+    LOG_DEBUG("Failed to end recording the command buffer");
+  }
 }
 
-void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+// The command buffer to submit this frame. Cached ones are only re-recorded
+// when something they bake in changed, everything that changes per frame
+// lives in buffers updated before this.
+VkCommandBuffer prepareCommandBuffer(uint32_t imageIndex)
+{
+  if(!vulkanConfig.cacheCommandBuffers)
+  {
+    // Everything recorded for this frame last time goes at once
+    vkResetCommandPool(vulkanConfig.device, vulkanConfig.commandPools[currentFrame].get(), 0);
+    vulkanConfig.recorder.resetFrame(currentFrame);
+    recordCommandBuffer(vulkanConfig.commandBuffers[currentFrame], imageIndex, false);
 
-  VkBufferImageCopy region{};
-  region.bufferOffset = 0;
-  region.bufferRowLength = 0;
-  region.bufferImageHeight = 0;
+    return vulkanConfig.commandBuffers[currentFrame];
+  }
 
-  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  region.imageSubresource.mipLevel = 0;
-  region.imageSubresource.baseArrayLayer = 0;
-  region.imageSubresource.layerCount = 1;
+  // The culled path reads the instance count from a buffer, the direct draw bakes it in
+  VkPipeline pipeline = selectPipeline();
+  uint32_t instanceCount = vulkanConfig.culler.isEnabled() ? 0 : vulkanConfig.instanceCounts[currentFrame];
 
-  region.imageOffset = {0, 0, 0};
-  region.imageExtent = {
-    width,
-    height,
-    1
-  };
+  // Sprite vertices live in buffers, their batches and pipelines are baked in
+  uint64_t spriteGeneration = vulkanConfig.sprites.getGeneration();
+  uint32_t spritePending = vulkanConfig.spritePipelines.getPendingCount();
 
-  vkCmdCopyBufferToImage(
-    commandBuffer,
-    buffer,
-    image,
-    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-    1,
-    &region
-  );
+  // So are the mesh offsets, until compaction moves them
+  uint64_t geometryGeneration = vulkanConfig.geometry.getGeneration();
+
+  if(
+    pipeline != vulkanConfig.recordedPipeline || instanceCount != vulkanConfig.recordedInstanceCount ||
+    spriteGeneration != vulkanConfig.recordedSpriteGeneration || spritePending != vulkanConfig.recordedSpritePending ||
+    geometryGeneration != vulkanConfig.recordedGeometryGeneration
+  )
+  {
+    vulkanConfig.recordedPipeline = pipeline;
+    vulkanConfig.recordedInstanceCount = instanceCount;
+    vulkanConfig.recordedSpriteGeneration = spriteGeneration;
+    vulkanConfig.recordedSpritePending = spritePending;
+    vulkanConfig.recordedGeometryGeneration = geometryGeneration;
+    markCommandBuffersDirty();
+  }
+
+  CachedCommandBuffer &cached = vulkanConfig.cachedCommandBuffers[currentFrame][imageIndex];
+
+  if(cached.generation != vulkanConfig.commandGeneration)
+  {
+    vkResetCommandBuffer(cached.buffer, 0);
+    recordCommandBuffer(cached.buffer, imageIndex, true);
+    cached.generation = vulkanConfig.commandGeneration;
+  }
+
+  return cached.buffer;
+}
+
+uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+  uint32_t memoryType = vulkanConfig.allocator.findMemoryType(typeFilter, properties);
+
+  if(memoryType == std::numeric_limits<uint32_t>::max())
+  {
+    LOG_DEBUG("Failed to find suitable memory type");
+  }
+
+  return memoryType;
+}
+
+void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, GpuAllocation& bufferAllocation) {
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  uint32_t queueFamilies[] = {vulkanConfig.queueFamilyIndices.graphicsFamily.value(), vulkanConfig.uploadQueue.getQueueFamily()};
+
+  // Written on the transfer queue, read on the graphics queue
+  if ((usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) && queueFamilies[0] != queueFamilies[1]) {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount = 2;
+    bufferInfo.pQueueFamilyIndices = queueFamilies;
+  }
+
+  if (vkCreateBuffer(vulkanConfig.device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+    LOG_DEBUG("failed to create buffer!");
+  }
+
+  if (!vulkanConfig.allocator.allocateBuffer(buffer, properties, bufferAllocation)) {
+    LOG_DEBUG("failed to allocate buffer memory!");
+  }
+}
+
+Buffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
+{
+  VkBuffer buffer = VK_NULL_HANDLE;
+  GpuAllocation allocation;
+  createBuffer(size, usage, properties, buffer, allocation);
+
+  return Buffer(vulkanConfig.deletionQueue, buffer, allocation);
+}
+
+void createStagingRing(VkDeviceSize size)
+{
+  vulkanConfig.stagingRing.init(vulkanConfig.device, vulkanConfig.allocator, size);
+}
+
+void createUploadQueue()
+{
+  const QueueFamilyIndices &indices = vulkanConfig.queueFamilyIndices;
+  uint32_t queueFamily = indices.transferFamily.value_or(indices.graphicsFamily.value());
+
+  LOG_DEBUG("Uploads use queue family {}{}", queueFamily, indices.transferFamily.has_value() ? " (dedicated transfer)" : " (graphics fallback)");
+
+  vulkanConfig.uploadQueue.init(vulkanConfig.device, queueFamily, vulkanConfig.transferQueue, &vulkanConfig.stagingRing, vulkanConfig.timelineSemaphores);
+}
+
+void createMipmapGenerator()
+{
+  vulkanConfig.mipmapQueue.init(vulkanConfig.device, vulkanConfig.queueFamilyIndices.graphicsFamily.value(), vulkanConfig.graphicsQueue, nullptr, vulkanConfig.timelineSemaphores);
+  vulkanConfig.mipmapGenerator.init(vulkanConfig.physicalDevice, vulkanConfig.device, vulkanConfig.pipelineCache.getHandle(), loadAsset("shaders/mipmap.spv"));
+}
+
+// Generates the queued mip chains on the graphics queue once the level 0 copies up to uploads are done
+UploadTicket flushMipmaps(UploadTicket uploads)
+{
+  if(!vulkanConfig.mipmapGenerator.hasPendingWork())
+  {
+    return vulkanConfig.mipmapQueue.getLastTicket();
+  }
+
+  // Without timelines both run on the graphics queue, in submission order
+  if(vulkanConfig.timelineSemaphores)
+  {
+    vulkanConfig.mipmapQueue.waitFor(vulkanConfig.uploadQueue.getTimeline(), uploads.value, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  }
+
+  vulkanConfig.mipmapGenerator.record(vulkanConfig.mipmapQueue.record());
+
+  UploadTicket ticket = vulkanConfig.mipmapQueue.flush();
+  vulkanConfig.mipmapGenerator.retire(ticket.value);
+
+  return ticket;
+}
+
+// Record the copy out of slice before staging anything else. A full ring
+// submits the open batch and recycles it, along with any slice handed out
+// earlier that no copy has been recorded for yet.
+bool stageUpload(const void *data, VkDeviceSize size, StagingRing::Slice &slice)
+{
+  StagingRing &ring = vulkanConfig.stagingRing;
+
+  // Grow instead of failing when a single upload is bigger than the whole ring
+  if(size > ring.getCapacity())
+  {
+    vulkanConfig.uploadQueue.flush();
+    ring.waitIdle();
+
+    if(ring.isIdle())
+    {
+      VkDeviceSize capacity = ring.getCapacity();
+      while(capacity < size)
+      {
+        capacity *= 2;
+      }
+
+      ring.destroy();
+      createStagingRing(capacity);
+    }
+  }
+
+  while(!ring.allocate(size, StagingRing::DEFAULT_ALIGNMENT, slice))
+  {
+    // The open batch may be what fills the ring, submit it so it can retire
+    if(vulkanConfig.uploadQueue.hasPendingWork())
+    {
+      vulkanConfig.uploadQueue.flush();
+    }
 
-  endSingleTimeCommands(commandBuffer);
+    if(!ring.waitOldest())
+    {
+      LOG_DEBUG("Upload of {} bytes does not fit in the staging ring", size);
+      return false;
+    }
+  }
+
+  memcpy(slice.data, data, static_cast<size_t>(size));
+  return true;
 }
 
-void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+// Consumer side of an upload's release barrier. Transfer only queues can't
+// name graphics stages, the timeline wait on the graphics queue covers it.
+TransferRecorder::Destination uploadDestination(VkPipelineStageFlags2 stage, VkAccessFlags2 access)
+{
+  if (vulkanConfig.queueFamilyIndices.transferFamily.has_value()) {
+    return {};
+  }
+
+  return {stage, access};
+}
+
+void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageCreateFlags flags, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, GpuAllocation& imageAllocation) {
   VkImageCreateInfo imageInfo{};
   imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
   imageInfo.imageType = VK_IMAGE_TYPE_2D;
   imageInfo.extent.width = width;
   imageInfo.extent.height = height;
   imageInfo.extent.depth = 1;
-  imageInfo.mipLevels = 1;
+  imageInfo.flags = flags;
+  imageInfo.mipLevels = mipLevels;
   imageInfo.arrayLayers = 1;
   imageInfo.format = format;
   imageInfo.tiling = tiling;
@@ -1162,98 +2355,481 @@ void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling
   imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
   imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+  uint32_t queueFamilies[] = {vulkanConfig.queueFamilyIndices.graphicsFamily.value(), vulkanConfig.uploadQueue.getQueueFamily()};
+
+  // Written on the transfer queue, read on the graphics queue
+  if ((usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT) && queueFamilies[0] != queueFamilies[1]) {
+    imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    imageInfo.queueFamilyIndexCount = 2;
+    imageInfo.pQueueFamilyIndices = queueFamilies;
+  }
+
   if (vkCreateImage(vulkanConfig.device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
     LOG_DEBUG("failed to create image!");
   }
 
-  VkMemoryRequirements memRequirements;
-  vkGetImageMemoryRequirements(vulkanConfig.device, image, &memRequirements);
+  if (!vulkanConfig.allocator.allocateImage(image, properties, imageAllocation)) {
+    LOG_DEBUG("failed to allocate image memory!");
+  }
+}
+
+Image createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageCreateFlags flags, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties)
+{
+  VkImage image = VK_NULL_HANDLE;
+  GpuAllocation allocation;
+  createImage(width, height, mipLevels, format, flags, tiling, usage, properties, image, allocation);
+
+  return Image(vulkanConfig.deletionQueue, image, allocation);
+}
+
+bool isFormatSampleable(VkFormat format)
+{
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties(vulkanConfig.physicalDevice, format, &properties);
+
+  VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+  return (properties.optimalTilingFeatures & required) == required;
+}
+
+// Runs on a worker thread. Picks the first block compressed variant of name
+// the device can sample, trying the one most likely to be supported on this
+// platform first, and falls back to decoding name.jpg to RGBA8.
+bool decodeTexture(const std::string &name, DecodedImage &image)
+{
+  #ifdef __ANDROID__
+  const char *variants[] = {"astc", "etc2", "bc7"};
+  #else
+  const char *variants[] = {"bc7", "astc", "etc2"};
+  #endif
+
+  for(const char *variant : variants)
+  {
+    std::string filename = name + "." + variant + ".ktx2";
+    std::span<const char> file = assetArchive.find(filename);
+
+    if(file.empty() || !parseKtx2(file.data(), file.size(), image.ktx))
+    {
+      continue;
+    }
+
+    if(!isFormatSampleable(image.ktx.format))
+    {
+      LOG_DEBUG("Skipping {}, format {} is not supported", filename, static_cast<int>(image.ktx.format));
+      continue;
+    }
+
+    image.file = file;
+    image.width = image.ktx.width;
+    image.height = image.ktx.height;
+    return true;
+  }
+
+  // No usable compressed variant, decode the JPEG to RGBA8 instead
+  std::string filename = name + ".jpg";
+
+  std::span<const char> encoded = loadAsset(filename);
+
+  if(encoded.empty())
+  {
+    return false;
+  }
+
+  #ifdef __ANDROID__
+  AImageDecoder *androidDecoder = nullptr;
+
+  if(AImageDecoder_createFromBuffer(encoded.data(), encoded.size(), &androidDecoder) != ANDROID_IMAGE_DECODER_SUCCESS)
+  {
+    LOG_DEBUG("Failed to create image decoder for {}", filename);
+    return false;
+  }
+
+  AImageDecoder_setAndroidBitmapFormat(androidDecoder, ANDROID_BITMAP_FORMAT_RGBA_8888);
+
+  const AImageDecoderHeaderInfo *imageHeader = AImageDecoder_getHeaderInfo(androidDecoder);
+
+  image.width = static_cast<uint32_t>(AImageDecoderHeaderInfo_getWidth(imageHeader));
+  image.height = static_cast<uint32_t>(AImageDecoderHeaderInfo_getHeight(imageHeader));
+  size_t stride = AImageDecoder_getMinimumStride(androidDecoder);
+
+  size_t bufferSize = image.height * stride;
+  image.pixels.reset(static_cast<unsigned char*>(malloc(bufferSize)));
+
+  int decodeResult = AImageDecoder_decodeImage(androidDecoder, image.pixels.get(), stride, bufferSize);
+
+  AImageDecoder_delete(androidDecoder);
+
+  if(decodeResult != ANDROID_IMAGE_DECODER_SUCCESS)
+  {
+    LOG_DEBUG("Failed to decode image {}", filename);
+    return false;
+  }
+
+  #else
+  int texWidth, texHeight, texChannels;
+  const stbi_uc *encodedBytes = reinterpret_cast<const stbi_uc*>(encoded.data());
+  image.pixels.reset(stbi_load_from_memory(encodedBytes, static_cast<int>(encoded.size()), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha));
+
+  if (!image.pixels) {
+    LOG_DEBUG("Failed to load texture image {}", filename);
+    return false;
+  }
+
+  image.width = static_cast<uint32_t>(texWidth);
+  image.height = static_cast<uint32_t>(texHeight);
+  #endif
+
+  return true;
+}
+
+// False when the upload could not be staged, the current texture stays
+bool createCompressedTextureImage(DecodedImage &image)
+{
+  const KtxTexture &ktx = image.ktx;
+
+  // All levels are contiguous in the file, one copy into staging covers them
+  StagingRing::Slice staging;
+  if(!stageUpload(image.file.data() + ktx.dataOffset, ktx.dataSize, staging))
+  {
+    return false;
+  }
+
+  vulkanConfig.textureFormat = ktx.format;
+  vulkanConfig.textureMipLevels = static_cast<uint32_t>(ktx.levels.size());
+
+  vulkanConfig.textureImage = createImage(ktx.width, ktx.height, vulkanConfig.textureMipLevels, ktx.format, 0, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  std::vector<VkBufferImageCopy> regions(ktx.levels.size());
+  for(uint32_t level = 0; level < regions.size(); level++)
+  {
+    regions[level].bufferOffset = staging.offset + (ktx.levels[level].offset - ktx.dataOffset);
+    regions[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    regions[level].imageSubresource.mipLevel = level;
+    regions[level].imageSubresource.baseArrayLayer = 0;
+    regions[level].imageSubresource.layerCount = 1;
+    regions[level].imageOffset = {0, 0, 0};
+    regions[level].imageExtent = {std::max(ktx.width >> level, 1u), std::max(ktx.height >> level, 1u), 1};
+  }
+
+  TransferRecorder::Destination destination = uploadDestination(VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+  vulkanConfig.uploadQueue.getRecorder().uploadImageRegions(staging.buffer, regions.data(), static_cast<uint32_t>(regions.size()), vulkanConfig.textureImage.get(), vulkanConfig.textureMipLevels, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, destination);
+  return true;
+}
+
+// False when the upload could not be staged, the current texture stays
+bool createUncompressedTextureImage(DecodedImage &image)
+{
+  VkDeviceSize imageSize = static_cast<VkDeviceSize>(image.width) * image.height * 4;
+
+  StagingRing::Slice staging;
+  if(!stageUpload(image.pixels.get(), imageSize, staging))
+  {
+    return false;
+  }
+
+  image.pixels.reset();
+
+  VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+  vulkanConfig.textureFormat = format;
+  MipmapGenerator::Method mipmapMethod = vulkanConfig.mipmapGenerator.selectMethod(format);
+
+  if(mipmapMethod == MipmapGenerator::Method::None)
+  {
+    LOG_DEBUG("Format {} can't be mipmapped on this device", static_cast<int>(format));
+  }
+
+  uint32_t width = image.width;
+  uint32_t height = image.height;
+  vulkanConfig.textureMipLevels = mipmapMethod == MipmapGenerator::Method::None ? 1 : MipmapGenerator::getMipLevelCount(width, height);
+
+  VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | MipmapGenerator::getImageUsage(mipmapMethod);
+  vulkanConfig.textureImage = createImage(width, height, vulkanConfig.textureMipLevels, format, MipmapGenerator::getImageFlags(mipmapMethod, format), VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  VkExtent3D extent = {width, height, 1};
+  TransferRecorder::Destination destination = uploadDestination(VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+
+  // With a mip chain level 0 stays in TRANSFER_DST, the generator moves every level to SHADER_READ_ONLY
+  VkImageLayout finalLayout = vulkanConfig.textureMipLevels > 1 ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vulkanConfig.uploadQueue.getRecorder().uploadImage(staging.buffer, staging.offset, vulkanConfig.textureImage.get(), extent, vulkanConfig.textureMipLevels, finalLayout, destination);
+
+  vulkanConfig.mipmapGenerator.generate(vulkanConfig.textureImage.get(), format, width, height, vulkanConfig.textureMipLevels, mipmapMethod);
+  return true;
+}
+
+// Drops the standalone texture once another one replaced it. Its image and
+// view are destroyed when the frames still sampling them are done, the slot
+// is reused after as many frames.
+void releaseTextureImage()
+{
+  vulkanConfig.textureImageView.reset();
+  vulkanConfig.textureImage.reset();
+
+  if(vulkanConfig.bindless)
+  {
+    vulkanConfig.textureTable.release(vulkanConfig.textureImageSlot, vulkanConfig.frameNumber);
+    vulkanConfig.textureImageSlot = TextureTable::INVALID_SLOT;
+  }
+}
+
+// Pages are only ever written where nothing was placed before, so they stay
+// in GENERAL and are sampled while later images are copied in
+void createAtlasPage()
+{
+  AtlasPage page;
+  uint32_t size = vulkanConfig.atlas.getPageSize();
+  uint32_t mipLevels = vulkanConfig.atlas.getMipLevels();
+  VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+
+  page.image = createImage(size, size, mipLevels, format, 0, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  vulkanConfig.uploadQueue.getRecorder().initializeImage(page.image.get(), mipLevels, VK_IMAGE_LAYOUT_GENERAL);
+
+  page.view = ImageView(vulkanConfig.deletionQueue, createImageView(page.image.get(), format, mipLevels));
+  page.slot = registerTexture(page.view.get(), VK_IMAGE_LAYOUT_GENERAL);
+
+  vulkanConfig.atlasPages.push_back(std::move(page));
+  LOG_DEBUG("Opened atlas page {}", vulkanConfig.atlasPages.size() - 1);
+}
+
+// What every instance samples, the instance buffers pick it up on their next update
+void setInstanceTexture(uint32_t slot, glm::vec4 uvRect)
+{
+  vulkanConfig.textureSlot = slot;
+  vulkanConfig.textureUvRect = uvRect;
+  vulkanConfig.instanceGeneration++;
+}
+
+// Small uncompressed images share atlas pages, which needs the texture table
+// to reach them. False when the image has to get an image of its own.
+bool addToAtlas(DecodedImage &image)
+{
+  if(!vulkanConfig.bindless || image.isCompressed() || image.width > ATLAS_MAX_IMAGE_SIZE || image.height > ATLAS_MAX_IMAGE_SIZE)
+  {
+    return false;
+  }
+
+  TextureAtlas::Block block;
+  if(!vulkanConfig.atlas.insert(image.pixels.get(), image.width, image.height, block))
+  {
+    return false;
+  }
+
+  StagingRing::Slice staging;
+  if(!stageUpload(block.pixels.data(), block.pixels.size(), staging))
+  {
+    // The block would never be written, give its space back
+    vulkanConfig.atlas.revertLastInsert();
+    return false;
+  }
+
+  if(block.page == vulkanConfig.atlasPages.size())
+  {
+    createAtlasPage();
+  }
+
+  image.pixels.reset();
+
+  std::vector<VkBufferImageCopy> regions;
+  for(uint32_t level = 0; level < block.levels.size(); level++)
+  {
+    const TextureAtlas::Level &blockLevel = block.levels[level];
+
+    VkBufferImageCopy region{};
+    region.bufferOffset = staging.offset + blockLevel.offset;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = level;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {static_cast<int32_t>(blockLevel.x), static_cast<int32_t>(blockLevel.y), 0};
+    region.imageExtent = {blockLevel.width, blockLevel.height, 1};
+    regions.push_back(region);
+  }
+
+  const AtlasPage &page = vulkanConfig.atlasPages[block.page];
+  TransferRecorder::Destination destination = uploadDestination(VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+  vulkanConfig.uploadQueue.getRecorder().updateImageRegions(staging.buffer, regions.data(), static_cast<uint32_t>(regions.size()), page.image.get(), VK_IMAGE_LAYOUT_GENERAL, destination);
+
+  setInstanceTexture(page.slot, block.uvRect);
+
+  uint32_t percentUsed = static_cast<uint32_t>(vulkanConfig.atlas.getOccupancy(block.page) * 100.0f + 0.5f);
+  LOG_DEBUG("Packed {} ({}x{}) into atlas page {}, {}% used", image.name, image.width, image.height, block.page, percentUsed);
+  return true;
+}
+
+// Runs on the render thread for every texture the loader finished decoding
+void createTextureImage(DecodedImage &image)
+{
+  if(!image.valid)
+  {
+    LOG_DEBUG("Texture {} failed to load, keeping the placeholder", image.name);
+    return;
+  }
+
+  if(addToAtlas(image))
+  {
+    // The texture now lives on an atlas page
+    releaseTextureImage();
+    return;
+  }
+
+  // Replacing textureImage queues the earlier one for destruction
+  bool created = image.isCompressed() ? createCompressedTextureImage(image) : createUncompressedTextureImage(image);
+  if(!created)
+  {
+    return;
+  }
+
+  vulkanConfig.textureImageView = ImageView(vulkanConfig.deletionQueue, createImageView(vulkanConfig.textureImage.get(), vulkanConfig.textureFormat, vulkanConfig.textureMipLevels, VK_IMAGE_USAGE_SAMPLED_BIT));
+
+  if(vulkanConfig.bindless)
+  {
+    // Instances pick the new slot up on their next write, nothing gets re-recorded
+    vulkanConfig.textureTable.release(vulkanConfig.textureImageSlot, vulkanConfig.frameNumber);
+    vulkanConfig.textureImageSlot = registerTexture(vulkanConfig.textureImageView.get());
+  }
+  else
+  {
+    std::fill(vulkanConfig.textureDescriptorStale.begin(), vulkanConfig.textureDescriptorStale.end(), true);
+  }
+
+  // The whole image, an atlas texture before it only covered part of its page
+  setInstanceTexture(vulkanConfig.textureImageSlot, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+
+  LOG_DEBUG("Loaded {} ({}x{}, {} levels)", image.name, image.width, image.height, vulkanConfig.textureMipLevels);
+}
+
+// Bound until the real texture has been uploaded
+void createPlaceholderTexture()
+{
+  const uint32_t pixel = 0xff808080;
+
+  vulkanConfig.placeholderImage = createImage(1, 1, 1, VK_FORMAT_R8G8B8A8_UNORM, 0, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  StagingRing::Slice staging;
+  if(stageUpload(&pixel, sizeof(pixel), staging))
+  {
+    TransferRecorder::Destination destination = uploadDestination(VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+    vulkanConfig.uploadQueue.getRecorder().uploadImage(staging.buffer, staging.offset, vulkanConfig.placeholderImage.get(), {1, 1, 1}, 1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, destination);
+  }
+  else
+  {
+    // Every descriptor falls back on it, so it still has to be in a sampleable layout
+    LOG_DEBUG("Placeholder texture could not be staged, its contents stay undefined");
+    vulkanConfig.uploadQueue.getRecorder().initializeImage(vulkanConfig.placeholderImage.get(), 1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  }
+
+  vulkanConfig.placeholderImageView = ImageView(vulkanConfig.deletionQueue, createImageView(vulkanConfig.placeholderImage.get(), VK_FORMAT_R8G8B8A8_UNORM, 1));
+  vulkanConfig.placeholderSlot = registerTexture(vulkanConfig.placeholderImageView.get());
+  vulkanConfig.instanceGeneration++;
+}
+
+void createTextureAtlas()
+{
+  // Pages are R8G8B8A8_SRGB, see createAtlasPage()
+  vulkanConfig.atlas.init(ATLAS_PAGE_SIZE, ATLAS_PADDING, ATLAS_MIP_LEVELS, ATLAS_MAX_PAGES, true);
+}
+
+void createTextureLoader()
+{
+  vulkanConfig.textureLoader.init(vulkanConfig.threadPool, decodeTexture);
 
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+  vulkanConfig.textureLoader.request("textures/texture");
+}
 
-  if (vkAllocateMemory(vulkanConfig.device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-    LOG_DEBUG("failed to allocate image memory!");
+// Uploads whatever finished decoding since the last frame, frames keep
+// rendering with the placeholder until then
+void pollTextureLoader()
+{
+  if(vulkanConfig.textureLoader.poll(createTextureImage) == 0)
+  {
+    return;
   }
 
-  vkBindImageMemory(vulkanConfig.device, image, imageMemory, 0);
+  vulkanConfig.pendingUploads = vulkanConfig.uploadQueue.flush();
+  vulkanConfig.pendingMipmaps = flushMipmaps(vulkanConfig.pendingUploads);
+
+  TextureLoader::Progress progress = vulkanConfig.textureLoader.getProgress();
+  LOG_DEBUG("Textures uploaded {}/{}", progress.uploaded, progress.requested);
 }
 
-void createTextureImage()
+// Moves meshes into the holes freed ones left. The copies go through the
+// upload queue like any other write, so this frame's submission waits for
+// them; frames still in flight keep reading the old ranges.
+void compactGeometry()
 {
-  const char *filename = "textures/texture.jpg";
-  int texWidth, texHeight, texChannels;
-  unsigned char *pixels = nullptr;
-  
-  #ifdef __ANDROID__
-  AAssetManager *am = androidApp->activity->assetManager;
-  AAsset *image = AAssetManager_open(am, filename, AASSET_MODE_BUFFER);
-  AImageDecoder *androidDecoder = nullptr;
-
-  int result = AImageDecoder_createFromAAsset(image, &androidDecoder);
-
-  if(result != ANDROID_IMAGE_DECODER_SUCCESS)
+  if(!vulkanConfig.geometry.isFragmented())
   {
-    LOG_DEBUG("Failed to create image decoder");
+    return;
   }
 
-  AImageDecoder_setAndroidBitmapFormat(androidDecoder, ANDROID_BITMAP_FORMAT_RGBA_8888);
+  std::vector<GeometryArena::Copy> vertexCopies;
+  std::vector<GeometryArena::Copy> indexCopies;
 
-  const AImageDecoderHeaderInfo *imageHeader = AImageDecoder_getHeaderInfo(androidDecoder);
+  if(!vulkanConfig.geometry.compact(vulkanConfig.frameNumber, vertexCopies, indexCopies))
+  {
+    return;
+  }
 
-  texWidth = static_cast<int>(AImageDecoderHeaderInfo_getWidth(imageHeader));
-  texHeight = static_cast<int>(AImageDecoderHeaderInfo_getHeight(imageHeader));
-  size_t stride = AImageDecoder_getMinimumStride(androidDecoder);
+  // Uploads still queued may write the ranges about to be copied, the
+  // barrier in front of the copies only covers earlier batches
+  if(vulkanConfig.uploadQueue.hasPendingWork())
+  {
+    vulkanConfig.uploadQueue.flush();
+  }
 
-  size_t bufferSize = texHeight * stride;
-  pixels = new unsigned char[bufferSize];
+  TransferRecorder &recorder = vulkanConfig.uploadQueue.getRecorder();
 
-  auto decodeResult = AImageDecoder_decodeImage(androidDecoder, pixels, stride, bufferSize);
-  if(decodeResult != ANDROID_IMAGE_DECODER_SUCCESS)
+  TransferRecorder::Destination vertexDestination = uploadDestination(VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT);
+  for(const GeometryArena::Copy &copy : vertexCopies)
   {
-    LOG_DEBUG("Failed to decode image");
+    recorder.copyBuffer(
+      vulkanConfig.vertexBuffer.get(), sizeof(PackedVertex) * VkDeviceSize(copy.source),
+      vulkanConfig.vertexBuffer.get(), sizeof(PackedVertex) * VkDeviceSize(copy.target),
+      sizeof(PackedVertex) * VkDeviceSize(copy.count), vertexDestination
+    );
   }
 
-  #else
-  pixels = stbi_load(filename, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
-  if (!pixels) {
-    LOG_DEBUG("Failed to load texture image");
+  TransferRecorder::Destination indexDestination = uploadDestination(VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, VK_ACCESS_2_INDEX_READ_BIT);
+  for(const GeometryArena::Copy &copy : indexCopies)
+  {
+    recorder.copyBuffer(
+      vulkanConfig.indexBuffer.get(), sizeof(uint16_t) * VkDeviceSize(copy.source),
+      vulkanConfig.indexBuffer.get(), sizeof(uint16_t) * VkDeviceSize(copy.target),
+      sizeof(uint16_t) * VkDeviceSize(copy.count), indexDestination
+    );
   }
-  #endif
 
-  VkDeviceSize imageSize = texWidth * texHeight * 4;
+  vulkanConfig.pendingUploads = vulkanConfig.uploadQueue.flush();
 
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+  LOG_DEBUG("Geometry compacted, moved {} vertex and {} index ranges", vertexCopies.size(), indexCopies.size());
+}
 
-  void* data;
-  vkMapMemory(vulkanConfig.device, stagingBufferMemory, 0, imageSize, 0, &data);
-      memcpy(data, pixels, static_cast<size_t>(imageSize));
-  vkUnmapMemory(vulkanConfig.device, stagingBufferMemory);
+// The set of a frame slot is only rewritten once that slot's previous frame has finished
+void updateTextureDescriptor(uint32_t frame)
+{
+  if(!vulkanConfig.textureDescriptorStale[frame])
+  {
+    return;
+  }
 
-  #ifdef __ANDROID__
-  delete[] pixels;
-  #else
-  stbi_image_free(pixels);
-  #endif
+  VkDescriptorImageInfo imageInfo{};
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  imageInfo.imageView = vulkanConfig.textureImageView ? vulkanConfig.textureImageView.get() : vulkanConfig.placeholderImageView.get();
+  imageInfo.sampler = vulkanConfig.textureSampler.get();
 
-  createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vulkanConfig.textureImage, vulkanConfig.textureImageMemory);
+  VkWriteDescriptorSet descriptorWrite{};
+  descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrite.dstSet = vulkanConfig.descriptorSets[frame];
+  descriptorWrite.dstBinding = 1;
+  descriptorWrite.dstArrayElement = 0;
+  descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pImageInfo = &imageInfo;
 
-  transitionImageLayout(vulkanConfig.textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-  copyBufferToImage(stagingBuffer, vulkanConfig.textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-  transitionImageLayout(vulkanConfig.textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  vkUpdateDescriptorSets(vulkanConfig.device, 1, &descriptorWrite, 0, nullptr);
 
-  vkDestroyBuffer(vulkanConfig.device, stagingBuffer, nullptr);
-  vkFreeMemory(vulkanConfig.device, stagingBufferMemory, nullptr);
-}
+  vulkanConfig.textureDescriptorStale[frame] = false;
 
-void createTextureImageView()
-{
-  vulkanConfig.textureImageView = createImageView(vulkanConfig.textureImage, VK_FORMAT_R8G8B8A8_SRGB);
+  // Recorded command buffers that bound the set are invalid now
+  markCommandBuffersDirty();
 }
 
 void createTextureSampler()
@@ -1282,11 +2858,15 @@ void createTextureSampler()
   samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
   samplerInfo.mipLodBias = 0.0f;
   samplerInfo.minLod = 0.0f;
-  samplerInfo.maxLod = 0.0f;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE; // The texture arrives later, its view limits the levels
 
-  if (vkCreateSampler(vulkanConfig.device, &samplerInfo, nullptr, &vulkanConfig.textureSampler) != VK_SUCCESS) {
+  VkSampler sampler;
+  if (vkCreateSampler(vulkanConfig.device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS) {
     LOG_DEBUG("failed to create texture sampler!");
+    return;
   }
+
+  vulkanConfig.textureSampler = Sampler(vulkanConfig.deletionQueue, sampler);
 }
 
 void createSyncObjects()
@@ -1315,19 +2895,151 @@ void createSyncObjects()
   }
 }
 
-void cleanUpSwapChain()
+// Needs timestamps on the graphics queue, rendering stays at full resolution without them
+void createFrameTimer()
+{
+  if(!enableDynamicResolution)
+  {
+    return;
+  }
+
+  vulkanConfig.dynamicResolution = vulkanConfig.frameTimer.init(vulkanConfig.physicalDevice, vulkanConfig.device, vulkanConfig.queueFamilyIndices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT);
+
+  if(!vulkanConfig.dynamicResolution)
+  {
+    LOG_DEBUG("No timestamps on the graphics queue, dynamic resolution disabled");
+    return;
+  }
+
+  ResolutionController::Settings settings{};
+  settings.targetMilliseconds = TARGET_FRAME_MILLISECONDS;
+  settings.minScale = MIN_RENDER_SCALE;
+  vulkanConfig.resolution.init(settings);
+}
+
+// Before createRenderPass(), which lays the scene out for the upscaler only
+// when there is one. Without it the scene goes straight to the swapchain.
+void createUpscaler()
+{
+  if(!vulkanConfig.dynamicResolution)
+  {
+    return;
+  }
+
+  VkShaderModule vertexShader = createShaderModule(loadAsset("shaders/upscale_vert.spv"));
+  VkShaderModule fragmentShader = createShaderModule(loadAsset("shaders/upscale_frag.spv"));
+
+  bool created = vertexShader != VK_NULL_HANDLE && fragmentShader != VK_NULL_HANDLE;
+
+  if(created)
+  {
+    created = vulkanConfig.upscaler.init(vulkanConfig.device, vulkanConfig.deletionQueue, vulkanConfig.pipelineCache, vertexShader, fragmentShader, vulkanConfig.upscaleRenderPass, vulkanConfig.swapChainImageFormat);
+  }
+  else
+  {
+    vkDestroyShaderModule(vulkanConfig.device, vertexShader, nullptr);
+    vkDestroyShaderModule(vulkanConfig.device, fragmentShader, nullptr);
+  }
+
+  if(created)
+  {
+    return;
+  }
+
+  LOG_DEBUG("Failed to create upscaler, rendering at full resolution");
+
+  vulkanConfig.upscaler.destroy();
+  vulkanConfig.frameTimer.destroy();
+  vkDestroyRenderPass(vulkanConfig.device, vulkanConfig.upscaleRenderPass, nullptr);
+  vulkanConfig.upscaleRenderPass = VK_NULL_HANDLE;
+  vulkanConfig.dynamicResolution = false;
+}
+
+void updateRenderExtent()
+{
+  vulkanConfig.renderExtent = vulkanConfig.dynamicResolution ? vulkanConfig.resolution.scaleExtent(vulkanConfig.swapChainExtent) : vulkanConfig.swapChainExtent;
+}
+
+// Full swapchain size, so a scale change only moves the render area and
+// never reallocates
+void createSceneTarget()
+{
+  updateRenderExtent();
+
+  if(!vulkanConfig.dynamicResolution)
+  {
+    return;
+  }
+
+  vulkanConfig.sceneImage = createImage(
+    vulkanConfig.swapChainExtent.width, vulkanConfig.swapChainExtent.height, 1, vulkanConfig.swapChainImageFormat, 0, VK_IMAGE_TILING_OPTIMAL,
+    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+  );
+
+  vulkanConfig.sceneImageView = ImageView(vulkanConfig.deletionQueue, createImageView(vulkanConfig.sceneImage.get(), vulkanConfig.swapChainImageFormat, 1));
+  vulkanConfig.upscaler.setSource(vulkanConfig.sceneImageView.get(), vulkanConfig.swapChainExtent);
+}
+
+// Feeds the GPU time of this frame's previous submission to the controller,
+// its fence must have signalled
+void updateRenderScale(uint32_t frame)
 {
-  for (auto framebuffer : vulkanConfig.swapChainFramebuffers)
+  float milliseconds;
+  if(!vulkanConfig.dynamicResolution || !vulkanConfig.frameTimer.read(frame, milliseconds))
+  {
+    return;
+  }
+
+  if(vulkanConfig.resolution.update(milliseconds))
   {
-    vkDestroyFramebuffer(vulkanConfig.device, framebuffer, nullptr);
+    updateRenderExtent();
+    markCommandBuffersDirty();
+
+    LOG_DEBUG("Render scale {} at {} ms, rendering {}x{}", vulkanConfig.resolution.getScale(), vulkanConfig.resolution.getAverageMilliseconds(), vulkanConfig.renderExtent.width, vulkanConfig.renderExtent.height);
   }
+}
 
-  for (auto imageView : vulkanConfig.swapChainImageViews)
+void createFramePacing()
+{
+  if(vulkanConfig.presentWaitSupported)
   {
-    vkDestroyImageView(vulkanConfig.device, imageView, nullptr);
+    vulkanConfig.presentWaiter.init(vulkanConfig.device);
+    vulkanConfig.presentWaitSupported = vulkanConfig.presentWaiter.isEnabled();
   }
 
-  vkDestroySwapchainKHR(vulkanConfig.device, vulkanConfig.swapChain, nullptr);
+  vulkanConfig.frameLimiter.setRate(frameRateLimit);
+}
+
+// Hands everything built for the current swapchain to the deletion queue,
+// the frames in flight finish with it first. vulkanConfig.swapChain stays
+// set so the next one can take its images over.
+void releaseSwapChainResources()
+{
+  vulkanConfig.cachedCommandBuffers.clear();
+  vulkanConfig.cachedCommandPool.reset();
+
+  vulkanConfig.swapChainFramebuffers.clear();
+  vulkanConfig.sceneFramebuffer.reset();
+
+  releaseTransientAttachment(vulkanConfig.colorAttachment);
+  releaseTransientAttachment(vulkanConfig.depthAttachment);
+
+  vulkanConfig.sceneImageView.reset();
+  vulkanConfig.sceneImage.reset();
+  vulkanConfig.swapChainImageViews.clear();
+}
+
+// Call after waiting on a frame's fence and before resetting it, so every
+// slot is seen signalled before it is reused
+void collectDeletions()
+{
+  for (uint32_t i = 0; i < vulkanConfig.inFlightFences.size(); i++)
+  {
+    if (vkGetFenceStatus(vulkanConfig.device, vulkanConfig.inFlightFences[i]) == VK_SUCCESS)
+    {
+      vulkanConfig.deletionQueue.collect(i);
+    }
+  }
 }
 
 void recreateSwapChain()
@@ -1343,12 +3055,212 @@ void recreateSwapChain()
   }
   #endif
 
-  vkDeviceWaitIdle(vulkanConfig.device);
-  cleanUpSwapChain();
+  // No drain, the frames in flight finish with what they were recorded
+  // against while the new swapchain takes over the old one's images
+  auto start = std::chrono::steady_clock::now();
+
+  releaseSwapChainResources();
 
   createSwapChain();
   createImageViews();
+  createTransientAttachments();
+  createSceneTarget();
   createFramebuffers();
+  createCachedCommandBuffers();
+
+  float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+  vulkanConfig.swapChainRecreations++;
+  vulkanConfig.slowestSwapChainRecreation = std::max(vulkanConfig.slowestSwapChainRecreation, milliseconds);
+
+  LOG_DEBUG("Recreated swapchain {} in {} ms (slowest {} ms)", vulkanConfig.swapChainRecreations, milliseconds, vulkanConfig.slowestSwapChainRecreation);
+}
+
+// Between frames only, the swapchain is rebuilt for the new mode's present
+// mode and image count
+void setLatencyMode(LatencyMode mode)
+{
+  latencyMode = mode;
+
+  if(isBackendReady)
+  {
+    recreateSwapChain();
+  }
+}
+
+void setFrameRateLimit(uint32_t framesPerSecond)
+{
+  frameRateLimit = framesPerSecond;
+  vulkanConfig.frameLimiter.setRate(framesPerSecond);
+}
+
+#ifndef __ANDROID__
+// Runs inside glfwPollEvents(), between frames
+void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+  if(action != GLFW_PRESS)
+  {
+    return;
+  }
+
+  if(key == GLFW_KEY_L)
+  {
+    LatencyMode next = static_cast<LatencyMode>((static_cast<int>(latencyMode) + 1) % 3);
+    LOG_DEBUG("Switching to {} pacing", getLatencyModeName(next));
+    setLatencyMode(next);
+  }
+  else if(key == GLFW_KEY_F)
+  {
+    const uint32_t *limit = std::find(std::begin(FRAME_RATE_LIMITS), std::end(FRAME_RATE_LIMITS), frameRateLimit);
+    uint32_t next = limit == std::end(FRAME_RATE_LIMITS) || limit + 1 == std::end(FRAME_RATE_LIMITS) ? FRAME_RATE_LIMITS[0] : limit[1];
+    LOG_DEBUG("Frame rate limit {}", next);
+    setFrameRateLimit(next);
+  }
+}
+#endif
+
+// settings.cfg from the archive, then the command line on top of it
+void loadSettings()
+{
+  settings = {};
+
+  std::span<const char> file = assetArchive.find("settings.cfg");
+  settings.parse(std::string_view(file.data(), file.size()));
+
+  for(const std::string &argument : commandLineArguments)
+  {
+    if(!settings.parseArgument(argument))
+    {
+      LOG_DEBUG("Ignoring argument {}, options are --key=value", argument);
+    }
+  }
+
+  preferDynamicRendering = settings.getBool("dynamic_rendering", preferDynamicRendering);
+  cacheCommandBuffers = settings.getBool("cache_command_buffers", cacheCommandBuffers);
+
+  if(std::optional<std::string_view> name = settings.get("latency_mode"))
+  {
+    std::optional<LatencyMode> mode = parseLatencyMode(*name);
+
+    if(mode)
+    {
+      setLatencyMode(*mode);
+    }
+    else
+    {
+      LOG_DEBUG("Unknown latency_mode {}", *name);
+    }
+  }
+
+  setFrameRateLimit(settings.getUint("frame_rate_limit", frameRateLimit));
+}
+
+void createGpuCuller()
+{
+  std::vector<VkBuffer> instanceBuffers;
+  for(const Buffer &buffer : vulkanConfig.instanceBuffers)
+  {
+    instanceBuffers.push_back(buffer.get());
+  }
+
+  vulkanConfig.culler.init(
+    vulkanConfig.device, vulkanConfig.allocator, vulkanConfig.deletionQueue, vulkanConfig.pipelineCache.getHandle(), loadAsset("shaders/cull.spv"),
+    instanceBuffers, sizeof(InstanceData), MAX_INSTANCES
+  );
+}
+
+#ifndef NDEBUG
+// Checks what the GPU found visible the last time this frame ran against the same test on the CPU
+void verifyCulling(uint32_t currentFrame)
+{
+  if(!vulkanConfig.culler.hasResult(currentFrame))
+  {
+    return;
+  }
+
+  const GpuCuller::Frustum &frustum = vulkanConfig.culler.getFrustum(currentFrame);
+  const InstanceData *instances = vulkanConfig.instanceBuffersMapped[currentFrame];
+  uint32_t instanceCount = vulkanConfig.culler.getInstanceCount(currentFrame);
+  uint32_t expected = 0;
+
+  for(uint32_t i = 0; i < instanceCount; i++)
+  {
+    float radius = GpuCuller::boundingRadius(instances[i].transform, meshExtent);
+    expected += GpuCuller::isVisible(frustum, instances[i].translation, radius) ? 1 : 0;
+  }
+
+  uint32_t visible = vulkanConfig.culler.getVisibleCount(currentFrame);
+
+  if(visible != expected)
+  {
+    LOG_DEBUG("GPU culling kept {} of {} instances, the CPU reference kept {}", visible, instanceCount, expected);
+  }
+}
+#endif
+
+// Writes straight into the mapped buffer, the GPU reads it in place. The
+// instances only change with the texture, so each buffer is rewritten once
+// per change instead of every frame.
+void updateInstanceBuffer(uint32_t currentFrame)
+{
+  if(vulkanConfig.instanceBufferGenerations[currentFrame] == vulkanConfig.instanceGeneration)
+  {
+    return;
+  }
+
+  vulkanConfig.instanceBufferGenerations[currentFrame] = vulkanConfig.instanceGeneration;
+
+  InstanceData *instances = vulkanConfig.instanceBuffersMapped[currentFrame];
+  uint32_t count = 0;
+
+  float tileSize = 1.0f / INSTANCE_GRID_SIZE;
+  uint32_t textureIndex = vulkanConfig.textureSlot != TextureTable::INVALID_SLOT ? vulkanConfig.textureSlot : vulkanConfig.placeholderSlot;
+
+  for(uint32_t y = 0; y < INSTANCE_GRID_SIZE && count < MAX_INSTANCES; y++)
+  {
+    for(uint32_t x = 0; x < INSTANCE_GRID_SIZE && count < MAX_INSTANCES; x++)
+    {
+      // The quad spans -0.5..0.5 with its texture mirrored in u, each tile keeps its part of it
+      InstanceData &instance = instances[count++];
+      instance.transform = glm::vec4(tileSize, 0.0f, 0.0f, tileSize);
+      instance.translation = glm::vec2((x + 0.5f) * tileSize - 0.5f, (y + 0.5f) * tileSize - 0.5f);
+      instance.uvRect = TextureAtlas::remap(vulkanConfig.textureUvRect, glm::vec4(1.0f - (x + 1) * tileSize, y * tileSize, tileSize, tileSize));
+      instance.textureIndex = textureIndex;
+    }
+  }
+
+  vulkanConfig.instanceCounts[currentFrame] = count;
+}
+
+void updateSprites(uint32_t currentFrame)
+{
+  if(!vulkanConfig.spritesEnabled)
+  {
+    return;
+  }
+
+  static auto startTime = std::chrono::high_resolution_clock::now();
+  float time = std::chrono::duration<float, std::chrono::seconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+  uint32_t texture = vulkanConfig.textureSlot != TextureTable::INVALID_SLOT ? vulkanConfig.textureSlot : vulkanConfig.placeholderSlot;
+
+  vulkanConfig.sprites.begin(currentFrame);
+
+  for(uint32_t i = 0; i < SPRITE_RING_SIZE; i++)
+  {
+    float angle = time + i * (2.0f * 3.14159265f / SPRITE_RING_SIZE);
+
+    SpriteBatcher::Sprite sprite{};
+    sprite.position = glm::vec2(std::cos(angle), std::sin(angle)) * 0.7f;
+    sprite.size = glm::vec2(0.08f, 0.08f);
+    sprite.rotation = angle;
+    sprite.color = glm::vec3(1.0f, 0.8f, 0.6f);
+    sprite.uvRect = vulkanConfig.textureUvRect;
+    sprite.texture = texture;
+    sprite.material = 0;
+    vulkanConfig.sprites.submit(sprite);
+  }
+
+  vulkanConfig.sprites.end();
 }
 
 void updateUniformBuffer(uint32_t currentFrame)
@@ -1365,14 +3277,43 @@ void updateUniformBuffer(uint32_t currentFrame)
   ubo.proj[1][1] *= -1;
 
   memcpy(vulkanConfig.uniformBuffersMapped[currentFrame], &ubo, sizeof(ubo));
+  vulkanConfig.uniforms = ubo;
 }
 
 void drawFrame()
 {
+  vulkanConfig.frameLimiter.wait();
+
+  // Without present wait the fence below is all that holds the CPU back
+  if(vulkanConfig.presentWaitSupported)
+  {
+    PacingPolicy policy = getPacingPolicy(latencyMode, MAX_FRAMES_IN_FLIGHT);
+    vulkanConfig.presentWaiter.wait(vulkanConfig.swapChain.get(), policy.maxQueuedPresents, PRESENT_WAIT_TIMEOUT);
+  }
+
   vkWaitForFences(vulkanConfig.device, 1, &vulkanConfig.inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+  updateRenderScale(currentFrame);
+  collectDeletions();
+  vulkanConfig.stagingRing.reclaim();
+  vulkanConfig.uploadQueue.collect();
+  vulkanConfig.mipmapQueue.collect();
+  vulkanConfig.mipmapGenerator.collect(vulkanConfig.mipmapQueue.getCompletedValue());
+
+  // Counts submits only, a frame that bails out on acquire never reached the GPU
+  // and must not age whatever the table and arena are holding back
+  if(vulkanConfig.bindless)
+  {
+    vulkanConfig.textureTable.beginFrame(vulkanConfig.frameNumber);
+  }
+
+  vulkanConfig.geometry.beginFrame(vulkanConfig.frameNumber);
+
+  pollTextureLoader();
+  compactGeometry();
+  updateTextureDescriptor(currentFrame);
 
   uint32_t imageIndex;
-  VkResult result = vkAcquireNextImageKHR(vulkanConfig.device, vulkanConfig.swapChain, UINT64_MAX, vulkanConfig.imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+  VkResult result = vkAcquireNextImageKHR(vulkanConfig.device, vulkanConfig.swapChain.get(), UINT64_MAX, vulkanConfig.imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
 
   if (result == VK_ERROR_OUT_OF_DATE_KHR) {
       recreateSwapChain();
@@ -1383,22 +3324,61 @@ void drawFrame()
 
   vkResetFences(vulkanConfig.device, 1, &vulkanConfig.inFlightFences[currentFrame]);
 
-  vkResetCommandBuffer(vulkanConfig.commandBuffers[currentFrame], /*VkCommandBufferResetFlagBits*/ 0);
-  recordCommandBuffer(vulkanConfig.commandBuffers[currentFrame], imageIndex);
+  #ifndef NDEBUG
+  verifyCulling(currentFrame);
+  #endif
 
+  // Recording culls against this frame's matrices and instances
+  updateInstanceBuffer(currentFrame);
+  updateSprites(currentFrame);
   updateUniformBuffer(currentFrame);
 
+  if(vulkanConfig.culler.isEnabled() && vulkanConfig.quadMesh != GeometryArena::INVALID_MESH)
+  {
+    const UniformBufferObject &ubo = vulkanConfig.uniforms;
+    GpuCuller::Frustum frustum = GpuCuller::extractFrustum(ubo.proj * ubo.view * ubo.model);
+    const GeometryArena::Mesh &quad = vulkanConfig.geometry.getMesh(vulkanConfig.quadMesh);
+
+    vulkanConfig.culler.update(currentFrame, frustum, vulkanConfig.instanceCounts[currentFrame], quad.indexCount, quad.firstIndex, static_cast<int32_t>(quad.firstVertex), meshExtent);
+  }
+
+  VkCommandBuffer commandBuffer = prepareCommandBuffer(imageIndex);
+
   VkSubmitInfo submitInfo{};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-  VkSemaphore waitSemaphores[] = {vulkanConfig.imageAvailableSemaphores[currentFrame]};
-  VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+  VkSemaphore waitSemaphores[3] = {vulkanConfig.imageAvailableSemaphores[currentFrame]};
+  VkPipelineStageFlags waitStages[3] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+  uint64_t waitValues[3] = {0}; // Binary semaphore values are ignored
   submitInfo.waitSemaphoreCount = 1;
+
+  // Without timelines uploads and mipmaps were submitted to the graphics queue
+  // ahead of this, their release barriers order them before the draws
+  if(vulkanConfig.timelineSemaphores && !vulkanConfig.uploadQueue.isComplete(vulkanConfig.pendingUploads))
+  {
+    waitSemaphores[submitInfo.waitSemaphoreCount] = vulkanConfig.uploadQueue.getTimeline();
+    waitStages[submitInfo.waitSemaphoreCount] = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    waitValues[submitInfo.waitSemaphoreCount++] = vulkanConfig.pendingUploads.value;
+  }
+
+  if(vulkanConfig.timelineSemaphores && !vulkanConfig.mipmapQueue.isComplete(vulkanConfig.pendingMipmaps))
+  {
+    waitSemaphores[submitInfo.waitSemaphoreCount] = vulkanConfig.mipmapQueue.getTimeline();
+    waitStages[submitInfo.waitSemaphoreCount] = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    waitValues[submitInfo.waitSemaphoreCount++] = vulkanConfig.pendingMipmaps.value;
+  }
+
   submitInfo.pWaitSemaphores = waitSemaphores;
   submitInfo.pWaitDstStageMask = waitStages;
 
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.waitSemaphoreValueCount = submitInfo.waitSemaphoreCount;
+  timelineInfo.pWaitSemaphoreValues = waitValues;
+  submitInfo.pNext = vulkanConfig.timelineSemaphores ? &timelineInfo : nullptr;
+
   submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &vulkanConfig.commandBuffers[currentFrame];
+  submitInfo.pCommandBuffers = &commandBuffer;
 
   VkSemaphore signalSemaphores[] = {vulkanConfig.renderFinishedSemaphores[currentFrame]};
   submitInfo.signalSemaphoreCount = 1;
@@ -1407,6 +3387,17 @@ void drawFrame()
   if (vkQueueSubmit(vulkanConfig.graphicsQueue, 1, &submitInfo, vulkanConfig.inFlightFences[currentFrame]) != VK_SUCCESS) {
     LOG_DEBUG("failed to submit draw command buffer!");
   }
+  else
+  {
+    // Whatever was released up to now is destroyed once this frame's fence signals
+    vulkanConfig.deletionQueue.submit(currentFrame);
+    vulkanConfig.frameNumber++;
+
+    if(vulkanConfig.dynamicResolution)
+    {
+      vulkanConfig.frameTimer.markSubmitted(currentFrame);
+    }
+  }
 
   VkPresentInfoKHR presentInfo{};
   presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1414,12 +3405,25 @@ void drawFrame()
   presentInfo.waitSemaphoreCount = 1;
   presentInfo.pWaitSemaphores = signalSemaphores;
 
-  VkSwapchainKHR swapChains[] = {vulkanConfig.swapChain};
+  VkSwapchainKHR swapChains[] = {vulkanConfig.swapChain.get()};
   presentInfo.swapchainCount = 1;
   presentInfo.pSwapchains = swapChains;
 
   presentInfo.pImageIndices = &imageIndex;
 
+  // Tagged so later frames can wait for this one to reach the display
+  VkPresentIdKHR presentId{};
+  presentId.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+  presentId.swapchainCount = 1;
+
+  uint64_t presentIdValue = 0;
+  if(vulkanConfig.presentWaitSupported)
+  {
+    presentIdValue = vulkanConfig.presentWaiter.next();
+    presentId.pPresentIds = &presentIdValue;
+    presentInfo.pNext = &presentId;
+  }
+
   result = vkQueuePresentKHR(vulkanConfig.presentQueue, &presentInfo);
 
   if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
@@ -1429,62 +3433,98 @@ void drawFrame()
     LOG_DEBUG("failed to present swap chain image!");
   }
 
-  currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+  currentFrame = (currentFrame + 1) % vulkanConfig.framesInFlight;
 }
 
 
-void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+// One vertex and one index buffer every mesh is sub allocated from
+void createGeometryArena()
 {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+  vulkanConfig.geometry.init(GEOMETRY_MAX_VERTICES, GEOMETRY_MAX_INDICES, MAX_FRAMES_IN_FLIGHT);
 
-  VkBufferCopy copyRegion{};
-  copyRegion.size = size;
-  vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+  // Compaction copies within the buffers
+  VkBufferUsageFlags transferUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 
-  endSingleTimeCommands(commandBuffer);
+  vulkanConfig.vertexBuffer = createBuffer(sizeof(PackedVertex) * VkDeviceSize(GEOMETRY_MAX_VERTICES), transferUsage | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  vulkanConfig.indexBuffer = createBuffer(sizeof(uint16_t) * VkDeviceSize(GEOMETRY_MAX_INDICES), transferUsage | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 }
 
-
-void createVertexBuffer()
+// Packs a mesh into the geometry arena and records its upload. Indices are
+// relative to the mesh's first vertex. INVALID_MESH when the arena is full or
+// the data can't be staged.
+uint32_t uploadMesh(std::span<const Vertex> meshVertices, std::span<const uint16_t> meshIndices)
 {
-  VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+  uint32_t mesh = vulkanConfig.geometry.allocate(static_cast<uint32_t>(meshVertices.size()), static_cast<uint32_t>(meshIndices.size()));
+
+  if(mesh == GeometryArena::INVALID_MESH)
+  {
+    LOG_DEBUG("Geometry arena full, mesh of {} vertices and {} indices left out", meshVertices.size(), meshIndices.size());
+    return mesh;
+  }
+
+  const GeometryArena::Mesh &ranges = vulkanConfig.geometry.getMesh(mesh);
+
+  std::vector<PackedVertex> packedVertices(meshVertices.size());
+  packVertices(meshVertices.data(), packedVertices.data(), meshVertices.size());
 
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+  VkDeviceSize vertexSize = sizeof(PackedVertex) * packedVertices.size();
+  VkDeviceSize indexSize = sizeof(uint16_t) * meshIndices.size();
 
-  void* data;
-  vkMapMemory(vulkanConfig.device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, vertices.data(), (size_t) bufferSize);
-  vkUnmapMemory(vulkanConfig.device, stagingBufferMemory);
+  // Each copy is recorded before the next slice is staged, see stageUpload()
+  StagingRing::Slice vertexStaging;
+  if(!stageUpload(packedVertices.data(), vertexSize, vertexStaging))
+  {
+    vulkanConfig.geometry.free(mesh, vulkanConfig.frameNumber);
+    return GeometryArena::INVALID_MESH;
+  }
+
+  TransferRecorder::Destination vertexDestination = uploadDestination(VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT);
+  vulkanConfig.uploadQueue.getRecorder().uploadBuffer(vertexStaging.buffer, vertexStaging.offset, vulkanConfig.vertexBuffer.get(), sizeof(PackedVertex) * VkDeviceSize(ranges.firstVertex), vertexSize, vertexDestination);
+
+  StagingRing::Slice indexStaging;
+  if(!stageUpload(meshIndices.data(), indexSize, indexStaging))
+  {
+    // The vertex copy is already recorded, the ranges stay reserved past it
+    vulkanConfig.geometry.free(mesh, vulkanConfig.frameNumber);
+    return GeometryArena::INVALID_MESH;
+  }
 
-  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vulkanConfig.vertexBuffer, vulkanConfig.vertexBufferMemory);
+  TransferRecorder::Destination indexDestination = uploadDestination(VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, VK_ACCESS_2_INDEX_READ_BIT);
+  vulkanConfig.uploadQueue.getRecorder().uploadBuffer(indexStaging.buffer, indexStaging.offset, vulkanConfig.indexBuffer.get(), sizeof(uint16_t) * VkDeviceSize(ranges.firstIndex), indexSize, indexDestination);
 
-  copyBuffer(stagingBuffer, vulkanConfig.vertexBuffer, bufferSize);
+  return mesh;
+}
 
-  vkDestroyBuffer(vulkanConfig.device, stagingBuffer, nullptr);
-  vkFreeMemory(vulkanConfig.device, stagingBufferMemory, nullptr);
+void createMeshes()
+{
+  vulkanConfig.quadMesh = uploadMesh(vertices, indices);
 }
 
-void createIndexBuffer()
+// The static index pattern all sprite batches draw from, and the batcher on top of it
+void createSpriteBatcher()
 {
-  VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+  if(!vulkanConfig.spritesEnabled)
+  {
+    return;
+  }
 
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+  std::vector<uint32_t> pattern = SpriteBatcher::buildIndexPattern(MAX_SPRITES);
+  VkDeviceSize bufferSize = sizeof(pattern[0]) * pattern.size();
 
-  void* data;
-  vkMapMemory(vulkanConfig.device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices.data(), (size_t) bufferSize);
-  vkUnmapMemory(vulkanConfig.device, stagingBufferMemory);
+  StagingRing::Slice staging;
+  if(!stageUpload(pattern.data(), bufferSize, staging))
+  {
+    LOG_DEBUG("Sprite index pattern could not be staged, sprites disabled");
+    vulkanConfig.spritesEnabled = false;
+    return;
+  }
 
-  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vulkanConfig.indexBuffer, vulkanConfig.indexBufferMemory);
+  vulkanConfig.spriteIndexBuffer = createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-  copyBuffer(stagingBuffer, vulkanConfig.indexBuffer, bufferSize);
+  TransferRecorder::Destination destination = uploadDestination(VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, VK_ACCESS_2_INDEX_READ_BIT);
+  vulkanConfig.uploadQueue.getRecorder().uploadBuffer(staging.buffer, staging.offset, vulkanConfig.spriteIndexBuffer.get(), 0, bufferSize, destination);
 
-  vkDestroyBuffer(vulkanConfig.device, stagingBuffer, nullptr);
-  vkFreeMemory(vulkanConfig.device, stagingBufferMemory, nullptr);
+  vulkanConfig.spritesEnabled = vulkanConfig.sprites.init(vulkanConfig.device, vulkanConfig.allocator, vulkanConfig.deletionQueue, vulkanConfig.spriteIndexBuffer.get(), MAX_SPRITES, MAX_FRAMES_IN_FLIGHT);
 }
 
 void createDescriptorSetLayout()
@@ -1514,18 +3554,36 @@ void createDescriptorSetLayout()
   }
 }
 
+void createInstanceBuffers()
+{
+  VkDeviceSize bufferSize = sizeof(InstanceData) * MAX_INSTANCES;
+
+  vulkanConfig.instanceBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  vulkanConfig.instanceBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+  vulkanConfig.instanceCounts.resize(MAX_FRAMES_IN_FLIGHT, 0);
+  vulkanConfig.instanceBufferGenerations.assign(MAX_FRAMES_IN_FLIGHT, 0);
+
+  // One per frame in flight, so the CPU never writes instances the GPU is still reading
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    // Also read as a storage buffer by the cull shader
+    vulkanConfig.instanceBuffers[i] = createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    vulkanConfig.instanceBuffersMapped[i] = static_cast<InstanceData*>(vulkanConfig.instanceBuffers[i].getAllocation().mapped);
+  }
+}
+
 void createUniformBuffers()
 {
   VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
   vulkanConfig.uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-  vulkanConfig.uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
   vulkanConfig.uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
 
   for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, vulkanConfig.uniformBuffers[i], vulkanConfig.uniformBuffersMemory[i]);
+    vulkanConfig.uniformBuffers[i] = createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    vkMapMemory(vulkanConfig.device, vulkanConfig.uniformBuffersMemory[i], 0, bufferSize, 0, &vulkanConfig.uniformBuffersMapped[i]);
+    // Host visible blocks are persistently mapped by the allocator
+    vulkanConfig.uniformBuffersMapped[i] = vulkanConfig.uniformBuffers[i].getAllocation().mapped;
   }
 }
 
@@ -1543,9 +3601,12 @@ void createDescriptorPool()
   poolInfo.pPoolSizes = poolSizes.data();
   poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
-  if (vkCreateDescriptorPool(vulkanConfig.device, &poolInfo, nullptr, &vulkanConfig.descriptorPool) != VK_SUCCESS) {
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  if (vkCreateDescriptorPool(vulkanConfig.device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
     LOG_DEBUG("failed to create descriptor pool!");
   }
+
+  vulkanConfig.descriptorPool = DescriptorPool(vulkanConfig.deletionQueue, descriptorPool);
 }
 
 void createDescriptorSets()
@@ -1553,7 +3614,7 @@ void createDescriptorSets()
   std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, vulkanConfig.descriptorSetLayout);
   VkDescriptorSetAllocateInfo allocInfo{};
   allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-  allocInfo.descriptorPool = vulkanConfig.descriptorPool;
+  allocInfo.descriptorPool = vulkanConfig.descriptorPool.get();
   allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
   allocInfo.pSetLayouts = layouts.data();
 
@@ -1565,14 +3626,14 @@ void createDescriptorSets()
 
   for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
     VkDescriptorBufferInfo bufferInfo{};
-    bufferInfo.buffer = vulkanConfig.uniformBuffers[i];
+    bufferInfo.buffer = vulkanConfig.uniformBuffers[i].get();
     bufferInfo.offset = 0;
     bufferInfo.range = sizeof(UniformBufferObject);
 
     VkDescriptorImageInfo imageInfo{};
     imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    imageInfo.imageView = vulkanConfig.textureImageView;
-    imageInfo.sampler = vulkanConfig.textureSampler;
+    imageInfo.imageView = vulkanConfig.placeholderImageView.get();
+    imageInfo.sampler = vulkanConfig.textureSampler.get();
 
     std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
 
@@ -1594,35 +3655,33 @@ void createDescriptorSets()
 
     vkUpdateDescriptorSets(vulkanConfig.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
   }
+
+  vulkanConfig.textureDescriptorStale.assign(MAX_FRAMES_IN_FLIGHT, false);
 }
 
 void cleanUp()
 {
   LOG_DEBUG("Cleaning up");
 
-  cleanUpSwapChain();
+  vulkanConfig.threadPool.destroy();
 
-  vkDestroySampler(vulkanConfig.device, vulkanConfig.textureSampler, nullptr);
-  vkDestroyImageView(vulkanConfig.device, vulkanConfig.textureImageView, nullptr);
+  // The device is idle, every Resource still alive and everything released
+  // during the last frames goes now
+  vulkanConfig.deletionQueue.releaseAll();
+  vulkanConfig.deletionQueue.flush();
 
-  vkDestroyImage(vulkanConfig.device, vulkanConfig.textureImage, nullptr);
-  vkFreeMemory(vulkanConfig.device, vulkanConfig.textureImageMemory, nullptr);
+  vulkanConfig.culler.destroy();
+  vulkanConfig.textureTable.destroy();
+  vulkanConfig.sprites.destroy();
 
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    vkDestroyBuffer(vulkanConfig.device, vulkanConfig.uniformBuffers[i], nullptr);
-    vkFreeMemory(vulkanConfig.device, vulkanConfig.uniformBuffersMemory[i], nullptr);
+  if(vulkanConfig.dynamicResolution)
+  {
+    vulkanConfig.upscaler.destroy();
+    vulkanConfig.frameTimer.destroy();
   }
 
-  vkDestroyDescriptorPool(vulkanConfig.device, vulkanConfig.descriptorPool, nullptr);
-
   vkDestroyDescriptorSetLayout(vulkanConfig.device, vulkanConfig.descriptorSetLayout, nullptr);
 
-  vkDestroyBuffer(vulkanConfig.device, vulkanConfig.indexBuffer, nullptr);
-  vkFreeMemory(vulkanConfig.device, vulkanConfig.indexBufferMemory, nullptr);
-
-  vkDestroyBuffer(vulkanConfig.device, vulkanConfig.vertexBuffer, nullptr);
-  vkFreeMemory(vulkanConfig.device, vulkanConfig.vertexBufferMemory, nullptr);
-
   for(size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
   {
     vkDestroySemaphore(vulkanConfig.device, vulkanConfig.imageAvailableSemaphores[i], nullptr);
@@ -1630,13 +3689,25 @@ void cleanUp()
     vkDestroyFence(vulkanConfig.device, vulkanConfig.inFlightFences[i], nullptr);
   }
 
-  vkDestroyCommandPool(vulkanConfig.device, vulkanConfig.commandPool, nullptr);
+  vulkanConfig.recorder.destroy();
 
   vkDestroyRenderPass(vulkanConfig.device, vulkanConfig.renderPass, nullptr);
+  vkDestroyRenderPass(vulkanConfig.device, vulkanConfig.upscaleRenderPass, nullptr);
 
-  vkDestroyPipeline(vulkanConfig.device, vulkanConfig.graphicsPipeline, nullptr);
+  vulkanConfig.pipelines.destroy();
+  vulkanConfig.spritePipelines.destroy();
   vkDestroyPipelineLayout(vulkanConfig.device, vulkanConfig.pipelineLayout, nullptr);
 
+  vulkanConfig.mipmapQueue.destroy();
+  vulkanConfig.mipmapGenerator.destroy();
+
+  vulkanConfig.pipelineCache.save();
+  vulkanConfig.pipelineCache.destroy();
+
+  vulkanConfig.uploadQueue.destroy();
+  vulkanConfig.stagingRing.destroy();
+  vulkanConfig.allocator.destroy();
+
   if (enableValidationLayers)
   {
     DestroyDebugUtilsMessengerEXT(vulkanConfig.instance, vulkanConfig.debugMessenger, nullptr);
@@ -1646,6 +3717,8 @@ void cleanUp()
   vkDestroySurfaceKHR(vulkanConfig.instance, vulkanConfig.surface, nullptr);
   vkDestroyInstance(vulkanConfig.instance, nullptr);
 
+  assetArchive.close();
+
   #ifndef __ANDROID__
   glfwDestroyWindow(glfwWindow);
   glfwTerminate();
@@ -1655,28 +3728,55 @@ void cleanUp()
 void initVulkan()
 {
   LOG_DEBUG("Initializing Vulkan");
+  openAssetArchive();
+  loadSettings();
   createInstance(&vulkanConfig.instance);
   setupDebugMessenger();
   createSurface();
   pickPhysicalDevice();
   createLogicalDevice();
+  createFramePacing();
+  selectAttachmentFormats();
+  createFrameTimer();
   createSwapChain();
   createImageViews();
+  createTransientAttachments();
+  createPipelineCache();
+  createUpscaleRenderPass();
+  createUpscaler();
   createRenderPass();
   createDescriptorSetLayout();
+  createTextureTable();
+  createThreadPool();
   createGraphicsPipeline();
+  createSceneTarget();
   createFramebuffers();
   createCommandPool();
-  createTextureImage();
-  createTextureImageView();
+  createStagingRing(StagingRing::DEFAULT_SIZE);
+  createUploadQueue();
+  createMipmapGenerator();
   createTextureSampler();
-  createVertexBuffer();
-  createIndexBuffer();
+  createPlaceholderTexture();
+  createTextureAtlas();
+  createGeometryArena();
+  createMeshes();
+  createSpriteBatcher();
+
+  // Rendering waits for these on the GPU, the CPU carries on
+  vulkanConfig.pendingUploads = vulkanConfig.uploadQueue.flush();
+  vulkanConfig.pendingMipmaps = flushMipmaps(vulkanConfig.pendingUploads);
+
+  createInstanceBuffers();
+  createGpuCuller();
   createUniformBuffers();
   createDescriptorPool();
   createDescriptorSets();
   createCommandBuffer();
   createSyncObjects();
+  createTextureLoader();
+
+  vulkanConfig.allocator.logStats();
+  vulkanConfig.pipelineCache.logStats();
 
   isBackendReady = true;
 }
@@ -1767,6 +3867,7 @@ void initPlatform(android_app *app, int32_t cmd)
 
   glfwWindow = glfwCreateWindow(1280, 720, "Vulkan", nullptr, nullptr);
   glfwSetFramebufferSizeCallback(glfwWindow, framebufferResizeCallback);
+  glfwSetKeyCallback(glfwWindow, keyCallback);
   centerGLFWWindow(glfwWindow);
   initVulkan();
   #endif
@@ -1802,8 +3903,9 @@ void android_main(struct android_app *app)
   run();
 }
 #else
-int main()
+int main(int argc, char **argv)
 {
+  commandLineArguments.assign(argv + 1, argv + argc);
   run();
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,526 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <span>
+#include <vector>
+
+#include "barriers.hpp"
+#include "logger.hpp"
+
+/*
+  Builds full mip chains for uploaded textures on the graphics queue.
+
+  Level 0 arrives in TRANSFER_DST_OPTIMAL (all levels transitioned by the
+  transfer recorder). Formats that support linear filtered blits are
+  downsampled with vkCmdBlitImage, others with the mipmap.comp compute shader
+  through UNORM storage views. Either way every level ends up in
+  SHADER_READ_ONLY_OPTIMAL. Descriptor pools and views used by the compute
+  path are kept until the submission that used them has finished.
+*/
+class MipmapGenerator
+{
+  public:
+  enum class Method
+  {
+    None,
+    Blit,
+    Compute
+  };
+
+  void init(VkPhysicalDevice physicalDevice, VkDevice device, VkPipelineCache pipelineCache, std::span<const char> computeShaderCode)
+  {
+    this->physicalDevice = physicalDevice;
+    this->device = device;
+
+    if(computeShaderCode.empty())
+    {
+      LOG_DEBUG("Mipmap compute shader missing, only blit capable formats get mipmaps");
+      return;
+    }
+
+    VkDescriptorSetLayoutBinding bindings[2]{};
+    for(uint32_t i = 0; i < 2; i++)
+    {
+      bindings[i].binding = i;
+      bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      bindings[i].descriptorCount = 1;
+      bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 2;
+    layoutInfo.pBindings = bindings;
+
+    if(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create mipmap descriptor set layout");
+    }
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(uint32_t);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create mipmap pipeline layout");
+    }
+
+    VkShaderModuleCreateInfo moduleInfo{};
+    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleInfo.codeSize = computeShaderCode.size();
+    moduleInfo.pCode = reinterpret_cast<const uint32_t*>(computeShaderCode.data());
+
+    VkShaderModule shaderModule;
+    if(vkCreateShaderModule(device, &moduleInfo, nullptr, &shaderModule) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create mipmap shader module");
+      return;
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = pipelineLayout;
+
+    if(vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create mipmap compute pipeline");
+    }
+
+    vkDestroyShaderModule(device, shaderModule, nullptr);
+  }
+
+  // The owning queue must be idle
+  void destroy()
+  {
+    collect(UINT64_MAX);
+
+    for(auto &resources : recorded)
+    {
+      release(resources);
+    }
+
+    recorded.clear();
+    jobs.clear();
+
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+
+    pipeline = VK_NULL_HANDLE;
+    pipelineLayout = VK_NULL_HANDLE;
+    descriptorSetLayout = VK_NULL_HANDLE;
+  }
+
+  static uint32_t getMipLevelCount(uint32_t width, uint32_t height)
+  {
+    return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+  }
+
+  Method selectMethod(VkFormat format) const
+  {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+
+    VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    if((properties.optimalTilingFeatures & blitFeatures) == blitFeatures)
+    {
+      return Method::Blit;
+    }
+
+    VkFormat storageFormat = getStorageFormat(format);
+    if(pipeline != VK_NULL_HANDLE && storageFormat != VK_FORMAT_UNDEFINED)
+    {
+      vkGetPhysicalDeviceFormatProperties(physicalDevice, storageFormat, &properties);
+
+      if(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)
+      {
+        return Method::Compute;
+      }
+    }
+
+    return Method::None;
+  }
+
+  // Extra usage and create flags the image needs for the given method
+  static VkImageUsageFlags getImageUsage(Method method)
+  {
+    switch(method)
+    {
+      case Method::Blit: return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+      case Method::Compute: return VK_IMAGE_USAGE_STORAGE_BIT;
+      default: return 0;
+    }
+  }
+
+  // The storage views alias an sRGB image as UNORM. sRGB formats have no
+  // storage support, so the image also needs EXTENDED_USAGE (core in 1.1)
+  // to be created with a usage only its views support.
+  static VkImageCreateFlags getImageFlags(Method method, VkFormat format)
+  {
+    if(method != Method::Compute || getStorageFormat(format) == format)
+    {
+      return 0;
+    }
+
+    return VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT | VK_IMAGE_CREATE_EXTENDED_USAGE_BIT;
+  }
+
+  void generate(VkImage image, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, Method method)
+  {
+    if(method == Method::None || mipLevels <= 1)
+    {
+      return;
+    }
+
+    jobs.push_back({image, format, width, height, mipLevels, method});
+  }
+
+  bool hasPendingWork() const
+  {
+    return !jobs.empty();
+  }
+
+  // Records every queued job. Must run on a graphics capable queue after the
+  // level 0 copies are complete; call retire() with the submission's timeline value.
+  void record(VkCommandBuffer commandBuffer)
+  {
+    if(jobs.empty())
+    {
+      return;
+    }
+
+    Resources resources;
+    createDescriptorPool(resources);
+
+    std::vector<VkImageMemoryBarrier2> finalBarriers;
+
+    for(const Job &job : jobs)
+    {
+      if(job.method == Method::Blit)
+      {
+        recordBlit(commandBuffer, job, finalBarriers);
+      }
+      else
+      {
+        recordCompute(commandBuffer, job, resources, finalBarriers);
+      }
+    }
+
+    VkDependencyInfo dependencyInfo{};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(finalBarriers.size());
+    dependencyInfo.pImageMemoryBarriers = finalBarriers.data();
+
+    PipelineBarriers::record(commandBuffer, dependencyInfo);
+
+    jobs.clear();
+    recorded.push_back(resources);
+  }
+
+  // Tags everything recorded since the last call with the submission's timeline value
+  void retire(uint64_t value)
+  {
+    for(auto &resources : recorded)
+    {
+      resources.value = value;
+      retired.push_back(resources);
+    }
+
+    recorded.clear();
+  }
+
+  void collect(uint64_t completedValue)
+  {
+    while(!retired.empty() && retired.front().value <= completedValue)
+    {
+      release(retired.front());
+      retired.pop_front();
+    }
+  }
+
+  private:
+  struct Job
+  {
+    VkImage image;
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    Method method;
+  };
+
+  struct Resources
+  {
+    uint64_t value = 0;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    std::vector<VkImageView> views;
+  };
+
+  static VkFormat getStorageFormat(VkFormat format)
+  {
+    switch(format)
+    {
+      case VK_FORMAT_R8G8B8A8_UNORM:
+      case VK_FORMAT_R8G8B8A8_SRGB:
+        return VK_FORMAT_R8G8B8A8_UNORM;
+      default:
+        return VK_FORMAT_UNDEFINED;
+    }
+  }
+
+  static VkImageMemoryBarrier2 levelBarrier(VkImage image, uint32_t baseLevel, uint32_t levelCount, VkImageLayout oldLayout, VkImageLayout newLayout)
+  {
+    VkImageMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = baseLevel;
+    barrier.subresourceRange.levelCount = levelCount;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    return barrier;
+  }
+
+  static void pipelineBarrier(VkCommandBuffer commandBuffer, const VkImageMemoryBarrier2 &barrier)
+  {
+    VkDependencyInfo dependencyInfo{};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.imageMemoryBarrierCount = 1;
+    dependencyInfo.pImageMemoryBarriers = &barrier;
+
+    PipelineBarriers::record(commandBuffer, dependencyInfo);
+  }
+
+  void recordBlit(VkCommandBuffer commandBuffer, const Job &job, std::vector<VkImageMemoryBarrier2> &finalBarriers)
+  {
+    int32_t mipWidth = static_cast<int32_t>(job.width);
+    int32_t mipHeight = static_cast<int32_t>(job.height);
+
+    for(uint32_t level = 1; level < job.mipLevels; level++)
+    {
+      VkImageMemoryBarrier2 barrier = levelBarrier(job.image, level - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+      barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_BLIT_BIT;
+      barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+      barrier.dstStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT;
+      barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+      pipelineBarrier(commandBuffer, barrier);
+
+      int32_t nextWidth = mipWidth > 1 ? mipWidth / 2 : 1;
+      int32_t nextHeight = mipHeight > 1 ? mipHeight / 2 : 1;
+
+      VkImageBlit blit{};
+      blit.srcOffsets[0] = {0, 0, 0};
+      blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
+      blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      blit.srcSubresource.mipLevel = level - 1;
+      blit.srcSubresource.baseArrayLayer = 0;
+      blit.srcSubresource.layerCount = 1;
+      blit.dstOffsets[0] = {0, 0, 0};
+      blit.dstOffsets[1] = {nextWidth, nextHeight, 1};
+      blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      blit.dstSubresource.mipLevel = level;
+      blit.dstSubresource.baseArrayLayer = 0;
+      blit.dstSubresource.layerCount = 1;
+
+      vkCmdBlitImage(commandBuffer, job.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, job.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+      mipWidth = nextWidth;
+      mipHeight = nextHeight;
+    }
+
+    VkImageMemoryBarrier2 sources = levelBarrier(job.image, 0, job.mipLevels - 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    sources.srcStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT;
+    sources.srcAccessMask = VK_ACCESS_2_NONE;
+    sources.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    sources.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+    finalBarriers.push_back(sources);
+
+    VkImageMemoryBarrier2 last = levelBarrier(job.image, job.mipLevels - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    last.srcStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT;
+    last.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    last.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    last.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+    finalBarriers.push_back(last);
+  }
+
+  void recordCompute(VkCommandBuffer commandBuffer, const Job &job, Resources &resources, std::vector<VkImageMemoryBarrier2> &finalBarriers)
+  {
+    VkImageMemoryBarrier2 toGeneral = levelBarrier(job.image, 0, job.mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+    toGeneral.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    toGeneral.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    toGeneral.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    toGeneral.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+    pipelineBarrier(commandBuffer, toGeneral);
+
+    size_t firstView = resources.views.size();
+    for(uint32_t level = 0; level < job.mipLevels; level++)
+    {
+      resources.views.push_back(createLevelView(job.image, getStorageFormat(job.format), level));
+    }
+
+    uint32_t srgb = job.format == VK_FORMAT_R8G8B8A8_SRGB ? 1 : 0;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &srgb);
+
+    uint32_t mipWidth = job.width;
+    uint32_t mipHeight = job.height;
+
+    for(uint32_t level = 1; level < job.mipLevels; level++)
+    {
+      mipWidth = std::max(mipWidth / 2, 1u);
+      mipHeight = std::max(mipHeight / 2, 1u);
+
+      VkDescriptorSet descriptorSet = allocateLevelSet(resources, resources.views[firstView + level - 1], resources.views[firstView + level]);
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+      vkCmdDispatch(commandBuffer, (mipWidth + 7) / 8, (mipHeight + 7) / 8, 1);
+
+      VkImageMemoryBarrier2 barrier = levelBarrier(job.image, level, 1, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
+      barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+      barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+      barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+      barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+      pipelineBarrier(commandBuffer, barrier);
+    }
+
+    VkImageMemoryBarrier2 toShaderRead = levelBarrier(job.image, 0, job.mipLevels, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    toShaderRead.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    toShaderRead.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    toShaderRead.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    toShaderRead.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+    finalBarriers.push_back(toShaderRead);
+  }
+
+  void createDescriptorPool(Resources &resources)
+  {
+    uint32_t setCount = 0;
+    for(const Job &job : jobs)
+    {
+      if(job.method == Method::Compute)
+      {
+        setCount += job.mipLevels - 1;
+      }
+    }
+
+    if(setCount == 0)
+    {
+      return;
+    }
+
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSize.descriptorCount = setCount * 2;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = setCount;
+
+    if(vkCreateDescriptorPool(device, &poolInfo, nullptr, &resources.descriptorPool) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create mipmap descriptor pool");
+    }
+  }
+
+  VkDescriptorSet allocateLevelSet(Resources &resources, VkImageView source, VkImageView destination)
+  {
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = resources.descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &descriptorSetLayout;
+
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    if(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to allocate mipmap descriptor set");
+    }
+
+    VkDescriptorImageInfo imageInfos[2]{};
+    imageInfos[0].imageView = source;
+    imageInfos[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfos[1].imageView = destination;
+    imageInfos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet writes[2]{};
+    for(uint32_t i = 0; i < 2; i++)
+    {
+      writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[i].dstSet = descriptorSet;
+      writes[i].dstBinding = i;
+      writes[i].descriptorCount = 1;
+      writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      writes[i].pImageInfo = &imageInfos[i];
+    }
+
+    vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+
+    return descriptorSet;
+  }
+
+  VkImageView createLevelView(VkImage image, VkFormat format, uint32_t level)
+  {
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = level;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    VkImageView view = VK_NULL_HANDLE;
+    if(vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create mipmap level view");
+    }
+
+    return view;
+  }
+
+  void release(Resources &resources)
+  {
+    for(auto view : resources.views)
+    {
+      vkDestroyImageView(device, view, nullptr);
+    }
+
+    vkDestroyDescriptorPool(device, resources.descriptorPool, nullptr);
+  }
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice device = VK_NULL_HANDLE;
+
+  VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+
+  std::vector<Job> jobs;
+  std::vector<Resources> recorded;
+  std::deque<Resources> retired;
+};
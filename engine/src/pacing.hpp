@@ -0,0 +1,193 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "logger.hpp"
+
+/*
+  Frame pacing.
+
+  A LatencyMode picks the present mode, the swapchain image count and the
+  number of frames in flight together, since each one alone only moves
+  where frames queue up:
+
+    LowLatency   One frame in flight and, with VK_KHR_present_wait, the CPU
+                 starts a frame only once the previous one is on screen, so
+                 input is sampled as late as possible.
+    Throughput   Every frame in flight and two spare images, the GPU never
+                 waits on the CPU or the display.
+    PowerSaving  FIFO with the fewest images, one present queued at most so
+                 neither processor runs ahead of the display.
+
+  FrameLimiter is an optional CPU cap on top of whichever mode is active.
+*/
+enum class LatencyMode
+{
+  LowLatency,
+  Throughput,
+  PowerSaving
+};
+
+struct PacingPolicy
+{
+  std::vector<VkPresentModeKHR> presentModes; // Most preferred first, FIFO is always available
+  uint32_t extraImages; // On top of the surface's minImageCount
+  uint32_t framesInFlight;
+  int32_t maxQueuedPresents; // Presents still waiting for the display when a frame starts, -1 never waits
+};
+
+inline PacingPolicy getPacingPolicy(LatencyMode mode, uint32_t maxFramesInFlight)
+{
+  switch(mode)
+  {
+    case LatencyMode::LowLatency:
+    return {{VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR}, 1, 1, 0};
+    case LatencyMode::PowerSaving:
+    return {{VK_PRESENT_MODE_FIFO_KHR}, 0, std::min(2u, maxFramesInFlight), 1};
+    case LatencyMode::Throughput:
+    default:
+    return {{VK_PRESENT_MODE_MAILBOX_KHR}, 2, maxFramesInFlight, -1};
+  }
+}
+
+inline const char *getLatencyModeName(LatencyMode mode)
+{
+  switch(mode)
+  {
+    case LatencyMode::LowLatency: return "low latency";
+    case LatencyMode::PowerSaving: return "power saving";
+    default: return "throughput";
+  }
+}
+
+// The names settings.cfg uses: low_latency, throughput, power_saving
+inline std::optional<LatencyMode> parseLatencyMode(std::string_view name)
+{
+  if(name == "low_latency") return LatencyMode::LowLatency;
+  if(name == "throughput") return LatencyMode::Throughput;
+  if(name == "power_saving") return LatencyMode::PowerSaving;
+
+  return std::nullopt;
+}
+
+inline VkPresentModeKHR choosePresentMode(const PacingPolicy &policy, const std::vector<VkPresentModeKHR> &availableModes)
+{
+  for(VkPresentModeKHR mode : policy.presentModes)
+  {
+    if(std::find(availableModes.begin(), availableModes.end(), mode) != availableModes.end())
+    {
+      return mode;
+    }
+  }
+
+  return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+inline uint32_t chooseImageCount(const PacingPolicy &policy, const VkSurfaceCapabilitiesKHR &capabilities)
+{
+  uint32_t imageCount = capabilities.minImageCount + policy.extraImages;
+
+  // 0 means no limit
+  if(capabilities.maxImageCount > 0)
+  {
+    imageCount = std::min(imageCount, capabilities.maxImageCount);
+  }
+
+  return imageCount;
+}
+
+// Sleeps away what is left of each frame's interval
+class FrameLimiter
+{
+  public:
+  // 0 turns the limiter off
+  void setRate(uint32_t framesPerSecond)
+  {
+    interval = framesPerSecond > 0 ? std::chrono::nanoseconds(1000000000 / framesPerSecond) : std::chrono::nanoseconds(0);
+    deadline = std::chrono::steady_clock::now();
+  }
+
+  // Call once at the start of every frame
+  void wait()
+  {
+    if(interval.count() == 0)
+    {
+      return;
+    }
+
+    std::this_thread::sleep_until(deadline);
+
+    // A frame that ran long starts a new schedule rather than letting the
+    // next ones catch up with a burst
+    auto now = std::chrono::steady_clock::now();
+    deadline = std::max(deadline + interval, now);
+  }
+
+  private:
+  std::chrono::nanoseconds interval{0};
+  std::chrono::steady_clock::time_point deadline;
+};
+
+// Tags presents with VK_KHR_present_id and waits on them with
+// VK_KHR_present_wait. Without the extensions every call is a no-op.
+class PresentWaiter
+{
+  public:
+  // Both extensions and their features must be enabled on device
+  void init(VkDevice device)
+  {
+    this->device = device;
+    waitForPresent = reinterpret_cast<PFN_vkWaitForPresentKHR>(vkGetDeviceProcAddr(device, "vkWaitForPresentKHR"));
+
+    if(waitForPresent == nullptr)
+    {
+      LOG_DEBUG("vkWaitForPresentKHR not found, presents aren't waited on");
+    }
+  }
+
+  bool isEnabled() const { return waitForPresent != nullptr; }
+
+  // Ids are per swapchain, call whenever it is recreated
+  void reset()
+  {
+    lastPresentId = 0;
+  }
+
+  // Id for the next present's VkPresentIdKHR
+  uint64_t next()
+  {
+    return ++lastPresentId;
+  }
+
+  // Blocks until at most maxQueued presents on swapChain are still waiting
+  // for the display. Gives up after timeout so a hidden window can't hang
+  // the frame loop.
+  void wait(VkSwapchainKHR swapChain, int32_t maxQueued, uint64_t timeout)
+  {
+    if(!isEnabled() || maxQueued < 0 || lastPresentId <= static_cast<uint64_t>(maxQueued))
+    {
+      return;
+    }
+
+    VkResult result = waitForPresent(device, swapChain, lastPresentId - maxQueued, timeout);
+
+    // Out of date swapchains are caught by the next acquire
+    if(result != VK_SUCCESS && result != VK_TIMEOUT && result != VK_ERROR_OUT_OF_DATE_KHR && result != VK_SUBOPTIMAL_KHR)
+    {
+      LOG_DEBUG("Failed to wait for present {}, error {}", lastPresentId - maxQueued, static_cast<int>(result));
+    }
+  }
+
+  private:
+  VkDevice device = VK_NULL_HANDLE;
+  PFN_vkWaitForPresentKHR waitForPresent = nullptr;
+  uint64_t lastPresentId = 0;
+};
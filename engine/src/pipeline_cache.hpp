@@ -0,0 +1,315 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "logger.hpp"
+
+/*
+  VkPipelineCache persisted between runs.
+
+  The driver blob is stored behind our own header holding its size, an
+  FNV-1a checksum and the identity of the device that produced it. On load
+  both that header and the driver's VkPipelineCacheHeaderVersionOne must match
+  the current vendor ID, device ID, driver version and pipelineCacheUUID;
+  anything else (truncated, corrupt, other GPU, driver update) is discarded
+  and the cache starts empty. Saving writes a temporary file and renames it,
+  so a crash mid-write never leaves a half written cache behind.
+
+  Pipelines created through createGraphicsPipeline() report whether the
+  driver found them in the cache, and how long creation took either way.
+  That takes VkPipelineCreationFeedbackCreateInfo, core in 1.3 and
+  VK_EXT_pipeline_creation_feedback before. Without it creation is timed on
+  the CPU instead, and every pipeline counts as a hit when the cache was
+  loaded from disk and as a miss when it started cold.
+*/
+class PipelineCache
+{
+  public:
+  struct Stats
+  {
+    uint32_t hits;
+    uint32_t misses;
+    uint64_t hitNanoseconds;
+    uint64_t missNanoseconds;
+  };
+
+  // creationFeedback when the device is 1.3 or has VK_EXT_pipeline_creation_feedback enabled
+  void init(VkPhysicalDevice physicalDevice, VkDevice device, const std::string &path, bool creationFeedback)
+  {
+    this->device = device;
+    this->path = path;
+    this->creationFeedback = creationFeedback;
+
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    std::vector<char> blob = load();
+    warm = !blob.empty();
+
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = blob.size();
+    cacheInfo.pInitialData = blob.empty() ? nullptr : blob.data();
+
+    if(vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create pipeline cache");
+    }
+  }
+
+  void save()
+  {
+    size_t size = 0;
+    vkGetPipelineCacheData(device, cache, &size, nullptr);
+
+    std::vector<char> blob(size);
+    if(size == 0 || vkGetPipelineCacheData(device, cache, &size, blob.data()) != VK_SUCCESS)
+    {
+      return;
+    }
+
+    FileHeader header = makeHeader();
+    header.dataSize = size;
+    header.checksum = checksum(blob.data(), size);
+
+    std::string temporaryPath = path + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+
+    if(!file.is_open())
+    {
+      LOG_DEBUG("Could not write pipeline cache {}", temporaryPath);
+      return;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(blob.data(), size);
+    file.close();
+
+    // std::rename fails on Windows when the destination exists, filesystem::rename replaces it everywhere
+    std::error_code error;
+    if(file)
+    {
+      std::filesystem::rename(temporaryPath, path, error);
+    }
+
+    if(!file || error)
+    {
+      LOG_DEBUG("Could not replace pipeline cache {}", path);
+      std::filesystem::remove(temporaryPath, error);
+      return;
+    }
+
+    LOG_DEBUG("Saved {} bytes of pipeline cache", size);
+  }
+
+  void destroy()
+  {
+    vkDestroyPipelineCache(device, cache, nullptr);
+    cache = VK_NULL_HANDLE;
+  }
+
+  VkPipelineCache getHandle() const { return cache; }
+
+  // vkCreateGraphicsPipelines through the cache, with creation feedback when
+  // the device has it. Safe to call from several threads, the driver
+  // synchronizes the cache itself.
+  VkResult createGraphicsPipeline(const VkGraphicsPipelineCreateInfo &createInfo, VkPipeline &pipeline)
+  {
+    VkPipelineCreationFeedback feedback{};
+
+    VkPipelineCreationFeedbackCreateInfo feedbackInfo{};
+    feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+    feedbackInfo.pNext = createInfo.pNext;
+    feedbackInfo.pPipelineCreationFeedback = &feedback;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = createInfo;
+    if(creationFeedback)
+    {
+      pipelineInfo.pNext = &feedbackInfo;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    VkResult result = vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, &pipeline);
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    if(result == VK_SUCCESS)
+    {
+      recordFeedback(feedback, static_cast<uint64_t>(elapsed.count()));
+    }
+
+    return result;
+  }
+
+  Stats getStats() const
+  {
+    return {hits.load(), misses.load(), hitNanoseconds.load(), missNanoseconds.load()};
+  }
+
+  void logStats() const
+  {
+    Stats stats = getStats();
+
+    LOG_DEBUG(
+      "Pipeline cache: {} hits ({} us), {} misses ({} us){}",
+      stats.hits, stats.hitNanoseconds / 1000,
+      stats.misses, stats.missNanoseconds / 1000,
+      creationFeedback ? "" : ", estimated without creation feedback"
+    );
+  }
+
+  private:
+  struct FileHeader
+  {
+    char magic[4];
+    uint32_t version;
+    uint64_t dataSize;
+    uint64_t checksum;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+  };
+
+  static constexpr uint32_t FILE_VERSION = 1;
+
+  static uint64_t checksum(const char *data, size_t size)
+  {
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for(size_t i = 0; i < size; i++)
+    {
+      hash ^= static_cast<uint8_t>(data[i]);
+      hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+  }
+
+  FileHeader makeHeader() const
+  {
+    FileHeader header{};
+    memcpy(header.magic, "PLCH", 4);
+    header.version = FILE_VERSION;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+    return header;
+  }
+
+  // Returns the driver blob, or nothing when the file is missing or rejected
+  std::vector<char> load() const
+  {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    if(!file.is_open())
+    {
+      LOG_DEBUG("No pipeline cache at {}, starting cold", path);
+      return {};
+    }
+
+    size_t fileSize = static_cast<size_t>(file.tellg());
+    file.seekg(0);
+
+    FileHeader header;
+    FileHeader expected = makeHeader();
+
+    if(fileSize < sizeof(FileHeader) || !file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+      LOG_DEBUG("Pipeline cache rejected: truncated header");
+      return {};
+    }
+
+    if(memcmp(header.magic, expected.magic, 4) != 0 || header.version != expected.version)
+    {
+      LOG_DEBUG("Pipeline cache rejected: unknown file format");
+      return {};
+    }
+
+    if(
+      header.vendorID != expected.vendorID ||
+      header.deviceID != expected.deviceID ||
+      header.driverVersion != expected.driverVersion ||
+      memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0
+    )
+    {
+      LOG_DEBUG("Pipeline cache rejected: written by another device or driver");
+      return {};
+    }
+
+    if(header.dataSize != fileSize - sizeof(FileHeader) || header.dataSize < sizeof(VkPipelineCacheHeaderVersionOne))
+    {
+      LOG_DEBUG("Pipeline cache rejected: size mismatch");
+      return {};
+    }
+
+    std::vector<char> blob(header.dataSize);
+    if(!file.read(blob.data(), blob.size()) || checksum(blob.data(), blob.size()) != header.checksum)
+    {
+      LOG_DEBUG("Pipeline cache rejected: checksum mismatch");
+      return {};
+    }
+
+    // The driver checks this too, but a mismatch there is silently ignored
+    VkPipelineCacheHeaderVersionOne driverHeader;
+    memcpy(&driverHeader, blob.data(), sizeof(driverHeader));
+
+    if(
+      driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+      driverHeader.vendorID != properties.vendorID ||
+      driverHeader.deviceID != properties.deviceID ||
+      memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0
+    )
+    {
+      LOG_DEBUG("Pipeline cache rejected: driver header mismatch");
+      return {};
+    }
+
+    LOG_DEBUG("Loaded {} bytes of pipeline cache", blob.size());
+    return blob;
+  }
+
+  // elapsed is the CPU side duration, used when the driver left feedback invalid
+  void recordFeedback(const VkPipelineCreationFeedback &feedback, uint64_t elapsed)
+  {
+    bool hit = warm;
+    uint64_t duration = elapsed;
+
+    if(feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT)
+    {
+      hit = feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT;
+      duration = feedback.duration;
+    }
+
+    if(hit)
+    {
+      hits++;
+      hitNanoseconds += duration;
+    }
+    else
+    {
+      misses++;
+      missNanoseconds += duration;
+    }
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPipelineCache cache = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties properties{};
+  std::string path;
+  bool creationFeedback = false;
+  bool warm = false; // Started from a blob on disk
+
+  std::atomic<uint32_t> hits{0};
+  std::atomic<uint32_t> misses{0};
+  std::atomic<uint64_t> hitNanoseconds{0};
+  std::atomic<uint64_t> missNanoseconds{0};
+};
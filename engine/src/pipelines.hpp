@@ -0,0 +1,335 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "logger.hpp"
+#include "pipeline_cache.hpp"
+#include "threadpool.hpp"
+
+/*
+  Graphics pipeline variants built on the thread pool.
+
+  Every variant shares the shader modules, layout, render pass and vertex
+  input given to init(); what differs is described by a PipelineState, which
+  is also the lookup key. Branches inside the fragment shader are picked with
+  specialization constants (FRAGMENT_PATH, constant_id 0 in shader.frag) so
+  one SPIR-V module serves all of them.
+
+  get() never blocks: an unknown state is queued for a worker and reported as
+  VK_NULL_HANDLE until it is built, so the caller draws with a fallback for a
+  frame or two instead of stalling. buildNow() is for the one pipeline that
+  has to exist before the first frame.
+*/
+enum FragmentPath : uint32_t
+{
+  FRAGMENT_PATH_TEXTURED = 0,
+  FRAGMENT_PATH_VERTEX_COLOR = 1,
+  FRAGMENT_PATH_TEXTURED_TINTED = 2
+};
+
+struct PipelineState
+{
+  VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+  uint32_t fragmentPath = FRAGMENT_PATH_TEXTURED;
+  bool blend = false;
+
+  bool operator==(const PipelineState &other) const = default;
+
+  uint64_t hash() const
+  {
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for(uint64_t value : {uint64_t(topology), uint64_t(cullMode), uint64_t(fragmentPath), uint64_t(blend)})
+    {
+      hash ^= value;
+      hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+  }
+};
+
+class PipelineManager
+{
+  public:
+  struct Description
+  {
+    VkShaderModule vertexShader;
+    VkShaderModule fragmentShader;
+    VkPipelineLayout layout;
+    VkRenderPass renderPass; // VK_NULL_HANDLE for dynamic rendering into colorFormat and depthFormat
+    uint32_t subpass;
+    VkFormat colorFormat;
+    VkFormat depthFormat;
+    VkSampleCountFlagBits samples;
+    std::vector<VkVertexInputBindingDescription> bindings;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+  };
+
+  // Takes ownership of the shader modules in description
+  void init(VkDevice device, PipelineCache &pipelineCache, ThreadPool &threadPool, const Description &description)
+  {
+    this->device = device;
+    this->pipelineCache = &pipelineCache;
+    this->threadPool = &threadPool;
+    this->description = description;
+  }
+
+  // The thread pool must have finished every queued build before this runs
+  void destroy()
+  {
+    // Never initialized
+    if(device == VK_NULL_HANDLE)
+    {
+      return;
+    }
+
+    for(auto &[state, entry] : pipelines)
+    {
+      vkDestroyPipeline(device, entry->pipeline, nullptr);
+    }
+
+    pipelines.clear();
+
+    vkDestroyShaderModule(device, description.fragmentShader, nullptr);
+    vkDestroyShaderModule(device, description.vertexShader, nullptr);
+  }
+
+  // Queues a build for state unless it is already built or building
+  void request(const PipelineState &state)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    findOrQueue(state);
+  }
+
+  // The pipeline for state, or VK_NULL_HANDLE while it is still being built
+  VkPipeline get(const PipelineState &state)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry *entry = findOrQueue(state);
+
+    return entry->status.load(std::memory_order_acquire) == Status::Ready ? entry->pipeline : VK_NULL_HANDLE;
+  }
+
+  // Builds on the calling thread, for pipelines needed before the first frame
+  VkPipeline buildNow(const PipelineState &state)
+  {
+    Entry *entry;
+    bool buildHere = false;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto found = pipelines.find(state);
+
+      if(found != pipelines.end())
+      {
+        entry = found->second.get();
+      }
+      else
+      {
+        entry = pipelines.emplace(state, std::make_unique<Entry>()).first->second.get();
+        buildHere = true;
+      }
+    }
+
+    if(buildHere)
+    {
+      build(state, *entry);
+    }
+
+    // Someone else queued it first, it won't take longer than building it again
+    while(entry->status.load(std::memory_order_acquire) == Status::Building)
+    {
+      std::this_thread::yield();
+    }
+
+    return entry->pipeline;
+  }
+
+  uint32_t getPendingCount() const
+  {
+    return pending.load();
+  }
+
+  private:
+  enum class Status
+  {
+    Building,
+    Ready,
+    Failed
+  };
+
+  struct Entry
+  {
+    std::atomic<Status> status{Status::Building};
+    VkPipeline pipeline = VK_NULL_HANDLE;
+  };
+
+  struct StateHash
+  {
+    size_t operator()(const PipelineState &state) const { return static_cast<size_t>(state.hash()); }
+  };
+
+  // Called with mutex held
+  Entry *findOrQueue(const PipelineState &state)
+  {
+    auto found = pipelines.find(state);
+
+    if(found != pipelines.end())
+    {
+      return found->second.get();
+    }
+
+    // Entries are heap allocated, the pointer survives rehashing
+    Entry *entry = pipelines.emplace(state, std::make_unique<Entry>()).first->second.get();
+    pending++;
+
+    threadPool->submit([this, state, entry]() {
+      build(state, *entry);
+      pending--;
+    });
+
+    return entry;
+  }
+
+  // Only reads description, so any number of these can run at once
+  void build(const PipelineState &state, Entry &entry)
+  {
+    VkSpecializationMapEntry fragmentPathEntry{};
+    fragmentPathEntry.constantID = 0;
+    fragmentPathEntry.offset = 0;
+    fragmentPathEntry.size = sizeof(uint32_t);
+
+    VkSpecializationInfo fragmentSpecialization{};
+    fragmentSpecialization.mapEntryCount = 1;
+    fragmentSpecialization.pMapEntries = &fragmentPathEntry;
+    fragmentSpecialization.dataSize = sizeof(uint32_t);
+    fragmentSpecialization.pData = &state.fragmentPath;
+
+    VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = description.vertexShader;
+    shaderStages[0].pName = "main";
+
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = description.fragmentShader;
+    shaderStages[1].pName = "main";
+    shaderStages[1].pSpecializationInfo = &fragmentSpecialization;
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(description.bindings.size());
+    vertexInputInfo.pVertexBindingDescriptions = description.bindings.data();
+    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(description.attributes.size());
+    vertexInputInfo.pVertexAttributeDescriptions = description.attributes.data();
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = state.topology;
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    VkPipelineViewportStateCreateInfo viewportState{};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = state.cullMode;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.rasterizationSamples = description.samples;
+
+    // Everything is drawn in submission order on one plane so far,
+    // LESS_OR_EQUAL keeps that order
+    VkPipelineDepthStencilStateCreateInfo depthStencil{};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+    // Premultiplied alpha when blending
+    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.blendEnable = state.blend ? VK_TRUE : VK_FALSE;
+    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    VkPipelineColorBlendStateCreateInfo colorBlending{};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOp = VK_LOGIC_OP_COPY;
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    VkDynamicState dynamicStates[] = {
+      VK_DYNAMIC_STATE_VIEWPORT,
+      VK_DYNAMIC_STATE_SCISSOR
+    };
+
+    VkPipelineDynamicStateCreateInfo dynamicState{};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
+
+    VkPipelineRenderingCreateInfo renderingInfo{};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachmentFormats = &description.colorFormat;
+    renderingInfo.depthAttachmentFormat = description.depthFormat;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.pNext = description.renderPass == VK_NULL_HANDLE ? &renderingInfo : nullptr;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = description.layout;
+    pipelineInfo.renderPass = description.renderPass;
+    pipelineInfo.subpass = description.subpass;
+    pipelineInfo.basePipelineIndex = -1;
+
+    if(pipelineCache->createGraphicsPipeline(pipelineInfo, entry.pipeline) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create graphics pipeline variant {}", state.hash());
+      entry.pipeline = VK_NULL_HANDLE;
+      entry.status.store(Status::Failed, std::memory_order_release);
+      return;
+    }
+
+    entry.status.store(Status::Ready, std::memory_order_release);
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  PipelineCache *pipelineCache = nullptr;
+  ThreadPool *threadPool = nullptr;
+  Description description{};
+
+  std::mutex mutex;
+  std::unordered_map<PipelineState, std::unique_ptr<Entry>, StateHash> pipelines;
+  std::atomic<uint32_t> pending{0};
+};
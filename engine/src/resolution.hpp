@@ -0,0 +1,424 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "logger.hpp"
+#include "pipeline_cache.hpp"
+#include "resolution_controller.hpp"
+#include "resources.hpp"
+
+/*
+  Dynamic resolution.
+
+  The scene is drawn into the top left renderExtent of an offscreen image
+  the size of the swapchain, then Upscaler stretches that area over the
+  swapchain image with a fullscreen triangle (upscale.vert, upscale.frag).
+  Only the render area shrinks, so changing the scale never reallocates.
+
+  FrameTimer brackets each frame's command buffer with timestamps, and
+  ResolutionController (resolution_controller.hpp) turns the GPU times into
+  a render scale.
+*/
+class FrameTimer
+{
+  public:
+  // False when queueFamily can't write timestamps
+  bool init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t frameCount)
+  {
+    this->device = device;
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+    uint32_t validBits = families[queueFamily].timestampValidBits;
+
+    if(validBits == 0)
+    {
+      return false;
+    }
+
+    validMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    nanosecondsPerTick = properties.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = frameCount * 2;
+
+    if(vkCreateQueryPool(device, &poolInfo, nullptr, &queryPool) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create timestamp query pool");
+      return false;
+    }
+
+    submitted.assign(frameCount, false);
+    return true;
+  }
+
+  void destroy()
+  {
+    vkDestroyQueryPool(device, queryPool, nullptr);
+    queryPool = VK_NULL_HANDLE;
+  }
+
+  // First command of the frame's command buffer, outside any render pass
+  void begin(VkCommandBuffer commandBuffer, uint32_t frame)
+  {
+    vkCmdResetQueryPool(commandBuffer, queryPool, frame * 2, 2);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, frame * 2);
+  }
+
+  // Last command of the frame's command buffer
+  void end(VkCommandBuffer commandBuffer, uint32_t frame)
+  {
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, frame * 2 + 1);
+  }
+
+  void markSubmitted(uint32_t frame)
+  {
+    submitted[frame] = true;
+  }
+
+  // GPU time of the frame's last submission, once its fence has signalled.
+  // Each submission is read once.
+  bool read(uint32_t frame, float &milliseconds)
+  {
+    if(!submitted[frame])
+    {
+      return false;
+    }
+
+    submitted[frame] = false;
+
+    uint64_t timestamps[2];
+    if(vkGetQueryPoolResults(device, queryPool, frame * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+    {
+      return false;
+    }
+
+    uint64_t ticks = (timestamps[1] - timestamps[0]) & validMask;
+    milliseconds = static_cast<float>(double(ticks) * nanosecondsPerTick / 1e6);
+
+    return true;
+  }
+
+  private:
+  VkDevice device = VK_NULL_HANDLE;
+  VkQueryPool queryPool = VK_NULL_HANDLE;
+  uint64_t validMask = 0;
+  float nanosecondsPerTick = 1.0f;
+  std::vector<bool> submitted;
+};
+
+class Upscaler
+{
+  public:
+  // renderPass is VK_NULL_HANDLE for dynamic rendering into colorFormat.
+  // Takes ownership of the shader modules.
+  bool init(VkDevice device, DeletionQueue &deletionQueue, PipelineCache &pipelineCache, VkShaderModule vertexShader, VkShaderModule fragmentShader, VkRenderPass renderPass, VkFormat colorFormat)
+  {
+    this->device = device;
+    this->deletionQueue = &deletionQueue;
+
+    bool created = createSampler() && createDescriptorSetLayout() && createSourceSet() && createPipeline(pipelineCache, vertexShader, fragmentShader, renderPass, colorFormat);
+
+    vkDestroyShaderModule(device, vertexShader, nullptr);
+    vkDestroyShaderModule(device, fragmentShader, nullptr);
+
+    return created;
+  }
+
+  // Pipeline, sampler and source go to the deletion queue. The layouts go
+  // now, recorded commands don't need them.
+  void destroy()
+  {
+    pipeline.reset();
+    sampler.reset();
+    sourcePool.reset();
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+
+    pipelineLayout = VK_NULL_HANDLE;
+    descriptorSet = VK_NULL_HANDLE;
+    sourceWritten = false;
+    descriptorSetLayout = VK_NULL_HANDLE;
+  }
+
+  // The scene image, in SHADER_READ_ONLY_OPTIMAL whenever draw() runs.
+  // Frames still in flight may be reading the current set, so once it has
+  // been written a new source gets a set of its own, and the old one goes
+  // to the deletion queue with its pool.
+  void setSource(VkImageView view, VkExtent2D extent)
+  {
+    if(sourceWritten && !createSourceSet())
+    {
+      // Nothing to make another set from, rewrite this one once no frame reads it
+      LOG_DEBUG("Waiting for the device to rewrite the upscale source");
+      vkDeviceWaitIdle(device);
+    }
+
+    sourceWritten = true;
+    sourceExtent = extent;
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfo.imageView = view;
+    imageInfo.sampler = sampler.get();
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSet;
+    write.dstBinding = 0;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.descriptorCount = 1;
+    write.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+
+  // Inside the pass into targetExtent, stretches the top left renderExtent of the source over it
+  void draw(VkCommandBuffer commandBuffer, VkExtent2D renderExtent, VkExtent2D targetExtent) const
+  {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.get());
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+
+    VkViewport viewport{};
+    viewport.width = static_cast<float>(targetExtent.width);
+    viewport.height = static_cast<float>(targetExtent.height);
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor{};
+    scissor.extent = targetExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    // Bilinear taps stop half a texel inside the render area, past it is last frame's leftovers
+    Constants constants;
+    constants.uvScale[0] = float(renderExtent.width) / sourceExtent.width;
+    constants.uvScale[1] = float(renderExtent.height) / sourceExtent.height;
+    constants.uvMax[0] = (renderExtent.width - 0.5f) / sourceExtent.width;
+    constants.uvMax[1] = (renderExtent.height - 0.5f) / sourceExtent.height;
+
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(constants), &constants);
+    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+  }
+
+  private:
+  // Matches the Upscale push constant block of upscale.vert and upscale.frag
+  struct Constants
+  {
+    float uvScale[2];
+    float uvMax[2];
+  };
+
+  bool createSampler()
+  {
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+    VkSampler handle;
+    if(vkCreateSampler(device, &samplerInfo, nullptr, &handle) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create upscale sampler");
+      return false;
+    }
+
+    sampler = Sampler(*deletionQueue, handle);
+    return true;
+  }
+
+  bool createDescriptorSetLayout()
+  {
+    VkDescriptorSetLayoutBinding binding{};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &binding;
+
+    if(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create upscale descriptor set layout");
+      return false;
+    }
+
+    return true;
+  }
+
+  // A pool holding just the one set, so replacing a source never runs out
+  // of sets while the earlier ones wait for their frames. Keeps the current
+  // set when it fails.
+  bool createSourceSet()
+  {
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = 1;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = 1;
+
+    VkDescriptorPool pool;
+    if(vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create upscale descriptor pool");
+      return false;
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &descriptorSetLayout;
+
+    VkDescriptorSet set;
+    if(vkAllocateDescriptorSets(device, &allocInfo, &set) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to allocate upscale descriptor set");
+      vkDestroyDescriptorPool(device, pool, nullptr);
+      return false;
+    }
+
+    sourcePool = DescriptorPool(*deletionQueue, pool);
+    descriptorSet = set;
+    sourceWritten = false;
+
+    return true;
+  }
+
+  bool createPipeline(PipelineCache &pipelineCache, VkShaderModule vertexShader, VkShaderModule fragmentShader, VkRenderPass renderPass, VkFormat colorFormat)
+  {
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(Constants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create upscale pipeline layout");
+      return false;
+    }
+
+    VkPipelineShaderStageCreateInfo shaderStages[2]{};
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = vertexShader;
+    shaderStages[0].pName = "main";
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = fragmentShader;
+    shaderStages[1].pName = "main";
+
+    // The triangle comes from gl_VertexIndex
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkPipelineViewportStateCreateInfo viewportState{};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_NONE;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+    VkPipelineColorBlendStateCreateInfo colorBlending{};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    VkDynamicState dynamicStates[] = {
+      VK_DYNAMIC_STATE_VIEWPORT,
+      VK_DYNAMIC_STATE_SCISSOR
+    };
+
+    VkPipelineDynamicStateCreateInfo dynamicState{};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
+
+    VkPipelineRenderingCreateInfo renderingInfo{};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachmentFormats = &colorFormat;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.pNext = renderPass == VK_NULL_HANDLE ? &renderingInfo : nullptr;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = pipelineLayout;
+    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.subpass = 0;
+    pipelineInfo.basePipelineIndex = -1;
+
+    VkPipeline handle;
+    if(pipelineCache.createGraphicsPipeline(pipelineInfo, handle) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create upscale pipeline");
+      return false;
+    }
+
+    pipeline = Pipeline(*deletionQueue, handle);
+    return true;
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeletionQueue *deletionQueue = nullptr;
+  Sampler sampler;
+  VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+  DescriptorPool sourcePool; // descriptorSet's
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  bool sourceWritten = false; // descriptorSet may be bound by frames in flight
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  Pipeline pipeline;
+  VkExtent2D sourceExtent = {1, 1};
+};
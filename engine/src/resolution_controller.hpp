@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+/*
+  Render scale from GPU frame times.
+
+  ResolutionController keeps a running average of the times it is fed and
+  moves the scale in fixed steps: down as far as the average says the frame
+  fits the target, up one step at a time once there is headroom, and never
+  again before settleFrames have passed. It is plain arithmetic with no
+  Vulkan in it, so synthetic timings drive it exactly like measured ones.
+*/
+class ResolutionController
+{
+  public:
+  struct Settings
+  {
+    float targetMilliseconds = 1000.0f / 60.0f;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    float step = 0.05f; // Scales are multiples of this, so small jitter never changes the resolution
+    float headroom = 0.8f; // Scale up once the average is below this fraction of the target
+    float smoothing = 0.1f; // Weight of the newest time in the running average
+    uint32_t settleFrames = 30; // Frames after a change before the next one
+  };
+
+  void init(const Settings &settings)
+  {
+    this->settings = settings;
+    scale = settings.maxScale;
+    average = 0.0f;
+    samples = 0;
+    settleCountdown = 0;
+  }
+
+  // Feeds one measured GPU frame time, true when the scale changed
+  bool update(float milliseconds)
+  {
+    average = samples == 0 ? milliseconds : average + (milliseconds - average) * settings.smoothing;
+    samples++;
+
+    if(settleCountdown > 0)
+    {
+      settleCountdown--;
+      return false;
+    }
+
+    float newScale = scale;
+
+    if(average > settings.targetMilliseconds)
+    {
+      // GPU time follows the pixel count, which goes with the square of the scale
+      float fit = scale * std::sqrt(settings.targetMilliseconds / average);
+      newScale = std::min(quantize(fit), scale - settings.step);
+    }
+    else if(average < settings.targetMilliseconds * settings.headroom)
+    {
+      newScale = scale + settings.step;
+    }
+
+    newScale = std::clamp(newScale, settings.minScale, settings.maxScale);
+
+    if(std::abs(newScale - scale) < settings.step * 0.5f)
+    {
+      return false;
+    }
+
+    scale = newScale;
+    settleCountdown = settings.settleFrames;
+
+    return true;
+  }
+
+  float getScale() const { return scale; }
+  float getAverageMilliseconds() const { return average; }
+
+  // extent scaled, at least one pixel each way. Any struct with uint32_t
+  // width and height, VkExtent2D on the renderer's side.
+  template<typename Extent>
+  Extent scaleExtent(Extent extent) const
+  {
+    return {
+      std::max(1u, static_cast<uint32_t>(std::lround(extent.width * scale))),
+      std::max(1u, static_cast<uint32_t>(std::lround(extent.height * scale)))
+    };
+  }
+
+  private:
+  float quantize(float value) const
+  {
+    return std::floor(value / settings.step + 1e-3f) * settings.step;
+  }
+
+  Settings settings;
+  float scale = 1.0f;
+  float average = 0.0f;
+  uint64_t samples = 0;
+  uint32_t settleCountdown = 0;
+};
@@ -0,0 +1,335 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "allocator.hpp"
+#include "logger.hpp"
+
+/*
+  Deferred destruction.
+
+  A Resource owns one Vulkan object, plus the memory behind it for buffers
+  and images. Destroying or reassigning it doesn't destroy the object; it
+  goes to the DeletionQueue, so a resource can be dropped in the middle of
+  a frame while submissions still in flight use it.
+
+  The queue hands everything released since the last submission to the
+  frame slot that submits next. Its objects are destroyed once that slot's
+  fence has signalled, since every earlier submission on the queue has
+  finished by then. Nothing waits for the device to go idle.
+
+  Every Resource holding an object is linked into its queue in creation
+  order, so shutdown is releaseAll() and flush() rather than a list of
+  everything that has to go first.
+
+  Render thread only.
+*/
+class ResourceLink
+{
+  public:
+  virtual void reset() = 0;
+
+  protected:
+  ~ResourceLink() = default;
+
+  private:
+  friend class DeletionQueue;
+
+  ResourceLink *previous = nullptr;
+  ResourceLink *next = nullptr;
+};
+
+class DeletionQueue
+{
+  public:
+  void init(VkDevice device, DeviceAllocator &allocator, uint32_t slotCount)
+  {
+    this->device = device;
+    this->allocator = &allocator;
+    slots.assign(slotCount, {});
+  }
+
+  void push(VkObjectType type, uint64_t handle, const GpuAllocation &allocation)
+  {
+    released.push_back({type, handle, allocation});
+  }
+
+  // Right after slot's vkQueueSubmit, its fence now covers everything released so far
+  void submit(uint32_t slot)
+  {
+    std::vector<Deletion> &deletions = slots[slot];
+    deletions.insert(deletions.end(), released.begin(), released.end());
+    released.clear();
+  }
+
+  // Once slot's fence has signalled, before it is reset
+  void collect(uint32_t slot)
+  {
+    for(const Deletion &deletion : slots[slot])
+    {
+      destroy(deletion);
+    }
+
+    slots[slot].clear();
+  }
+
+  // Newest first, so views and framebuffers go ahead of what they were made from
+  void releaseAll()
+  {
+    while(newest != nullptr)
+    {
+      newest->reset();
+    }
+  }
+
+  // The device must be idle
+  void flush()
+  {
+    for(uint32_t slot = 0; slot < slots.size(); slot++)
+    {
+      collect(slot);
+    }
+
+    for(const Deletion &deletion : released)
+    {
+      destroy(deletion);
+    }
+
+    released.clear();
+  }
+
+  private:
+  template<VkObjectType TYPE, typename Handle>
+  friend class Resource;
+
+  void link(ResourceLink &resource)
+  {
+    resource.previous = newest;
+    resource.next = nullptr;
+
+    if(newest != nullptr)
+    {
+      newest->next = &resource;
+    }
+
+    newest = &resource;
+  }
+
+  void unlink(ResourceLink &resource)
+  {
+    if(resource.previous != nullptr)
+    {
+      resource.previous->next = resource.next;
+    }
+
+    if(resource.next != nullptr)
+    {
+      resource.next->previous = resource.previous;
+    }
+    else
+    {
+      newest = resource.previous;
+    }
+
+    resource.previous = nullptr;
+    resource.next = nullptr;
+  }
+
+  // to takes over from's place, keeping the creation order through moves
+  void relink(ResourceLink &from, ResourceLink &to)
+  {
+    to.previous = from.previous;
+    to.next = from.next;
+
+    if(to.previous != nullptr)
+    {
+      to.previous->next = &to;
+    }
+
+    if(to.next != nullptr)
+    {
+      to.next->previous = &to;
+    }
+    else
+    {
+      newest = &to;
+    }
+
+    from.previous = nullptr;
+    from.next = nullptr;
+  }
+
+  struct Deletion
+  {
+    VkObjectType type;
+    uint64_t handle;
+    GpuAllocation allocation;
+  };
+
+  // Non dispatchable handles are pointers on 64 bit platforms and uint64_t elsewhere
+  template<typename Handle>
+  static Handle fromObjectHandle(uint64_t handle)
+  {
+    if constexpr(std::is_pointer_v<Handle>)
+    {
+      return reinterpret_cast<Handle>(handle);
+    }
+    else
+    {
+      return static_cast<Handle>(handle);
+    }
+  }
+
+  void destroy(const Deletion &deletion)
+  {
+    switch(deletion.type)
+    {
+      case VK_OBJECT_TYPE_BUFFER:
+      vkDestroyBuffer(device, fromObjectHandle<VkBuffer>(deletion.handle), nullptr);
+      break;
+      case VK_OBJECT_TYPE_IMAGE:
+      vkDestroyImage(device, fromObjectHandle<VkImage>(deletion.handle), nullptr);
+      break;
+      case VK_OBJECT_TYPE_IMAGE_VIEW:
+      vkDestroyImageView(device, fromObjectHandle<VkImageView>(deletion.handle), nullptr);
+      break;
+      case VK_OBJECT_TYPE_SAMPLER:
+      vkDestroySampler(device, fromObjectHandle<VkSampler>(deletion.handle), nullptr);
+      break;
+      case VK_OBJECT_TYPE_PIPELINE:
+      vkDestroyPipeline(device, fromObjectHandle<VkPipeline>(deletion.handle), nullptr);
+      break;
+      case VK_OBJECT_TYPE_FRAMEBUFFER:
+      vkDestroyFramebuffer(device, fromObjectHandle<VkFramebuffer>(deletion.handle), nullptr);
+      break;
+      case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+      vkDestroyDescriptorPool(device, fromObjectHandle<VkDescriptorPool>(deletion.handle), nullptr);
+      break;
+      case VK_OBJECT_TYPE_COMMAND_POOL:
+      vkDestroyCommandPool(device, fromObjectHandle<VkCommandPool>(deletion.handle), nullptr);
+      break;
+      case VK_OBJECT_TYPE_SWAPCHAIN_KHR:
+      vkDestroySwapchainKHR(device, fromObjectHandle<VkSwapchainKHR>(deletion.handle), nullptr);
+      break;
+      default:
+      LOG_DEBUG("DeletionQueue: no destroy function for object type {}", static_cast<int>(deletion.type));
+      break;
+    }
+
+    // Only after the object bound to it is gone
+    GpuAllocation allocation = deletion.allocation;
+    allocator->free(allocation);
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator *allocator = nullptr;
+  std::vector<Deletion> released; // Since the last submission
+  std::vector<std::vector<Deletion>> slots;
+  ResourceLink *newest = nullptr; // Most recently created Resource still holding an object
+};
+
+// Move only owner of a Handle of type TYPE, see DeletionQueue. Linked
+// into the queue whenever it holds an object.
+template<VkObjectType TYPE, typename Handle>
+class Resource : public ResourceLink
+{
+  public:
+  Resource() = default;
+
+  // allocation is the memory bound to a buffer or image, freed along with it
+  Resource(DeletionQueue &queue, Handle handle, const GpuAllocation &allocation = {})
+    : queue(&queue), handle(handle), allocation(allocation)
+  {
+    if(handle != VK_NULL_HANDLE)
+    {
+      queue.link(*this);
+    }
+  }
+
+  Resource(const Resource &) = delete;
+  Resource &operator=(const Resource &) = delete;
+
+  Resource(Resource &&other) noexcept
+  {
+    take(other);
+  }
+
+  Resource &operator=(Resource &&other) noexcept
+  {
+    if(this != &other)
+    {
+      reset();
+      take(other);
+    }
+
+    return *this;
+  }
+
+  ~Resource()
+  {
+    reset();
+  }
+
+  // Queues the object for destruction once the frames using it are done
+  void reset() override
+  {
+    if(handle == VK_NULL_HANDLE)
+    {
+      return;
+    }
+
+    uint64_t objectHandle;
+    if constexpr(std::is_pointer_v<Handle>)
+    {
+      objectHandle = reinterpret_cast<uint64_t>(handle);
+    }
+    else
+    {
+      objectHandle = static_cast<uint64_t>(handle);
+    }
+
+    queue->unlink(*this);
+    queue->push(TYPE, objectHandle, allocation);
+
+    handle = VK_NULL_HANDLE;
+    allocation = {};
+  }
+
+  Handle get() const { return handle; }
+  const GpuAllocation &getAllocation() const { return allocation; }
+
+  explicit operator bool() const { return handle != VK_NULL_HANDLE; }
+
+  private:
+  // This holds nothing
+  void take(Resource &other)
+  {
+    queue = other.queue;
+    handle = std::exchange(other.handle, VK_NULL_HANDLE);
+    allocation = std::exchange(other.allocation, {});
+
+    if(handle != VK_NULL_HANDLE)
+    {
+      queue->relink(other, *this);
+    }
+  }
+
+  DeletionQueue *queue = nullptr;
+  Handle handle = VK_NULL_HANDLE;
+  GpuAllocation allocation;
+};
+
+using Buffer = Resource<VK_OBJECT_TYPE_BUFFER, VkBuffer>;
+using Image = Resource<VK_OBJECT_TYPE_IMAGE, VkImage>;
+using ImageView = Resource<VK_OBJECT_TYPE_IMAGE_VIEW, VkImageView>;
+using Sampler = Resource<VK_OBJECT_TYPE_SAMPLER, VkSampler>;
+using Pipeline = Resource<VK_OBJECT_TYPE_PIPELINE, VkPipeline>;
+using Framebuffer = Resource<VK_OBJECT_TYPE_FRAMEBUFFER, VkFramebuffer>;
+using DescriptorPool = Resource<VK_OBJECT_TYPE_DESCRIPTOR_POOL, VkDescriptorPool>; // Destroying it frees its sets
+using CommandPool = Resource<VK_OBJECT_TYPE_COMMAND_POOL, VkCommandPool>; // Destroying it frees its command buffers
+using SwapChain = Resource<VK_OBJECT_TYPE_SWAPCHAIN_KHR, VkSwapchainKHR>;
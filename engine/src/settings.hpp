@@ -0,0 +1,143 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "logger.hpp"
+
+/*
+  Runtime options, read before the device is created.
+
+  settings.cfg in the asset archive holds one "key = value" per line, '#'
+  starts a comment. On desktop every "--key=value" argument is applied after
+  it, so the command line wins. Keys nothing asks for are ignored; a value
+  that does not parse logs and leaves the default in place.
+*/
+class Settings
+{
+  public:
+  void parse(std::string_view text)
+  {
+    while(!text.empty())
+    {
+      size_t end = text.find('\n');
+      std::string_view line = text.substr(0, end);
+      text = end == std::string_view::npos ? std::string_view() : text.substr(end + 1);
+
+      line = line.substr(0, line.find('#'));
+
+      if(!trim(line).empty() && !set(line))
+      {
+        LOG_DEBUG("Ignoring setting line \"{}\"", trim(line));
+      }
+    }
+  }
+
+  // False when argument is not of the form --key=value
+  bool parseArgument(std::string_view argument)
+  {
+    if(argument.substr(0, 2) != "--")
+    {
+      return false;
+    }
+
+    return set(argument.substr(2));
+  }
+
+  std::optional<std::string_view> get(std::string_view key) const
+  {
+    auto value = values.find(key);
+
+    if(value == values.end())
+    {
+      return std::nullopt;
+    }
+
+    return value->second;
+  }
+
+  bool getBool(std::string_view key, bool fallback) const
+  {
+    std::optional<std::string_view> value = get(key);
+
+    if(!value)
+    {
+      return fallback;
+    }
+
+    if(*value == "true" || *value == "on" || *value == "1")
+    {
+      return true;
+    }
+
+    if(*value == "false" || *value == "off" || *value == "0")
+    {
+      return false;
+    }
+
+    LOG_DEBUG("Setting {} is not a boolean: {}", key, *value);
+    return fallback;
+  }
+
+  uint32_t getUint(std::string_view key, uint32_t fallback) const
+  {
+    std::optional<std::string_view> value = get(key);
+
+    if(!value)
+    {
+      return fallback;
+    }
+
+    uint32_t result = 0;
+    auto [end, error] = std::from_chars(value->data(), value->data() + value->size(), result);
+
+    if(error != std::errc() || end != value->data() + value->size())
+    {
+      LOG_DEBUG("Setting {} is not a number: {}", key, *value);
+      return fallback;
+    }
+
+    return result;
+  }
+
+  private:
+  static std::string_view trim(std::string_view text)
+  {
+    size_t first = text.find_first_not_of(" \t\r");
+
+    if(first == std::string_view::npos)
+    {
+      return {};
+    }
+
+    return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+  }
+
+  // "key = value", false without the '=' or a key
+  bool set(std::string_view line)
+  {
+    size_t separator = line.find('=');
+
+    if(separator == std::string_view::npos)
+    {
+      return false;
+    }
+
+    std::string_view key = trim(line.substr(0, separator));
+
+    if(key.empty())
+    {
+      return false;
+    }
+
+    values[std::string(key)] = std::string(trim(line.substr(separator + 1)));
+    return true;
+  }
+
+  std::map<std::string, std::string, std::less<>> values;
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <span>
+#include <vector>
+
+#include "allocator.hpp"
+#include "logger.hpp"
+#include "resources.hpp"
+#include "vertex.hpp"
+
+/*
+  Sprite batching on top of the 2D vertex format.
+
+  submit() only copies the sprite and its sort key into storage reserved by
+  init(), so a frame of sprites costs no allocations. end() sorts by layer,
+  material and texture, expands every sprite into four vertices, packs them
+  a chunk at a time into the frame's persistently mapped PackedVertex
+  stream, and merges runs that share a material and texture into one batch.
+  draw() then issues a single vkCmdDrawIndexed per batch over a static index
+  buffer holding the 0 1 2 2 3 0 pattern for every quad, built once with
+  buildIndexPattern().
+
+  Materials and textures are ids the caller gives meaning to, draw() hands
+  them back through BindFunction whenever they change. Sprites on one layer
+  may be drawn in any order, lower layers are drawn first.
+*/
+class SpriteBatcher
+{
+  public:
+  static constexpr uint32_t MAX_LAYERS = 256;
+  static constexpr uint32_t MAX_MATERIALS = 256;
+  static constexpr uint32_t MAX_TEXTURES = 1u << 24;
+  static constexpr uint32_t MAX_SPRITES = 1u << 24;
+
+  struct Sprite
+  {
+    glm::vec2 position; // Center
+    glm::vec2 size;
+    float rotation = 0.0f; // Radians, counter clockwise about the center
+    glm::vec3 color = glm::vec3(1.0f, 1.0f, 1.0f);
+    glm::vec4 uvRect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f); // Offset in xy, size in zw
+    uint32_t texture = 0;
+    uint32_t material = 0;
+    uint32_t layer = 0;
+  };
+
+  struct Batch
+  {
+    uint32_t material;
+    uint32_t texture;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+
+    bool operator==(const Batch &other) const = default;
+  };
+
+  using BindFunction = std::function<void(VkCommandBuffer commandBuffer, uint32_t material, uint32_t texture)>;
+
+  // Six indices per sprite, referencing its four vertices
+  static std::vector<uint32_t> buildIndexPattern(uint32_t maxSprites)
+  {
+    std::vector<uint32_t> pattern(size_t(maxSprites) * 6);
+
+    for(uint32_t sprite = 0; sprite < maxSprites; sprite++)
+    {
+      uint32_t vertex = sprite * 4;
+      uint32_t *quad = &pattern[size_t(sprite) * 6];
+
+      quad[0] = vertex;
+      quad[1] = vertex + 1;
+      quad[2] = vertex + 2;
+      quad[3] = vertex + 2;
+      quad[4] = vertex + 3;
+      quad[5] = vertex;
+    }
+
+    return pattern;
+  }
+
+  // indexBuffer holds buildIndexPattern(maxSprites) as VK_INDEX_TYPE_UINT32
+  bool init(VkDevice device, DeviceAllocator &allocator, DeletionQueue &deletionQueue, VkBuffer indexBuffer, uint32_t maxSprites, uint32_t frameCount)
+  {
+    this->device = device;
+    this->allocator = &allocator;
+    this->deletionQueue = &deletionQueue;
+    this->indexBuffer = indexBuffer;
+    this->maxSprites = std::min(maxSprites, MAX_SPRITES);
+
+    sprites.reserve(this->maxSprites);
+    keys.reserve(this->maxSprites);
+    previousBatches.reserve(this->maxSprites);
+    quads.resize(size_t(QUAD_CHUNK_SIZE) * 4);
+
+    frames.resize(frameCount);
+
+    for(Frame &frame : frames)
+    {
+      if(!createVertexStream(frame))
+      {
+        return false;
+      }
+
+      frame.batches.reserve(this->maxSprites);
+    }
+
+    LOG_DEBUG("Sprite batcher with room for {} sprites per frame", this->maxSprites);
+    return true;
+  }
+
+  // The vertex streams go to the deletion queue
+  void destroy()
+  {
+    frames.clear();
+  }
+
+  // Starts collecting sprites for frame, whose previous submission must have finished
+  void begin(uint32_t frameIndex)
+  {
+    currentFrame = frameIndex;
+    sprites.clear();
+    keys.clear();
+  }
+
+  void submit(const Sprite &sprite)
+  {
+    if(sprites.size() == maxSprites)
+    {
+      droppedSprites++;
+      return;
+    }
+
+    // Sorts by layer, then material, then texture, then submission order
+    uint64_t key =
+      (uint64_t(std::min(sprite.layer, MAX_LAYERS - 1)) << 56) |
+      (uint64_t(std::min(sprite.material, MAX_MATERIALS - 1)) << 48) |
+      (uint64_t(std::min(sprite.texture, MAX_TEXTURES - 1)) << 24) |
+      uint64_t(sprites.size());
+
+    keys.push_back(key);
+    sprites.push_back(sprite);
+  }
+
+  // Writes the vertex stream and batches of the current frame
+  void end()
+  {
+    if(droppedSprites > 0)
+    {
+      LOG_DEBUG("Sprite batcher full, dropped {} sprites", droppedSprites);
+      droppedSprites = 0;
+    }
+
+    Frame &frame = frames[currentFrame];
+    frame.batches.clear();
+
+    std::sort(keys.begin(), keys.end());
+
+    for(uint32_t i = 0; i < keys.size(); i++)
+    {
+      const Sprite &sprite = sprites[keys[i] & 0xffffff];
+      writeQuad(sprite, &quads[size_t(i % QUAD_CHUNK_SIZE) * 4]);
+
+      // Packing goes straight to the mapped stream once a chunk is complete
+      if((i + 1) % QUAD_CHUNK_SIZE == 0 || i + 1 == keys.size())
+      {
+        uint32_t first = i - i % QUAD_CHUNK_SIZE;
+        packVertices(quads.data(), frame.vertices + size_t(first) * 4, size_t(i + 1 - first) * 4);
+      }
+
+      if(!frame.batches.empty() && frame.batches.back().material == sprite.material && frame.batches.back().texture == sprite.texture)
+      {
+        frame.batches.back().indexCount += 6;
+      }
+      else
+      {
+        frame.batches.push_back({sprite.material, sprite.texture, i * 6, 6});
+      }
+    }
+
+    // Recorded draws stay valid as long as the batches do
+    if(frame.batches != previousBatches)
+    {
+      previousBatches = frame.batches;
+      generation++;
+    }
+  }
+
+  // Draws frame's batches, the pipeline layout and descriptor sets stay as bound
+  void draw(VkCommandBuffer commandBuffer, uint32_t frameIndex, const BindFunction &bind) const
+  {
+    const Frame &frame = frames[frameIndex];
+
+    if(frame.batches.empty())
+    {
+      return;
+    }
+
+    VkDeviceSize offset = 0;
+    VkBuffer vertexBuffer = frame.vertexBuffer.get();
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &offset);
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+    for(const Batch &batch : frame.batches)
+    {
+      bind(commandBuffer, batch.material, batch.texture);
+      vkCmdDrawIndexed(commandBuffer, batch.indexCount, 1, batch.firstIndex, 0, 0);
+    }
+  }
+
+  std::span<const Batch> getBatches(uint32_t frameIndex) const { return frames[frameIndex].batches; }
+
+  // Changes whenever end() produced batches different from the previous end()
+  uint64_t getGeneration() const { return generation; }
+
+  private:
+  static constexpr uint32_t QUAD_CHUNK_SIZE = 256;
+
+  struct Frame
+  {
+    Buffer vertexBuffer;
+    PackedVertex *vertices = nullptr;
+    std::vector<Batch> batches;
+  };
+
+  static void writeQuad(const Sprite &sprite, Vertex *quad)
+  {
+    glm::vec2 halfSize = sprite.size * 0.5f;
+    float c = std::cos(sprite.rotation);
+    float s = std::sin(sprite.rotation);
+
+    // Counter clockwise from the bottom left, matching the quad mesh
+    const glm::vec2 corners[4] = {{-1.0f, -1.0f}, {1.0f, -1.0f}, {1.0f, 1.0f}, {-1.0f, 1.0f}};
+    const glm::vec2 uvs[4] = {{0.0f, 1.0f}, {1.0f, 1.0f}, {1.0f, 0.0f}, {0.0f, 0.0f}};
+
+    for(int i = 0; i < 4; i++)
+    {
+      glm::vec2 local = corners[i] * halfSize;
+
+      quad[i].pos = sprite.position + glm::vec2(c * local.x - s * local.y, s * local.x + c * local.y);
+      quad[i].color = sprite.color;
+      quad[i].texCoord = glm::vec2(sprite.uvRect.x + uvs[i].x * sprite.uvRect.z, sprite.uvRect.y + uvs[i].y * sprite.uvRect.w);
+    }
+  }
+
+  bool createVertexStream(Frame &frame)
+  {
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = sizeof(PackedVertex) * 4 * VkDeviceSize(maxSprites);
+    bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkBuffer buffer;
+    if(vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create sprite vertex buffer");
+      return false;
+    }
+
+    GpuAllocation allocation;
+    bool allocated = allocator->allocateBuffer(buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, allocation);
+    frame.vertexBuffer = Buffer(*deletionQueue, buffer, allocation);
+
+    if(!allocated)
+    {
+      LOG_DEBUG("Failed to allocate sprite vertex buffer memory");
+      return false;
+    }
+
+    frame.vertices = static_cast<PackedVertex*>(allocation.mapped);
+    return true;
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator *allocator = nullptr;
+  DeletionQueue *deletionQueue = nullptr;
+  VkBuffer indexBuffer = VK_NULL_HANDLE;
+  uint32_t maxSprites = 0;
+  uint32_t currentFrame = 0;
+  uint32_t droppedSprites = 0;
+  uint64_t generation = 0;
+
+  std::vector<Sprite> sprites;
+  std::vector<uint64_t> keys;
+  std::vector<Vertex> quads; // Float quads of the chunk being packed
+  std::vector<Batch> previousBatches;
+  std::vector<Frame> frames;
+};
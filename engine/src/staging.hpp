@@ -0,0 +1,237 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+#include <vector>
+
+#include "logger.hpp"
+#include "allocator.hpp"
+
+/*
+  Persistently mapped ring buffer used as the source of every upload.
+
+  Uploads write into the ring and record copies out of it. When the copies are
+  submitted the caller asks for submitFence(), which closes the current batch:
+  the space written since the previous batch is given back once that fence
+  signals. Nothing is allocated, mapped or freed per upload.
+*/
+class StagingRing
+{
+  public:
+  static constexpr VkDeviceSize DEFAULT_SIZE = 32ull * 1024 * 1024;
+  static constexpr VkDeviceSize DEFAULT_ALIGNMENT = 16;
+
+  struct Slice
+  {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void *data = nullptr;
+  };
+
+  void init(VkDevice device, DeviceAllocator &allocator, VkDeviceSize size)
+  {
+    this->device = device;
+    this->allocator = &allocator;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if(vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create staging ring buffer");
+    }
+
+    if(!allocator.allocateBuffer(buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, allocation))
+    {
+      LOG_DEBUG("Failed to allocate staging ring memory");
+    }
+
+    capacity = size;
+    head = 0;
+    tail = 0;
+    usedBytes = 0;
+    openBytes = 0;
+  }
+
+  void destroy()
+  {
+    waitIdle();
+
+    for(auto fence : freeFences)
+    {
+      vkDestroyFence(device, fence, nullptr);
+    }
+
+    freeFences.clear();
+
+    vkDestroyBuffer(device, buffer, nullptr);
+    allocator->free(allocation);
+    buffer = VK_NULL_HANDLE;
+  }
+
+  // Returns false when the ring has no contiguous room left; the caller should
+  // wait for an older batch (waitOldest) or submit the open one first.
+  bool allocate(VkDeviceSize size, VkDeviceSize alignment, Slice &slice)
+  {
+    reclaim();
+
+    if(size > capacity)
+    {
+      return false;
+    }
+
+    if(usedBytes == 0)
+    {
+      head = 0;
+      tail = 0;
+    }
+
+    VkDeviceSize offset = alignUp(head, alignment);
+    VkDeviceSize consumed = 0;
+
+    if(usedBytes == 0 || head > tail)
+    {
+      if(offset + size <= capacity)
+      {
+        consumed = offset + size - head;
+      }
+      else if(size <= tail)
+      {
+        // Wrap around, the skipped end of the buffer belongs to this batch
+        consumed = capacity - head + size;
+        offset = 0;
+      }
+      else
+      {
+        return false;
+      }
+    }
+    else if(offset + size <= tail)
+    {
+      consumed = offset + size - head;
+    }
+    else
+    {
+      return false;
+    }
+
+    head = offset + size;
+    usedBytes += consumed;
+    openBytes += consumed;
+
+    slice.buffer = buffer;
+    slice.offset = offset;
+    slice.size = size;
+    slice.data = static_cast<char*>(allocation.mapped) + offset;
+
+    return true;
+  }
+
+  // Closes the open batch. The returned fence must be passed to the vkQueueSubmit
+  // that consumes the batch; its space is reclaimed once the fence signals.
+  VkFence submitFence()
+  {
+    VkFence fence = acquireFence();
+    batches.push_back({fence, head, openBytes});
+    openBytes = 0;
+
+    return fence;
+  }
+
+  void reclaim()
+  {
+    while(!batches.empty() && vkGetFenceStatus(device, batches.front().fence) == VK_SUCCESS)
+    {
+      retireFront();
+    }
+  }
+
+  // Blocks until the oldest submitted batch is done, returns false if nothing is in flight
+  bool waitOldest()
+  {
+    if(batches.empty())
+    {
+      return false;
+    }
+
+    vkWaitForFences(device, 1, &batches.front().fence, VK_TRUE, UINT64_MAX);
+    retireFront();
+
+    return true;
+  }
+
+  void waitIdle()
+  {
+    while(waitOldest());
+  }
+
+  VkDeviceSize getCapacity() const { return capacity; }
+  VkDeviceSize getUsed() const { return usedBytes; }
+  bool isIdle() const { return usedBytes == 0; }
+
+  private:
+  struct Batch
+  {
+    VkFence fence;
+    VkDeviceSize end;
+    VkDeviceSize bytes;
+  };
+
+  static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+  {
+    alignment = alignment == 0 ? 1 : alignment;
+    return (value + alignment - 1) / alignment * alignment;
+  }
+
+  void retireFront()
+  {
+    Batch batch = batches.front();
+    batches.pop_front();
+
+    tail = batch.end;
+    usedBytes -= batch.bytes;
+
+    vkResetFences(device, 1, &batch.fence);
+    freeFences.push_back(batch.fence);
+  }
+
+  VkFence acquireFence()
+  {
+    if(!freeFences.empty())
+    {
+      VkFence fence = freeFences.back();
+      freeFences.pop_back();
+      return fence;
+    }
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkFence fence = VK_NULL_HANDLE;
+    if(vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create staging fence");
+    }
+
+    return fence;
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator *allocator = nullptr;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  GpuAllocation allocation;
+
+  VkDeviceSize capacity = 0;
+  VkDeviceSize head = 0; // Next write position
+  VkDeviceSize tail = 0; // Start of the oldest batch still in flight
+  VkDeviceSize usedBytes = 0; // In flight + open, including wrap padding
+  VkDeviceSize openBytes = 0; // Written since the last submitFence()
+
+  std::deque<Batch> batches;
+  std::vector<VkFence> freeFences;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "ktx.hpp"
+#include "threadpool.hpp"
+
+/*
+  Decodes textures on the thread pool and hands them back to the render
+  thread, which stages and uploads each one as soon as it is picked up by
+  poll(). The render thread keeps presenting (with a placeholder texture)
+  while decodes are in flight; getProgress() drives a loading screen.
+*/
+struct DecodedImage
+{
+  std::string name;
+  bool valid = false;
+
+  // Either a block compressed KTX2 file, viewed in place in the asset archive...
+  std::span<const char> file;
+  KtxTexture ktx;
+
+  // ...or RGBA8 pixels, malloc'ed by the decoder
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::unique_ptr<unsigned char, void(*)(void*)> pixels{nullptr, free};
+
+  bool isCompressed() const { return !file.empty(); }
+};
+
+class TextureLoader
+{
+  public:
+  using DecodeFunction = std::function<bool(const std::string &name, DecodedImage &image)>;
+
+  struct Progress
+  {
+    uint32_t requested;
+    uint32_t decoded;
+    uint32_t uploaded;
+  };
+
+  void init(ThreadPool &threadPool, DecodeFunction decode)
+  {
+    this->threadPool = &threadPool;
+    this->decode = decode;
+  }
+
+  void request(const std::string &name)
+  {
+    requested++;
+
+    threadPool->submit([this, name]() {
+      auto image = std::make_unique<DecodedImage>();
+      image->name = name;
+      image->valid = decode(name, *image);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        decodedImages.push_back(std::move(image));
+      }
+
+      decoded++;
+    });
+  }
+
+  // Runs upload on the calling thread for every image decoded since the last
+  // call, returns how many were handed over
+  uint32_t poll(const std::function<void(DecodedImage &image)> &upload)
+  {
+    std::deque<std::unique_ptr<DecodedImage>> ready;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ready.swap(decodedImages);
+    }
+
+    for(auto &image : ready)
+    {
+      upload(*image);
+      uploaded++;
+    }
+
+    return static_cast<uint32_t>(ready.size());
+  }
+
+  Progress getProgress() const
+  {
+    return {requested.load(), decoded.load(), uploaded.load()};
+  }
+
+  bool isComplete() const
+  {
+    return uploaded.load() == requested.load();
+  }
+
+  private:
+  ThreadPool *threadPool = nullptr;
+  DecodeFunction decode;
+
+  std::mutex mutex;
+  std::deque<std::unique_ptr<DecodedImage>> decodedImages;
+
+  std::atomic<uint32_t> requested{0};
+  std::atomic<uint32_t> decoded{0};
+  std::atomic<uint32_t> uploaded{0};
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "logger.hpp"
+
+/*
+  Bindless texture table (descriptor indexing, core in Vulkan 1.2).
+
+  One descriptor set holding a large, partially bound array of combined
+  image samplers, bound once per command buffer as set 1 and indexed from
+  per-instance data in the fragment shader. Slots are handed out by
+  registerTexture() and written in place; the bindings are update-after-bind
+  and update-unused-while-pending, so registering never invalidates recorded
+  command buffers. A released slot is only reused once every frame in
+  flight that could still sample it has finished.
+*/
+class TextureTable
+{
+  public:
+  static constexpr uint32_t MAX_TEXTURES = 4096;
+  static constexpr uint32_t INVALID_SLOT = UINT32_MAX;
+
+  // Whether the device has the descriptor indexing features the table needs
+  static bool isSupported(const VkPhysicalDeviceVulkan12Features &features)
+  {
+    return
+      features.runtimeDescriptorArray &&
+      features.descriptorBindingPartiallyBound &&
+      features.descriptorBindingSampledImageUpdateAfterBind &&
+      features.descriptorBindingUpdateUnusedWhilePending &&
+      features.shaderSampledImageArrayNonUniformIndexing;
+  }
+
+  bool init(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t framesInFlight)
+  {
+    this->device = device;
+    this->framesInFlight = framesInFlight;
+
+    VkPhysicalDeviceVulkan12Properties properties12{};
+    properties12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &properties12;
+
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    capacity = std::min({
+      MAX_TEXTURES,
+      properties12.maxPerStageDescriptorUpdateAfterBindSamplers,
+      properties12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+      properties12.maxDescriptorSetUpdateAfterBindSamplers,
+      properties12.maxDescriptorSetUpdateAfterBindSampledImages
+    });
+
+    VkDescriptorSetLayoutBinding binding{};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = capacity;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorBindingFlags bindingFlags =
+      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+      VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.bindingCount = 1;
+    bindingFlagsInfo.pBindingFlags = &bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &bindingFlagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &binding;
+
+    if(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create texture table layout");
+      return false;
+    }
+
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = capacity;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = 1;
+
+    if(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create texture table pool");
+      return false;
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &descriptorSetLayout;
+
+    if(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to allocate texture table");
+      return false;
+    }
+
+    // Handed out lowest first
+    freeSlots.resize(capacity);
+    for(uint32_t i = 0; i < capacity; i++)
+    {
+      freeSlots[i] = capacity - 1 - i;
+    }
+
+    LOG_DEBUG("Bindless texture table with {} slots", capacity);
+    return true;
+  }
+
+  // The device must be idle
+  void destroy()
+  {
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+
+    descriptorPool = VK_NULL_HANDLE;
+    descriptorSetLayout = VK_NULL_HANDLE;
+    descriptorSet = VK_NULL_HANDLE;
+    freeSlots.clear();
+    releasedSlots.clear();
+  }
+
+  VkDescriptorSetLayout getLayout() const { return descriptorSetLayout; }
+  VkDescriptorSet getDescriptorSet() const { return descriptorSet; }
+
+  // Slot the shader indexes to sample view through sampler, INVALID_SLOT when full
+  uint32_t registerTexture(VkImageView view, VkSampler sampler, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+  {
+    if(freeSlots.empty())
+    {
+      LOG_DEBUG("Texture table is full ({} slots)", capacity);
+      return INVALID_SLOT;
+    }
+
+    uint32_t slot = freeSlots.back();
+    freeSlots.pop_back();
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageLayout = layout;
+    imageInfo.imageView = view;
+    imageInfo.sampler = sampler;
+
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = descriptorSet;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.dstArrayElement = slot;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+
+    return slot;
+  }
+
+  // The slot stays reserved until frame frameNumber + framesInFlight begins.
+  // The view it points at must live at least as long.
+  void release(uint32_t slot, uint64_t frameNumber)
+  {
+    if(slot != INVALID_SLOT)
+    {
+      releasedSlots.push_back({slot, frameNumber + framesInFlight});
+    }
+  }
+
+  // Call at the start of every frame, after its fence has signalled, with the
+  // number of frames submitted so far
+  void beginFrame(uint64_t frameNumber)
+  {
+    while(!releasedSlots.empty() && releasedSlots.front().reusableFrame <= frameNumber)
+    {
+      freeSlots.push_back(releasedSlots.front().slot);
+      releasedSlots.pop_front();
+    }
+  }
+
+  private:
+  struct ReleasedSlot
+  {
+    uint32_t slot;
+    uint64_t reusableFrame;
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  uint32_t framesInFlight = 1;
+  uint32_t capacity = 0;
+
+  VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+  std::vector<uint32_t> freeSlots;
+  std::deque<ReleasedSlot> releasedSlots;
+};
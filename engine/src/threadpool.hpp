@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+  Fixed set of worker threads pulling tasks from a shared FIFO queue.
+  Tasks must not touch Vulkan objects owned by the render thread; they hand
+  their results back through their own synchronized queues.
+*/
+class ThreadPool
+{
+  public:
+  // threadCount 0 picks one worker per hardware thread minus the caller's
+  void init(uint32_t threadCount = 0)
+  {
+    if(threadCount == 0)
+    {
+      threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    }
+
+    stopping = false;
+
+    for(uint32_t i = 0; i < threadCount; i++)
+    {
+      workers.emplace_back([this]() { workerLoop(); });
+    }
+  }
+
+  // Finishes the tasks already queued, then joins the workers
+  void destroy()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+
+    wakeWorkers.notify_all();
+
+    for(auto &worker : workers)
+    {
+      worker.join();
+    }
+
+    workers.clear();
+  }
+
+  void submit(std::function<void()> task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+    }
+
+    wakeWorkers.notify_one();
+  }
+
+  // Blocks until every queued task has finished running
+  void waitIdle()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return tasks.empty() && activeTasks == 0; });
+  }
+
+  uint32_t getThreadCount() const { return static_cast<uint32_t>(workers.size()); }
+
+  private:
+  void workerLoop()
+  {
+    while(true)
+    {
+      std::function<void()> task;
+
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wakeWorkers.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+        if(tasks.empty())
+        {
+          return;
+        }
+
+        task = std::move(tasks.front());
+        tasks.pop_front();
+        activeTasks++;
+      }
+
+      task();
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        activeTasks--;
+      }
+
+      idle.notify_all();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable wakeWorkers;
+  std::condition_variable idle;
+  uint32_t activeTasks = 0;
+  bool stopping = false;
+};
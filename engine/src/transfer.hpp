@@ -0,0 +1,294 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+#include "barriers.hpp"
+
+/*
+  Collects the barriers and copies of many uploads and records them as one
+  pass: a single barrier moving every destination into its copy layout, the
+  copies (regions targeting the same resource share one command), then a
+  single barrier releasing everything to its final layout and consumer stage.
+  Images whose final layout is TRANSFER_DST_OPTIMAL (mip chains generated
+  later on another queue) are left without a release barrier. Images that
+  are written piecewise over their lifetime (atlas pages) stay in GENERAL:
+  initializeImage() moves them there once, updateImageRegions() then copies
+  into them without a layout transition. Copies out of device buffers that
+  earlier transfers wrote (copyBuffer()) get a barrier ordering them after
+  every transfer write submitted before the batch; writes queued in the same
+  batch are not covered, submit those first.
+  Barriers are built as synchronization2 structs so the stage and access
+  masks live on each barrier; PipelineBarriers translates them on devices
+  without it.
+*/
+class TransferRecorder
+{
+  public:
+  // Consumer stage/access for the release barrier. A transfer only queue
+  // cannot name shader stages; pass VK_PIPELINE_STAGE_2_NONE there and let
+  // the semaphore wait on the consuming queue provide the visibility.
+  struct Destination
+  {
+    VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 access = VK_ACCESS_2_NONE;
+  };
+
+  // Copies level 0, every level is moved out of UNDEFINED
+  void uploadImage(VkBuffer source, VkDeviceSize sourceOffset, VkImage image, VkExtent3D extent, uint32_t mipLevels, VkImageLayout finalLayout, Destination destination)
+  {
+    VkBufferImageCopy region{};
+    region.bufferOffset = sourceOffset;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = extent;
+
+    uploadImageRegions(source, &region, 1, image, mipLevels, finalLayout, destination);
+  }
+
+  // Copies each region (typically one per mip level) out of the same source buffer
+  void uploadImageRegions(VkBuffer source, const VkBufferImageCopy *regions, uint32_t regionCount, VkImage image, uint32_t mipLevels, VkImageLayout finalLayout, Destination destination)
+  {
+    VkImageSubresourceRange range{};
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.baseMipLevel = 0;
+    range.levelCount = mipLevels;
+    range.baseArrayLayer = 0;
+    range.layerCount = 1;
+
+    VkImageMemoryBarrier2 acquire{};
+    acquire.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+    acquire.srcAccessMask = VK_ACCESS_2_NONE;
+    acquire.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    acquire.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    acquire.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    acquire.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    acquire.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    acquire.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    acquire.image = image;
+    acquire.subresourceRange = range;
+    acquireImages.push_back(acquire);
+
+    for(uint32_t i = 0; i < regionCount; i++)
+    {
+      imageCopies.push_back({source, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regions[i]});
+    }
+
+    if(finalLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+    {
+      return;
+    }
+
+    VkImageMemoryBarrier2 release = acquire;
+    release.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    release.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    release.dstStageMask = destination.stage;
+    release.dstAccessMask = destination.access;
+    release.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    release.newLayout = finalLayout;
+    releaseImages.push_back(release);
+  }
+
+  // Moves every level out of UNDEFINED into layout, before any copy of this batch
+  void initializeImage(VkImage image, uint32_t mipLevels, VkImageLayout layout)
+  {
+    VkImageMemoryBarrier2 acquire{};
+    acquire.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+    acquire.srcAccessMask = VK_ACCESS_2_NONE;
+    acquire.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    acquire.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    acquire.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    acquire.newLayout = layout;
+    acquire.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    acquire.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    acquire.image = image;
+    acquire.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    acquire.subresourceRange.baseMipLevel = 0;
+    acquire.subresourceRange.levelCount = mipLevels;
+    acquire.subresourceRange.baseArrayLayer = 0;
+    acquire.subresourceRange.layerCount = 1;
+    acquireImages.push_back(acquire);
+  }
+
+  // Copies regions into an image that stays in layout (GENERAL). The regions
+  // must not be read by work already submitted, there is no barrier before the copy.
+  void updateImageRegions(VkBuffer source, const VkBufferImageCopy *regions, uint32_t regionCount, VkImage image, VkImageLayout layout, Destination destination)
+  {
+    for(uint32_t i = 0; i < regionCount; i++)
+    {
+      imageCopies.push_back({source, image, layout, regions[i]});
+    }
+
+    if(destination.stage == VK_PIPELINE_STAGE_2_NONE)
+    {
+      return;
+    }
+
+    VkImageMemoryBarrier2 release{};
+    release.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    release.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    release.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    release.dstStageMask = destination.stage;
+    release.dstAccessMask = destination.access;
+    release.oldLayout = layout;
+    release.newLayout = layout;
+    release.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    release.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    release.image = image;
+    release.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    release.subresourceRange.baseMipLevel = 0;
+    release.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    release.subresourceRange.baseArrayLayer = 0;
+    release.subresourceRange.layerCount = 1;
+    releaseImages.push_back(release);
+  }
+
+  // Like uploadBuffer(), for a source written by earlier transfers instead of the host
+  void copyBuffer(VkBuffer source, VkDeviceSize sourceOffset, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, Destination destination)
+  {
+    readsTransferWrites = true;
+    uploadBuffer(source, sourceOffset, buffer, offset, size, destination);
+  }
+
+  void uploadBuffer(VkBuffer source, VkDeviceSize sourceOffset, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, Destination destination)
+  {
+    VkBufferCopy region{};
+    region.srcOffset = sourceOffset;
+    region.dstOffset = offset;
+    region.size = size;
+    bufferCopies.push_back({source, buffer, region});
+
+    // Buffers have no layout, nothing to release when nobody on this queue consumes them
+    if(destination.stage == VK_PIPELINE_STAGE_2_NONE)
+    {
+      return;
+    }
+
+    VkBufferMemoryBarrier2 release{};
+    release.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    release.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    release.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    release.dstStageMask = destination.stage;
+    release.dstAccessMask = destination.access;
+    release.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    release.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    release.buffer = buffer;
+    release.offset = offset;
+    release.size = size;
+    releaseBuffers.push_back(release);
+  }
+
+  bool isEmpty() const
+  {
+    return imageCopies.empty() && bufferCopies.empty();
+  }
+
+  // Records everything collected so far and clears the recorder
+  void record(VkCommandBuffer commandBuffer)
+  {
+    if(isEmpty())
+    {
+      return;
+    }
+
+    VkMemoryBarrier2 transferWrites{};
+    transferWrites.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    transferWrites.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    transferWrites.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    transferWrites.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    transferWrites.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+
+    if(!acquireImages.empty() || readsTransferWrites)
+    {
+      VkDependencyInfo dependencyInfo{};
+      dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+      dependencyInfo.memoryBarrierCount = readsTransferWrites ? 1 : 0;
+      dependencyInfo.pMemoryBarriers = &transferWrites;
+      dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(acquireImages.size());
+      dependencyInfo.pImageMemoryBarriers = acquireImages.data();
+
+      PipelineBarriers::record(commandBuffer, dependencyInfo);
+    }
+
+    std::vector<VkBufferImageCopy> imageRegions;
+    for(size_t i = 0; i < imageCopies.size(); i++)
+    {
+      imageRegions.push_back(imageCopies[i].region);
+
+      bool lastOfRun =
+        i + 1 == imageCopies.size() || imageCopies[i + 1].source != imageCopies[i].source ||
+        imageCopies[i + 1].image != imageCopies[i].image || imageCopies[i + 1].layout != imageCopies[i].layout;
+      if(lastOfRun)
+      {
+        vkCmdCopyBufferToImage(commandBuffer, imageCopies[i].source, imageCopies[i].image, imageCopies[i].layout, static_cast<uint32_t>(imageRegions.size()), imageRegions.data());
+        imageRegions.clear();
+      }
+    }
+
+    std::vector<VkBufferCopy> bufferRegions;
+    for(size_t i = 0; i < bufferCopies.size(); i++)
+    {
+      bufferRegions.push_back(bufferCopies[i].region);
+
+      bool lastOfRun = i + 1 == bufferCopies.size() || bufferCopies[i + 1].source != bufferCopies[i].source || bufferCopies[i + 1].buffer != bufferCopies[i].buffer;
+      if(lastOfRun)
+      {
+        vkCmdCopyBuffer(commandBuffer, bufferCopies[i].source, bufferCopies[i].buffer, static_cast<uint32_t>(bufferRegions.size()), bufferRegions.data());
+        bufferRegions.clear();
+      }
+    }
+
+    if(!releaseImages.empty() || !releaseBuffers.empty())
+    {
+      VkDependencyInfo dependencyInfo{};
+      dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+      dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(releaseBuffers.size());
+      dependencyInfo.pBufferMemoryBarriers = releaseBuffers.data();
+      dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(releaseImages.size());
+      dependencyInfo.pImageMemoryBarriers = releaseImages.data();
+
+      PipelineBarriers::record(commandBuffer, dependencyInfo);
+    }
+
+    clear();
+  }
+
+  void clear()
+  {
+    readsTransferWrites = false;
+    acquireImages.clear();
+    releaseImages.clear();
+    releaseBuffers.clear();
+    imageCopies.clear();
+    bufferCopies.clear();
+  }
+
+  private:
+  struct ImageCopy
+  {
+    VkBuffer source;
+    VkImage image;
+    VkImageLayout layout;
+    VkBufferImageCopy region;
+  };
+
+  struct BufferCopy
+  {
+    VkBuffer source;
+    VkBuffer buffer;
+    VkBufferCopy region;
+  };
+
+  std::vector<VkImageMemoryBarrier2> acquireImages;
+  std::vector<VkImageMemoryBarrier2> releaseImages;
+  std::vector<VkBufferMemoryBarrier2> releaseBuffers;
+  std::vector<ImageCopy> imageCopies;
+  std::vector<BufferCopy> bufferCopies;
+  bool readsTransferWrites = false;
+};
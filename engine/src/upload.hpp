@@ -0,0 +1,356 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+#include <vector>
+
+#include "logger.hpp"
+#include "staging.hpp"
+#include "transfer.hpp"
+
+/*
+  Asynchronous upload service.
+
+  Copies and layout transitions are recorded into a batch command buffer on
+  the upload queue (a dedicated transfer family when the device has one, the
+  graphics queue otherwise). flush() submits the batch and signals the next
+  value of a timeline semaphore; uploads queued on the transfer recorder are
+  recorded into the batch right before it is submitted. The returned ticket
+  can be polled, waited on, or handed to a graphics submission as a GPU side
+  wait, so the render thread never blocks on a copy.
+
+  Devices without timeline semaphores (most Vulkan 1.1 devices) get a fence
+  per batch instead. Tickets are still polled and waited on the same way,
+  but there is no semaphore to hand to another queue: the caller has to put
+  the upload queue on the queue that consumes its work and rely on
+  submission order, see getTimeline().
+*/
+struct UploadTicket
+{
+  uint64_t value = 0;
+};
+
+class UploadQueue
+{
+  public:
+  // stagingRing may be null for queues that never read from it. Without
+  // timelineSemaphores batches are tracked with fences.
+  void init(VkDevice device, uint32_t queueFamily, VkQueue queue, StagingRing *stagingRing, bool timelineSemaphores)
+  {
+    this->device = device;
+    this->queueFamily = queueFamily;
+    this->queue = queue;
+    this->stagingRing = stagingRing;
+    lastSubmitted = 0;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = queueFamily;
+
+    if(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create upload command pool");
+    }
+
+    if(!timelineSemaphores)
+    {
+      return;
+    }
+
+    VkSemaphoreTypeCreateInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &timelineInfo;
+
+    if(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create upload timeline semaphore");
+    }
+  }
+
+  void destroy()
+  {
+    wait({lastSubmitted});
+    collect();
+
+    vkDestroySemaphore(device, timeline, nullptr);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+
+    for(VkFence fence : freeFences)
+    {
+      vkDestroyFence(device, fence, nullptr);
+    }
+
+    recorder.clear();
+    inFlight.clear();
+    freeCommandBuffers.clear();
+    freeFences.clear();
+    recording = VK_NULL_HANDLE;
+    timeline = VK_NULL_HANDLE;
+  }
+
+  // Command buffer of the open batch, begun on first use
+  VkCommandBuffer record()
+  {
+    if(recording != VK_NULL_HANDLE)
+    {
+      return recording;
+    }
+
+    collect();
+
+    if(freeCommandBuffers.empty())
+    {
+      VkCommandBufferAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.commandPool = commandPool;
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      allocInfo.commandBufferCount = 1;
+
+      VkCommandBuffer commandBuffer;
+      if(vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+      {
+        LOG_DEBUG("Failed to allocate upload command buffer");
+      }
+
+      freeCommandBuffers.push_back(commandBuffer);
+    }
+
+    recording = freeCommandBuffers.back();
+    freeCommandBuffers.pop_back();
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkResetCommandBuffer(recording, 0);
+    vkBeginCommandBuffer(recording, &beginInfo);
+
+    return recording;
+  }
+
+  // Uploads queued here are merged into as few barriers as possible on flush()
+  TransferRecorder &getRecorder()
+  {
+    return recorder;
+  }
+
+  // Makes the next flush() wait for another queue's timeline to reach value.
+  // Only for queues with timeline semaphores.
+  void waitFor(VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags stage)
+  {
+    waitSemaphores.push_back(semaphore);
+    waitValues.push_back(value);
+    waitStages.push_back(stage);
+  }
+
+  bool hasPendingWork() const
+  {
+    return recording != VK_NULL_HANDLE || !recorder.isEmpty();
+  }
+
+  // Submits the open batch. Returns the ticket of the last submission when nothing was recorded.
+  UploadTicket flush()
+  {
+    if(!recorder.isEmpty())
+    {
+      recorder.record(record());
+    }
+
+    if(recording == VK_NULL_HANDLE)
+    {
+      return {lastSubmitted};
+    }
+
+    vkEndCommandBuffer(recording);
+
+    uint64_t signalValue = lastSubmitted + 1;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+    timelineInfo.pWaitSemaphoreValues = waitValues.data();
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &recording;
+
+    VkFence batchFence = VK_NULL_HANDLE;
+    if(timeline != VK_NULL_HANDLE)
+    {
+      submitInfo.pNext = &timelineInfo;
+      submitInfo.signalSemaphoreCount = 1;
+      submitInfo.pSignalSemaphores = &timeline;
+    }
+    else
+    {
+      batchFence = acquireFence();
+    }
+
+    // The staging space read by this batch is released together with it
+    VkFence stagingFence = stagingRing ? stagingRing->submitFence() : VK_NULL_HANDLE;
+
+    if(vkQueueSubmit(queue, 1, &submitInfo, batchFence != VK_NULL_HANDLE ? batchFence : stagingFence) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to submit upload batch");
+    }
+
+    // An empty submission signals its fence once everything before it is done
+    if(batchFence != VK_NULL_HANDLE && stagingFence != VK_NULL_HANDLE && vkQueueSubmit(queue, 0, nullptr, stagingFence) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to submit upload staging fence");
+    }
+
+    waitSemaphores.clear();
+    waitValues.clear();
+    waitStages.clear();
+
+    lastSubmitted = signalValue;
+    inFlight.push_back({recording, batchFence, signalValue});
+    recording = VK_NULL_HANDLE;
+
+    return {signalValue};
+  }
+
+  bool isComplete(UploadTicket ticket) const
+  {
+    return getCompletedValue() >= ticket.value;
+  }
+
+  void wait(UploadTicket ticket) const
+  {
+    if(ticket.value == 0)
+    {
+      return;
+    }
+
+    if(timeline == VK_NULL_HANDLE)
+    {
+      // Batches finish in order, the one that signals value covers the earlier ones
+      for(const Batch &batch : inFlight)
+      {
+        if(batch.value >= ticket.value)
+        {
+          vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+          return;
+        }
+      }
+
+      return;
+    }
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline;
+    waitInfo.pValues = &ticket.value;
+
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+  }
+
+  // Recycles command buffers of finished batches
+  void collect()
+  {
+    uint64_t completed = getCompletedValue();
+
+    while(!inFlight.empty() && inFlight.front().value <= completed)
+    {
+      freeCommandBuffers.push_back(inFlight.front().commandBuffer);
+
+      if(inFlight.front().fence != VK_NULL_HANDLE)
+      {
+        freeFences.push_back(inFlight.front().fence);
+      }
+
+      inFlight.pop_front();
+    }
+  }
+
+  uint64_t getCompletedValue() const
+  {
+    if(timeline == VK_NULL_HANDLE)
+    {
+      for(const Batch &batch : inFlight)
+      {
+        if(vkGetFenceStatus(device, batch.fence) != VK_SUCCESS)
+        {
+          return batch.value - 1;
+        }
+      }
+
+      return lastSubmitted;
+    }
+
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(device, timeline, &value);
+    return value;
+  }
+
+  UploadTicket getLastTicket() const { return {lastSubmitted}; }
+
+  // VK_NULL_HANDLE without timeline semaphores
+  VkSemaphore getTimeline() const { return timeline; }
+  uint32_t getQueueFamily() const { return queueFamily; }
+
+  private:
+  struct Batch
+  {
+    VkCommandBuffer commandBuffer;
+    VkFence fence; // Only without a timeline
+    uint64_t value;
+  };
+
+  VkFence acquireFence()
+  {
+    VkFence fence = VK_NULL_HANDLE;
+
+    if(!freeFences.empty())
+    {
+      fence = freeFences.back();
+      freeFences.pop_back();
+      vkResetFences(device, 1, &fence);
+      return fence;
+    }
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    if(vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+    {
+      LOG_DEBUG("Failed to create upload fence");
+    }
+
+    return fence;
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkQueue queue = VK_NULL_HANDLE;
+  uint32_t queueFamily = 0;
+  StagingRing *stagingRing = nullptr;
+
+  VkCommandPool commandPool = VK_NULL_HANDLE;
+  VkSemaphore timeline = VK_NULL_HANDLE;
+  uint64_t lastSubmitted = 0;
+
+  VkCommandBuffer recording = VK_NULL_HANDLE;
+  TransferRecorder recorder;
+  std::deque<Batch> inFlight;
+  std::vector<VkCommandBuffer> freeCommandBuffers;
+  std::vector<VkFence> freeFences;
+
+  std::vector<VkSemaphore> waitSemaphores;
+  std::vector<uint64_t> waitValues;
+  std::vector<VkPipelineStageFlags> waitStages;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+#include "vertex_layout.hpp"
+
+// The 2D vertex as authored and built on the CPU
+struct Vertex {
+  glm::vec2 pos;
+  glm::vec3 color;
+  glm::vec2 texCoord;
+};
+
+// Vertex as binding 0 holds it, 12 bytes instead of 28. Positions keep half
+// float precision (about 1/2048 of their magnitude), texture coordinates
+// are clamped to [0, 1] and colors get an alpha of 1.
+struct PackedVertex {
+  Half2 pos;
+  Unorm8x4 color;
+  Unorm16x2 texCoord;
+
+  using Layout = VertexLayout<Half2Attribute, Unorm8x4Attribute, Unorm16x2Attribute>;
+
+  static VkVertexInputBindingDescription getBindingDescription() {
+    return Layout::getBindingDescription(0, VK_VERTEX_INPUT_RATE_VERTEX);
+  }
+
+  static std::array<VkVertexInputAttributeDescription, Layout::attributeCount> getAttributeDescriptions() {
+    return Layout::getAttributeDescriptions(0, 0);
+  }
+};
+
+static_assert(sizeof(PackedVertex) == PackedVertex::Layout::stride, "PackedVertex members must match its layout");
+
+// Packs count vertices, gathering a chunk of each attribute at a time so
+// the SIMD packers run over contiguous floats
+inline void packVertices(const Vertex *in, PackedVertex *out, size_t count)
+{
+  constexpr size_t CHUNK_SIZE = 64;
+
+  float positions[CHUNK_SIZE * 2];
+  float colors[CHUNK_SIZE * 4];
+  float texCoords[CHUNK_SIZE * 2];
+
+  uint16_t packedPositions[CHUNK_SIZE * 2];
+  uint8_t packedColors[CHUNK_SIZE * 4];
+  uint16_t packedTexCoords[CHUNK_SIZE * 2];
+
+  for(size_t first = 0; first < count; first += CHUNK_SIZE)
+  {
+    size_t chunkSize = std::min(CHUNK_SIZE, count - first);
+
+    for(size_t i = 0; i < chunkSize; i++)
+    {
+      const Vertex &vertex = in[first + i];
+
+      positions[i * 2] = vertex.pos.x;
+      positions[i * 2 + 1] = vertex.pos.y;
+      colors[i * 4] = vertex.color.x;
+      colors[i * 4 + 1] = vertex.color.y;
+      colors[i * 4 + 2] = vertex.color.z;
+      colors[i * 4 + 3] = 1.0f;
+      texCoords[i * 2] = vertex.texCoord.x;
+      texCoords[i * 2 + 1] = vertex.texCoord.y;
+    }
+
+    packHalf(positions, packedPositions, chunkSize * 2);
+    packUnorm8(colors, packedColors, chunkSize * 4);
+    packUnorm16(texCoords, packedTexCoords, chunkSize * 2);
+
+    // Every attribute is 4 bytes, interleaving is one copy each
+    for(size_t i = 0; i < chunkSize; i++)
+    {
+      PackedVertex &vertex = out[first + i];
+
+      memcpy(&vertex.pos, &packedPositions[i * 2], sizeof(vertex.pos));
+      memcpy(&vertex.color, &packedColors[i * 4], sizeof(vertex.color));
+      memcpy(&vertex.texCoord, &packedTexCoords[i * 2], sizeof(vertex.texCoord));
+    }
+  }
+}
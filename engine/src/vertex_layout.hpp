@@ -0,0 +1,319 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define VERTEX_PACK_SSE2
+#endif
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#define VERTEX_PACK_F16C
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define VERTEX_PACK_NEON
+#endif
+
+/*
+  Vertex layouts described by a list of attribute types.
+
+  Each attribute type pairs the C++ type stored in the vertex with its
+  VkFormat, and VertexLayout<...> derives the stride, the offsets and the
+  VkVertexInputAttributeDescriptions from the list at compile time, in
+  order and with consecutive locations. A vertex struct declares one member
+  per attribute in the same order and checks itself with static_assert
+  against the layout's stride.
+
+  The packed formats (half floats, 8 and 16 bit UNORM) are filled from
+  float data by the pack*() functions below. They use F16C/SSE2 on x86 and
+  NEON on arm64, 4 to 16 values at a time, and fall back to scalar code
+  rounding the same way.
+*/
+template<typename T, VkFormat Format>
+struct VertexAttribute
+{
+  using Type = T;
+  static constexpr VkFormat format = Format;
+  static constexpr uint32_t size = sizeof(T);
+};
+
+struct Half2
+{
+  uint16_t x;
+  uint16_t y;
+};
+
+struct Unorm8x4
+{
+  uint8_t x;
+  uint8_t y;
+  uint8_t z;
+  uint8_t w;
+};
+
+struct Unorm16x2
+{
+  uint16_t x;
+  uint16_t y;
+};
+
+using Float2Attribute = VertexAttribute<glm::vec2, VK_FORMAT_R32G32_SFLOAT>;
+using Float3Attribute = VertexAttribute<glm::vec3, VK_FORMAT_R32G32B32_SFLOAT>;
+using Float4Attribute = VertexAttribute<glm::vec4, VK_FORMAT_R32G32B32A32_SFLOAT>;
+using UintAttribute = VertexAttribute<uint32_t, VK_FORMAT_R32_UINT>;
+using Half2Attribute = VertexAttribute<Half2, VK_FORMAT_R16G16_SFLOAT>;
+using Unorm8x4Attribute = VertexAttribute<Unorm8x4, VK_FORMAT_R8G8B8A8_UNORM>;
+using Unorm16x2Attribute = VertexAttribute<Unorm16x2, VK_FORMAT_R16G16_UNORM>;
+
+template<typename... Attributes>
+struct VertexLayout
+{
+  static constexpr uint32_t attributeCount = sizeof...(Attributes);
+  static constexpr uint32_t stride = (Attributes::size + ... + 0);
+
+  static constexpr std::array<uint32_t, attributeCount> getOffsets()
+  {
+    std::array<uint32_t, attributeCount> offsets{};
+    uint32_t sizes[] = {Attributes::size...};
+    uint32_t offset = 0;
+
+    for(uint32_t i = 0; i < attributeCount; i++)
+    {
+      offsets[i] = offset;
+      offset += sizes[i];
+    }
+
+    return offsets;
+  }
+
+  static constexpr VkVertexInputBindingDescription getBindingDescription(uint32_t binding, VkVertexInputRate inputRate)
+  {
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = binding;
+    bindingDescription.stride = stride;
+    bindingDescription.inputRate = inputRate;
+
+    return bindingDescription;
+  }
+
+  static constexpr std::array<VkVertexInputAttributeDescription, attributeCount> getAttributeDescriptions(uint32_t binding, uint32_t firstLocation)
+  {
+    std::array<VkVertexInputAttributeDescription, attributeCount> attributeDescriptions{};
+    std::array<uint32_t, attributeCount> offsets = getOffsets();
+    VkFormat formats[] = {Attributes::format...};
+
+    for(uint32_t i = 0; i < attributeCount; i++)
+    {
+      attributeDescriptions[i].binding = binding;
+      attributeDescriptions[i].location = firstLocation + i;
+      attributeDescriptions[i].format = formats[i];
+      attributeDescriptions[i].offset = offsets[i];
+    }
+
+    return attributeDescriptions;
+  }
+};
+
+// Round to nearest even, overflow to infinity, NaN stays NaN
+inline uint16_t floatToHalf(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  uint32_t sign = bits & 0x80000000u;
+  bits ^= sign;
+
+  uint16_t half;
+
+  if(bits >= 0x47800000u)
+  {
+    // Too large for a half, or already infinity or NaN
+    half = bits > 0x7f800000u ? 0x7e00 : 0x7c00;
+  }
+  else if(bits < 0x38800000u)
+  {
+    // Subnormal half, adding 0.5 lines the mantissa up and rounds it
+    float magic = 0.5f;
+    uint32_t magicBits;
+    memcpy(&magicBits, &magic, sizeof(magicBits));
+
+    float absolute;
+    memcpy(&absolute, &bits, sizeof(absolute));
+    absolute += magic;
+
+    uint32_t roundedBits;
+    memcpy(&roundedBits, &absolute, sizeof(roundedBits));
+    half = static_cast<uint16_t>(roundedBits - magicBits);
+  }
+  else
+  {
+    uint32_t mantissaOdd = (bits >> 13) & 1;
+    bits += (uint32_t(15 - 127) << 23) + 0xfff + mantissaOdd;
+    half = static_cast<uint16_t>(bits >> 13);
+  }
+
+  return static_cast<uint16_t>(half | (sign >> 16));
+}
+
+inline uint8_t floatToUnorm8(float value)
+{
+  return static_cast<uint8_t>(std::nearbyint(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+}
+
+inline uint16_t floatToUnorm16(float value)
+{
+  return static_cast<uint16_t>(std::nearbyint(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
+}
+
+#if defined(VERTEX_PACK_SSE2) && !defined(VERTEX_PACK_F16C)
+// floatToHalf() on four lanes, each result in the low 16 bits of its lane
+inline __m128i floatToHalfSse2(__m128 value)
+{
+  const __m128i signMask = _mm_set1_epi32(int32_t(0x80000000u));
+  const __m128i halfMax = _mm_set1_epi32(0x47800000);
+  const __m128i minNormal = _mm_set1_epi32(0x38800000);
+  const __m128i subnormalMagic = _mm_set1_epi32(0x3f000000);
+  const __m128i normalBias = _mm_set1_epi32(int32_t((uint32_t(15 - 127) << 23) + 0xfff));
+
+  __m128 sign = _mm_and_ps(value, _mm_castsi128_ps(signMask));
+  __m128 absolute = _mm_xor_ps(value, sign);
+  __m128i bits = _mm_castps_si128(absolute);
+
+  __m128i isNan = _mm_castps_si128(_mm_cmpunord_ps(absolute, absolute));
+  __m128i isRegular = _mm_cmpgt_epi32(halfMax, bits);
+  __m128i special = _mm_or_si128(_mm_and_si128(isNan, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+
+  __m128i isSubnormal = _mm_cmpgt_epi32(minNormal, bits);
+  __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absolute, _mm_castsi128_ps(subnormalMagic))), subnormalMagic);
+
+  __m128i mantissaOdd = _mm_srai_epi32(_mm_slli_epi32(bits, 31 - 13), 31);
+  __m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(bits, normalBias), mantissaOdd), 13);
+
+  __m128i regular = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+  __m128i half = _mm_or_si128(_mm_and_si128(isRegular, regular), _mm_andnot_si128(isRegular, special));
+
+  // Sign extended, so packing with signed saturation keeps the bit pattern
+  return _mm_or_si128(half, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+}
+#endif
+
+// count floats to halves
+inline void packHalf(const float *in, uint16_t *out, size_t count)
+{
+  size_t i = 0;
+
+  #if defined(VERTEX_PACK_F16C)
+  for(; i + 8 <= count; i += 8)
+  {
+    __m128i low = _mm_cvtps_ph(_mm_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+    __m128i high = _mm_cvtps_ph(_mm_loadu_ps(in + i + 4), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi64(low, high));
+  }
+  #elif defined(VERTEX_PACK_SSE2)
+  for(; i + 8 <= count; i += 8)
+  {
+    __m128i low = floatToHalfSse2(_mm_loadu_ps(in + i));
+    __m128i high = floatToHalfSse2(_mm_loadu_ps(in + i + 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(low, high));
+  }
+  #elif defined(VERTEX_PACK_NEON)
+  for(; i + 4 <= count; i += 4)
+  {
+    vst1_u16(out + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(in + i))));
+  }
+  #endif
+
+  for(; i < count; i++)
+  {
+    out[i] = floatToHalf(in[i]);
+  }
+}
+
+// count floats, clamped to [0, 1], to 8 bit UNORM
+inline void packUnorm8(const float *in, uint8_t *out, size_t count)
+{
+  size_t i = 0;
+
+  #if defined(VERTEX_PACK_SSE2)
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 scale = _mm_set1_ps(255.0f);
+
+  for(; i + 16 <= count; i += 16)
+  {
+    __m128i lanes[4];
+    for(int j = 0; j < 4; j++)
+    {
+      __m128 value = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + j * 4), zero), one);
+      lanes[j] = _mm_cvtps_epi32(_mm_mul_ps(value, scale));
+    }
+
+    __m128i words = _mm_packus_epi16(_mm_packs_epi32(lanes[0], lanes[1]), _mm_packs_epi32(lanes[2], lanes[3]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), words);
+  }
+  #elif defined(VERTEX_PACK_NEON)
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const float32x4_t one = vdupq_n_f32(1.0f);
+
+  for(; i + 8 <= count; i += 8)
+  {
+    uint32x4_t low = vcvtnq_u32_f32(vmulq_n_f32(vminq_f32(vmaxq_f32(vld1q_f32(in + i), zero), one), 255.0f));
+    uint32x4_t high = vcvtnq_u32_f32(vmulq_n_f32(vminq_f32(vmaxq_f32(vld1q_f32(in + i + 4), zero), one), 255.0f));
+    vst1_u8(out + i, vmovn_u16(vcombine_u16(vmovn_u32(low), vmovn_u32(high))));
+  }
+  #endif
+
+  for(; i < count; i++)
+  {
+    out[i] = floatToUnorm8(in[i]);
+  }
+}
+
+// count floats, clamped to [0, 1], to 16 bit UNORM
+inline void packUnorm16(const float *in, uint16_t *out, size_t count)
+{
+  size_t i = 0;
+
+  #if defined(VERTEX_PACK_SSE2)
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 scale = _mm_set1_ps(65535.0f);
+  const __m128i bias = _mm_set1_epi32(32768);
+
+  for(; i + 8 <= count; i += 8)
+  {
+    __m128i low = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), zero), one), scale));
+    __m128i high = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), zero), one), scale));
+
+    // SSE2 only packs with signed saturation, shift into its range and back
+    __m128i words = _mm_packs_epi32(_mm_sub_epi32(low, bias), _mm_sub_epi32(high, bias));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(words, _mm_set1_epi16(int16_t(0x8000))));
+  }
+  #elif defined(VERTEX_PACK_NEON)
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const float32x4_t one = vdupq_n_f32(1.0f);
+
+  for(; i + 4 <= count; i += 4)
+  {
+    uint32x4_t value = vcvtnq_u32_f32(vmulq_n_f32(vminq_f32(vmaxq_f32(vld1q_f32(in + i), zero), one), 65535.0f));
+    vst1_u16(out + i, vmovn_u32(value));
+  }
+  #endif
+
+  for(; i < count; i++)
+  {
+    out[i] = floatToUnorm16(in[i]);
+  }
+}
@@ -0,0 +1,165 @@
+#include "atlas.hpp"
+
+#include "check.hpp"
+
+#include <vector>
+
+namespace
+{
+  std::vector<uint8_t> makeImage(uint32_t width, uint32_t height)
+  {
+    std::vector<uint8_t> pixels(size_t(width) * height * 4);
+
+    for(size_t i = 0; i < pixels.size(); i++)
+    {
+      pixels[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    return pixels;
+  }
+
+  bool overlaps(const SkylinePacker::Rect &a, const SkylinePacker::Rect &b)
+  {
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+  }
+
+  void testPackerStaysInsideWithoutOverlaps()
+  {
+    SkylinePacker packer;
+    packer.init(256, 256);
+
+    std::vector<SkylinePacker::Rect> placed;
+    uint64_t area = 0;
+
+    for(uint32_t i = 0; ; i++)
+    {
+      uint32_t width = 8 + (i * 37) % 41;
+      uint32_t height = 8 + (i * 23) % 29;
+
+      SkylinePacker::Rect rect;
+      if(!packer.insert(width, height, rect))
+      {
+        break;
+      }
+
+      CHECK(rect.width == width && rect.height == height);
+      CHECK(rect.x + rect.width <= 256 && rect.y + rect.height <= 256);
+
+      for(const SkylinePacker::Rect &other : placed)
+      {
+        CHECK(!overlaps(rect, other));
+      }
+
+      placed.push_back(rect);
+      area += uint64_t(width) * height;
+    }
+
+    CHECK(placed.size() > 20);
+    CHECK(std::abs(packer.getOccupancy() - float(double(area) / (256.0 * 256.0))) < 1e-6f);
+  }
+
+  void testBlocksAreAlignedAndPadded()
+  {
+    TextureAtlas atlas;
+    atlas.init(256, 4, 3, 2, false);
+
+    std::vector<uint8_t> pixels = makeImage(10, 6);
+
+    // Knock the first spot off alignment for the next block
+    TextureAtlas::Block first;
+    CHECK(atlas.insert(pixels.data(), 10, 6, first));
+
+    TextureAtlas::Block block;
+    CHECK(atlas.insert(pixels.data(), 10, 6, block));
+    CHECK(block.page == 0);
+    CHECK(block.levels.size() == 3);
+
+    const TextureAtlas::Level &level0 = block.levels[0];
+    CHECK(level0.x % 4 == 0 && level0.y % 4 == 0);
+    CHECK(level0.width == 20 && level0.height == 16);
+    CHECK(block.levels[2].width == 5 && block.levels[2].height == 4);
+
+    CHECK(block.uvRect.x == float(level0.x + 4) / 256);
+    CHECK(block.uvRect.y == float(level0.y + 4) / 256);
+    CHECK(block.uvRect.z == 10.0f / 256 && block.uvRect.w == 6.0f / 256);
+
+    // The padding repeats the nearest edge texel
+    const uint8_t *texels = block.pixels.data() + level0.offset;
+    CHECK(memcmp(texels, pixels.data(), 4) == 0);
+    CHECK(memcmp(texels + (size_t(4) * 20 + 4) * 4, pixels.data(), 4) == 0);
+    CHECK(memcmp(texels + (size_t(15) * 20 + 19) * 4, pixels.data() + (size_t(5) * 10 + 9) * 4, 4) == 0);
+  }
+
+  // 2x2 black and white checker, its single mip texel
+  const uint8_t *averageChecker(TextureAtlas &atlas, TextureAtlas::Block &block)
+  {
+    const uint8_t pixels[16] = {
+      0, 0, 0, 255,  255, 255, 255, 255,
+      255, 255, 255, 255,  0, 0, 0, 255
+    };
+
+    CHECK(atlas.insert(pixels, 2, 2, block));
+    return block.pixels.data() + block.levels[1].offset;
+  }
+
+  void testMipsAverageInLinearSpace()
+  {
+    TextureAtlas unorm;
+    unorm.init(64, 0, 2, 1, false);
+    TextureAtlas::Block unormBlock;
+    const uint8_t *unormTexel = averageChecker(unorm, unormBlock);
+    CHECK(unormTexel[0] == 128 && unormTexel[3] == 255);
+
+    // Linear 0.5 is 188 once encoded, alpha is never converted
+    TextureAtlas srgb;
+    srgb.init(64, 0, 2, 1, true);
+    TextureAtlas::Block srgbBlock;
+    const uint8_t *srgbTexel = averageChecker(srgb, srgbBlock);
+    CHECK(srgbTexel[0] == 188 && srgbTexel[1] == 188 && srgbTexel[2] == 188);
+    CHECK(srgbTexel[3] == 255);
+  }
+
+  void testRevertLastInsert()
+  {
+    TextureAtlas atlas;
+    atlas.init(64, 0, 1, 2, false);
+
+    std::vector<uint8_t> pixels = makeImage(32, 32);
+    TextureAtlas::Block block;
+
+    CHECK(atlas.insert(pixels.data(), 32, 32, block));
+    CHECK(atlas.insert(pixels.data(), 32, 32, block));
+    uint32_t x = block.levels[0].x;
+    uint32_t y = block.levels[0].y;
+
+    atlas.revertLastInsert();
+    CHECK(atlas.getOccupancy(0) == 0.25f);
+
+    CHECK(atlas.insert(pixels.data(), 32, 32, block));
+    CHECK(block.levels[0].x == x && block.levels[0].y == y);
+
+    // Fill the first page, the next insert opens a second one
+    CHECK(atlas.insert(pixels.data(), 32, 32, block));
+    CHECK(atlas.insert(pixels.data(), 32, 32, block));
+    CHECK(atlas.insert(pixels.data(), 32, 32, block));
+    CHECK(block.page == 1 && atlas.getPageCount() == 2);
+
+    atlas.revertLastInsert();
+    CHECK(atlas.getPageCount() == 1);
+    CHECK(atlas.getOccupancy(0) == 1.0f);
+
+    // Nothing left to take back
+    atlas.revertLastInsert();
+    CHECK(atlas.getPageCount() == 1);
+  }
+}
+
+int main()
+{
+  testPackerStaysInsideWithoutOverlaps();
+  testBlocksAreAlignedAndPadded();
+  testMipsAverageInLinearSpace();
+  testRevertLastInsert();
+
+  return failedChecks == 0 ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdio>
+
+/*
+  Minimal assertions for the CPU side tests, each test is a plain executable
+  that returns non-zero when a check failed.
+*/
+inline int failedChecks = 0;
+
+#define CHECK(condition) \
+  do \
+  { \
+    if(!(condition)) \
+    { \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      failedChecks++; \
+    } \
+  } while(false)
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdio>
+#include <vector>
+
+/*
+  Headless Vulkan device for the tests that need one, no surface and no
+  layers. Any implementation works, lavapipe is enough. Without a device
+  the test returns SKIPPED, which CTest reports as skipped rather than
+  failed (SKIP_RETURN_CODE in CMakeLists.txt).
+
+  Timeline semaphores are enabled when the device has them, so both upload
+  paths can be tested on the same device.
+*/
+inline constexpr int SKIPPED = 77;
+
+struct TestDevice
+{
+  VkInstance instance = VK_NULL_HANDLE;
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice device = VK_NULL_HANDLE;
+  VkQueue queue = VK_NULL_HANDLE;
+  uint32_t queueFamily = 0;
+  bool timelineSemaphores = false;
+
+  // The first device with a queue that can copy
+  bool create()
+  {
+    VkApplicationInfo applicationInfo{};
+    applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    applicationInfo.pApplicationName = "engine tests";
+    applicationInfo.apiVersion = VK_API_VERSION_1_2;
+
+    VkInstanceCreateInfo instanceInfo{};
+    instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instanceInfo.pApplicationInfo = &applicationInfo;
+
+    if(vkCreateInstance(&instanceInfo, nullptr, &instance) != VK_SUCCESS)
+    {
+      std::fprintf(stderr, "No Vulkan instance\n");
+      instance = VK_NULL_HANDLE;
+      return false;
+    }
+
+    uint32_t deviceCount = 0;
+    vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+    std::vector<VkPhysicalDevice> devices(deviceCount);
+    vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+
+    for(VkPhysicalDevice candidate : devices)
+    {
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(candidate, &properties);
+
+      // Features2 and the memory requirements the allocator queries are 1.1
+      if(properties.apiVersion < VK_API_VERSION_1_1 || !findQueueFamily(candidate))
+      {
+        continue;
+      }
+
+      physicalDevice = candidate;
+      std::fprintf(stderr, "Testing on %s\n", properties.deviceName);
+
+      VkPhysicalDeviceVulkan12Features supportedFeatures12{};
+      supportedFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+      VkPhysicalDeviceFeatures2 supportedFeatures2{};
+      supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+      supportedFeatures2.pNext = properties.apiVersion >= VK_API_VERSION_1_2 ? &supportedFeatures12 : nullptr;
+      vkGetPhysicalDeviceFeatures2(candidate, &supportedFeatures2);
+
+      timelineSemaphores = supportedFeatures12.timelineSemaphore;
+      break;
+    }
+
+    if(physicalDevice == VK_NULL_HANDLE)
+    {
+      std::fprintf(stderr, "No Vulkan 1.1 device with a transfer queue\n");
+      return false;
+    }
+
+    float queuePriority = 1.0f;
+    VkDeviceQueueCreateInfo queueInfo{};
+    queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfo.queueFamilyIndex = queueFamily;
+    queueInfo.queueCount = 1;
+    queueInfo.pQueuePriorities = &queuePriority;
+
+    VkPhysicalDeviceVulkan12Features deviceFeatures12{};
+    deviceFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    deviceFeatures12.timelineSemaphore = timelineSemaphores;
+
+    VkDeviceCreateInfo deviceInfo{};
+    deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceInfo.pNext = timelineSemaphores ? &deviceFeatures12 : nullptr;
+    deviceInfo.queueCreateInfoCount = 1;
+    deviceInfo.pQueueCreateInfos = &queueInfo;
+
+    if(vkCreateDevice(physicalDevice, &deviceInfo, nullptr, &device) != VK_SUCCESS)
+    {
+      std::fprintf(stderr, "Failed to create the test device\n");
+      device = VK_NULL_HANDLE;
+      return false;
+    }
+
+    vkGetDeviceQueue(device, queueFamily, 0, &queue);
+
+    return true;
+  }
+
+  void destroy()
+  {
+    if(device != VK_NULL_HANDLE)
+    {
+      vkDeviceWaitIdle(device);
+      vkDestroyDevice(device, nullptr);
+    }
+
+    if(instance != VK_NULL_HANDLE)
+    {
+      vkDestroyInstance(instance, nullptr);
+    }
+
+    device = VK_NULL_HANDLE;
+    instance = VK_NULL_HANDLE;
+  }
+
+  private:
+  // Graphics and compute queues can copy too, without reporting TRANSFER
+  bool findQueueFamily(VkPhysicalDevice candidate)
+  {
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(candidate, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(candidate, &familyCount, families.data());
+
+    for(uint32_t i = 0; i < familyCount; i++)
+    {
+      if(families[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT))
+      {
+        queueFamily = i;
+        return true;
+      }
+    }
+
+    return false;
+  }
+};
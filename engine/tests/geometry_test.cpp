@@ -0,0 +1,163 @@
+#include "geometry.hpp"
+
+#include "check.hpp"
+
+#include <vector>
+
+namespace
+{
+  const uint32_t MAX_VERTICES = 1000;
+  const uint32_t MAX_INDICES = 3000;
+  const uint32_t FRAMES_IN_FLIGHT = 2;
+
+  bool overlaps(uint32_t firstA, uint32_t countA, uint32_t firstB, uint32_t countB)
+  {
+    return firstA < firstB + countB && firstB < firstA + countA;
+  }
+
+  void testAllocateHandsOutDisjointRanges()
+  {
+    GeometryArena arena;
+    arena.init(MAX_VERTICES, MAX_INDICES, FRAMES_IN_FLIGHT);
+
+    uint32_t a = arena.allocate(400, 600);
+    uint32_t b = arena.allocate(400, 600);
+    CHECK(a != GeometryArena::INVALID_MESH && b != GeometryArena::INVALID_MESH && a != b);
+
+    GeometryArena::Mesh meshA = arena.getMesh(a);
+    GeometryArena::Mesh meshB = arena.getMesh(b);
+    CHECK(meshA.vertexCount == 400 && meshA.indexCount == 600);
+    CHECK(!overlaps(meshA.firstVertex, meshA.vertexCount, meshB.firstVertex, meshB.vertexCount));
+    CHECK(!overlaps(meshA.firstIndex, meshA.indexCount, meshB.firstIndex, meshB.indexCount));
+
+    // Out of vertices
+    CHECK(arena.allocate(400, 600) == GeometryArena::INVALID_MESH);
+
+    // Out of indices, the vertices it took are given back
+    CHECK(arena.allocate(100, 2000) == GeometryArena::INVALID_MESH);
+    CHECK(arena.getUsedVertices() == 800);
+    CHECK(arena.getUsedIndices() == 1200);
+  }
+
+  void testFreedRangesWaitForFramesInFlight()
+  {
+    GeometryArena arena;
+    arena.init(MAX_VERTICES, MAX_INDICES, FRAMES_IN_FLIGHT);
+
+    uint32_t a = arena.allocate(600, 1000);
+    CHECK(a != GeometryArena::INVALID_MESH);
+
+    arena.free(a, 5);
+    CHECK(!arena.isFragmented());
+
+    // Frames 5 and 6 may still draw it
+    arena.beginFrame(6);
+    CHECK(arena.getUsedVertices() == 600);
+    CHECK(arena.allocate(600, 1000) == GeometryArena::INVALID_MESH);
+
+    arena.beginFrame(7);
+    CHECK(arena.getUsedVertices() == 0);
+    CHECK(arena.isFragmented());
+
+    // Freeing twice, or an invalid mesh, changes nothing
+    arena.free(a, 7);
+    arena.free(GeometryArena::INVALID_MESH, 7);
+    arena.beginFrame(9);
+    CHECK(arena.getUsedVertices() == 0);
+
+    uint32_t b = arena.allocate(600, 1000);
+    CHECK(b != GeometryArena::INVALID_MESH);
+    CHECK(arena.getMesh(b).firstVertex == 0);
+  }
+
+  void testCompactMovesMeshesDown()
+  {
+    GeometryArena arena;
+    arena.init(MAX_VERTICES, MAX_INDICES, FRAMES_IN_FLIGHT);
+
+    uint32_t a = arena.allocate(100, 300);
+    uint32_t b = arena.allocate(50, 150);
+    uint32_t c = arena.allocate(50, 150);
+
+    arena.free(a, 1);
+    arena.beginFrame(1 + FRAMES_IN_FLIGHT);
+    CHECK(arena.isFragmented());
+
+    uint64_t generation = arena.getGeneration();
+
+    std::vector<GeometryArena::Copy> vertexCopies;
+    std::vector<GeometryArena::Copy> indexCopies;
+    CHECK(arena.compact(10, vertexCopies, indexCopies));
+    CHECK(arena.getGeneration() != generation);
+    CHECK(!arena.isFragmented());
+
+    // Both fit into the hole a left, in order
+    CHECK(vertexCopies.size() == 2 && indexCopies.size() == 2);
+    CHECK(arena.getMesh(b).firstVertex == 0 && arena.getMesh(c).firstVertex == 50);
+    CHECK(arena.getMesh(b).firstIndex == 0 && arena.getMesh(c).firstIndex == 150);
+
+    // No copy reads what it or another copy writes
+    for(const std::vector<GeometryArena::Copy> *copies : {&vertexCopies, &indexCopies})
+    {
+      for(const GeometryArena::Copy &copy : *copies)
+      {
+        CHECK(copy.target < copy.source);
+
+        for(const GeometryArena::Copy &other : *copies)
+        {
+          CHECK(!overlaps(copy.source, copy.count, other.target, other.count));
+        }
+      }
+    }
+
+    CHECK(vertexCopies[0].source == 100 && vertexCopies[0].target == 0 && vertexCopies[0].count == 50);
+    CHECK(vertexCopies[1].source == 150 && vertexCopies[1].target == 50 && vertexCopies[1].count == 50);
+
+    // The vacated ranges are still read by frames in flight
+    CHECK(arena.getUsedVertices() == 200);
+    CHECK(arena.allocate(900, 100) == GeometryArena::INVALID_MESH);
+
+    arena.beginFrame(10 + FRAMES_IN_FLIGHT);
+    CHECK(arena.getUsedVertices() == 100);
+
+    // Everything is packed at the bottom, nothing left to move
+    vertexCopies.clear();
+    indexCopies.clear();
+    generation = arena.getGeneration();
+    CHECK(!arena.compact(12, vertexCopies, indexCopies));
+    CHECK(vertexCopies.empty() && indexCopies.empty());
+    CHECK(arena.getGeneration() == generation);
+
+    uint32_t d = arena.allocate(900, 100);
+    CHECK(d != GeometryArena::INVALID_MESH);
+    CHECK(arena.getMesh(d).firstVertex == 100);
+  }
+
+  void testCompactKeepsMeshesThatDontFit()
+  {
+    GeometryArena arena;
+    arena.init(MAX_VERTICES, MAX_INDICES, FRAMES_IN_FLIGHT);
+
+    uint32_t a = arena.allocate(50, 100);
+    uint32_t b = arena.allocate(100, 200);
+
+    arena.free(a, 1);
+    arena.beginFrame(1 + FRAMES_IN_FLIGHT);
+
+    std::vector<GeometryArena::Copy> vertexCopies;
+    std::vector<GeometryArena::Copy> indexCopies;
+    CHECK(!arena.compact(3, vertexCopies, indexCopies));
+    CHECK(vertexCopies.empty() && indexCopies.empty());
+    CHECK(arena.getMesh(b).firstVertex == 50 && arena.getMesh(b).firstIndex == 100);
+  }
+}
+
+int main()
+{
+  testAllocateHandsOutDisjointRanges();
+  testFreedRangesWaitForFramesInFlight();
+  testCompactMovesMeshesDown();
+  testCompactKeepsMeshesThatDontFit();
+
+  return failedChecks == 0 ? 0 : 1;
+}
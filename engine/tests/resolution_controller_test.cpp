@@ -0,0 +1,143 @@
+#include "resolution_controller.hpp"
+
+#include "check.hpp"
+
+namespace
+{
+  struct Extent
+  {
+    uint32_t width;
+    uint32_t height;
+  };
+
+  ResolutionController::Settings makeSettings()
+  {
+    ResolutionController::Settings settings;
+    settings.targetMilliseconds = 10.0f;
+    settings.minScale = 0.5f;
+    settings.maxScale = 1.0f;
+    settings.step = 0.05f;
+    settings.headroom = 0.8f;
+    settings.smoothing = 0.5f;
+    settings.settleFrames = 3;
+    return settings;
+  }
+
+  // Feeds the same time count times, returns how many of them changed the scale
+  uint32_t feed(ResolutionController &controller, float milliseconds, uint32_t count)
+  {
+    uint32_t changes = 0;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+      changes += controller.update(milliseconds) ? 1 : 0;
+    }
+
+    return changes;
+  }
+
+  void testStartsAtFullScale()
+  {
+    ResolutionController controller;
+    controller.init(makeSettings());
+
+    CHECK(controller.getScale() == 1.0f);
+    CHECK(feed(controller, 9.0f, 100) == 0);
+    CHECK(controller.getScale() == 1.0f);
+  }
+
+  void testScalesDownToFitTheTarget()
+  {
+    ResolutionController controller;
+    controller.init(makeSettings());
+
+    // Twice the budget: pixels have to halve, so the scale drops to about sqrt(0.5)
+    CHECK(controller.update(20.0f));
+    CHECK(std::abs(controller.getScale() - 0.70f) < 1e-4f);
+    CHECK(controller.getAverageMilliseconds() == 20.0f);
+  }
+
+  void testWaitsForSettleFrames()
+  {
+    ResolutionController controller;
+    controller.init(makeSettings());
+
+    CHECK(controller.update(20.0f));
+    float scale = controller.getScale();
+
+    CHECK(feed(controller, 20.0f, 3) == 0);
+    CHECK(controller.getScale() == scale);
+
+    CHECK(controller.update(20.0f));
+    CHECK(controller.getScale() < scale);
+  }
+
+  void testClampsToMinScale()
+  {
+    ResolutionController controller;
+    controller.init(makeSettings());
+
+    feed(controller, 100.0f, 50);
+    CHECK(controller.getScale() == 0.5f);
+    CHECK(feed(controller, 100.0f, 50) == 0);
+  }
+
+  void testScalesUpOneStepAtATime()
+  {
+    ResolutionController controller;
+    controller.init(makeSettings());
+
+    feed(controller, 100.0f, 50);
+    CHECK(controller.getScale() == 0.5f);
+
+    // Well under the headroom, the average catches up first
+    feed(controller, 2.0f, 10);
+    float scale = controller.getScale();
+    CHECK(scale > 0.5f);
+
+    CHECK(feed(controller, 2.0f, 4) == 1);
+    CHECK(std::abs(controller.getScale() - (scale + 0.05f)) < 1e-4f);
+
+    feed(controller, 2.0f, 200);
+    CHECK(controller.getScale() == 1.0f);
+  }
+
+  void testHoldsBetweenHeadroomAndTarget()
+  {
+    ResolutionController controller;
+    controller.init(makeSettings());
+
+    feed(controller, 100.0f, 50);
+    float scale = controller.getScale();
+
+    // 8.5 ms is under the target but above 80% of it
+    CHECK(feed(controller, 8.5f, 200) == 0);
+    CHECK(controller.getScale() == scale);
+  }
+
+  void testScaledExtentKeepsAPixel()
+  {
+    ResolutionController controller;
+    controller.init(makeSettings());
+    feed(controller, 100.0f, 50);
+
+    Extent extent = controller.scaleExtent(Extent{1920, 1080});
+    CHECK(extent.width == 960 && extent.height == 540);
+
+    Extent tiny = controller.scaleExtent(Extent{1, 1});
+    CHECK(tiny.width == 1 && tiny.height == 1);
+  }
+}
+
+int main()
+{
+  testStartsAtFullScale();
+  testScalesDownToFitTheTarget();
+  testWaitsForSettleFrames();
+  testClampsToMinScale();
+  testScalesUpOneStepAtATime();
+  testHoldsBetweenHeadroomAndTarget();
+  testScaledExtentKeepsAPixel();
+
+  return failedChecks == 0 ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+#include "upload.hpp"
+
+#include "check.hpp"
+#include "device.hpp"
+
+#include <cstring>
+#include <vector>
+
+namespace
+{
+  const VkDeviceSize RING_SIZE = 4096;
+  const VkDeviceSize TARGET_SIZE = 4 * RING_SIZE;
+
+  // A ring, a queue on it and a host visible buffer the copies land in
+  struct Uploads
+  {
+    DeviceAllocator allocator;
+    StagingRing ring;
+    UploadQueue queue;
+    VkBuffer target = VK_NULL_HANDLE;
+    GpuAllocation targetAllocation;
+    VkDevice device = VK_NULL_HANDLE;
+
+    bool init(const TestDevice &testDevice, bool timelineSemaphores)
+    {
+      device = testDevice.device;
+
+      PipelineBarriers::init(device, nullptr);
+      allocator.init(testDevice.physicalDevice, device);
+      ring.init(device, allocator, RING_SIZE);
+      queue.init(device, testDevice.queueFamily, testDevice.queue, &ring, timelineSemaphores);
+
+      VkBufferCreateInfo bufferInfo{};
+      bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+      bufferInfo.size = TARGET_SIZE;
+      bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+      bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+      if(vkCreateBuffer(device, &bufferInfo, nullptr, &target) != VK_SUCCESS)
+      {
+        return false;
+      }
+
+      return allocator.allocateBuffer(target, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, targetAllocation);
+    }
+
+    void destroy()
+    {
+      queue.destroy();
+      ring.destroy();
+
+      vkDestroyBuffer(device, target, nullptr);
+      allocator.free(targetAllocation);
+      allocator.destroy();
+    }
+
+    // Stages bytes and queues their copy to offset in the target
+    bool upload(VkDeviceSize offset, const std::vector<uint8_t> &bytes)
+    {
+      StagingRing::Slice slice;
+      if(!ring.allocate(bytes.size(), StagingRing::DEFAULT_ALIGNMENT, slice))
+      {
+        return false;
+      }
+
+      memcpy(slice.data, bytes.data(), bytes.size());
+
+      // Released to the host, which reads the target once the batch is done
+      TransferRecorder::Destination destination = {VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT};
+      queue.getRecorder().uploadBuffer(slice.buffer, slice.offset, target, offset, bytes.size(), destination);
+      return true;
+    }
+
+    bool targetHolds(VkDeviceSize offset, const std::vector<uint8_t> &bytes) const
+    {
+      return memcmp(static_cast<const uint8_t*>(targetAllocation.mapped) + offset, bytes.data(), bytes.size()) == 0;
+    }
+  };
+
+  std::vector<uint8_t> makeBytes(size_t size, uint8_t seed)
+  {
+    std::vector<uint8_t> bytes(size);
+
+    for(size_t i = 0; i < size; i++)
+    {
+      bytes[i] = static_cast<uint8_t>(seed + i * 7);
+    }
+
+    return bytes;
+  }
+
+  void testFlushAndWait(const TestDevice &device, bool timelineSemaphores)
+  {
+    Uploads uploads;
+    CHECK(uploads.init(device, timelineSemaphores));
+    CHECK((uploads.queue.getTimeline() != VK_NULL_HANDLE) == timelineSemaphores);
+
+    // Nothing recorded, nothing submitted
+    CHECK(!uploads.queue.hasPendingWork());
+    CHECK(uploads.queue.flush().value == 0);
+    CHECK(uploads.queue.getCompletedValue() == 0);
+
+    std::vector<uint8_t> bytes = makeBytes(256, 1);
+    CHECK(uploads.upload(0, bytes));
+    CHECK(uploads.queue.hasPendingWork());
+
+    UploadTicket ticket = uploads.queue.flush();
+    CHECK(ticket.value == 1);
+    CHECK(!uploads.queue.hasPendingWork());
+
+    uploads.queue.wait(ticket);
+    CHECK(uploads.queue.isComplete(ticket));
+    CHECK(uploads.queue.getCompletedValue() == 1);
+    CHECK(uploads.targetHolds(0, bytes));
+
+    // An empty flush hands back the last ticket
+    CHECK(uploads.queue.flush().value == 1);
+    CHECK(uploads.queue.getLastTicket().value == 1);
+
+    uploads.destroy();
+  }
+
+  void testBatchesCompleteInOrder(const TestDevice &device, bool timelineSemaphores)
+  {
+    Uploads uploads;
+    CHECK(uploads.init(device, timelineSemaphores));
+
+    std::vector<uint8_t> batches[3] = {makeBytes(512, 10), makeBytes(512, 20), makeBytes(512, 30)};
+    UploadTicket tickets[3];
+
+    for(uint32_t i = 0; i < 3; i++)
+    {
+      CHECK(uploads.upload(i * 512, batches[i]));
+      tickets[i] = uploads.queue.flush();
+      CHECK(tickets[i].value == i + 1);
+    }
+
+    // Waiting on the last one covers the earlier ones
+    uploads.queue.wait(tickets[2]);
+    CHECK(uploads.queue.getCompletedValue() == 3);
+
+    for(uint32_t i = 0; i < 3; i++)
+    {
+      CHECK(uploads.queue.isComplete(tickets[i]));
+      CHECK(uploads.targetHolds(i * 512, batches[i]));
+    }
+
+    // The next batch records into a command buffer collected from those
+    uploads.queue.collect();
+
+    std::vector<uint8_t> bytes = makeBytes(512, 40);
+    CHECK(uploads.upload(3 * 512, bytes));
+
+    UploadTicket ticket = uploads.queue.flush();
+    CHECK(ticket.value == 4);
+
+    uploads.queue.wait(ticket);
+    CHECK(uploads.queue.getCompletedValue() == 4);
+    CHECK(uploads.targetHolds(3 * 512, bytes));
+
+    uploads.destroy();
+  }
+
+  void testRingSpaceComesBackWithItsBatch(const TestDevice &device, bool timelineSemaphores)
+  {
+    Uploads uploads;
+    CHECK(uploads.init(device, timelineSemaphores));
+
+    std::vector<uint8_t> half = makeBytes(RING_SIZE / 2, 50);
+    CHECK(uploads.upload(0, half));
+    CHECK(uploads.upload(RING_SIZE / 2, half));
+
+    // The open batch holds the whole ring and nothing is in flight to wait on
+    StagingRing::Slice slice;
+    CHECK(!uploads.ring.allocate(16, StagingRing::DEFAULT_ALIGNMENT, slice));
+    CHECK(!uploads.ring.waitOldest());
+
+    UploadTicket ticket = uploads.queue.flush();
+    CHECK(uploads.ring.getUsed() == RING_SIZE);
+
+    uploads.queue.wait(ticket);
+    CHECK(uploads.targetHolds(0, half));
+    CHECK(uploads.targetHolds(RING_SIZE / 2, half));
+
+    // Without a timeline the staging fence goes out in a submission of its own
+    uploads.ring.waitIdle();
+    CHECK(uploads.ring.isIdle());
+
+    std::vector<uint8_t> bytes = makeBytes(RING_SIZE, 60);
+    CHECK(uploads.upload(RING_SIZE, bytes));
+
+    ticket = uploads.queue.flush();
+    uploads.queue.wait(ticket);
+    CHECK(uploads.targetHolds(RING_SIZE, bytes));
+
+    uploads.destroy();
+  }
+}
+
+int main()
+{
+  TestDevice device;
+
+  if(!device.create())
+  {
+    device.destroy();
+    return SKIPPED;
+  }
+
+  // Fences on every device, timelines where the device has them
+  for(bool timelineSemaphores : {false, true})
+  {
+    if(timelineSemaphores && !device.timelineSemaphores)
+    {
+      std::fprintf(stderr, "No timeline semaphores, only the fence path was tested\n");
+      continue;
+    }
+
+    testFlushAndWait(device, timelineSemaphores);
+    testBatchesCompleteInOrder(device, timelineSemaphores);
+    testRingSpaceComesBackWithItsBatch(device, timelineSemaphores);
+  }
+
+  device.destroy();
+
+  return failedChecks == 0 ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+
+# Packs every file under the given directories into the archive read by
+# src/archive.hpp, each directory's contents at the root of the archive.
+# Shader sources are left out, the build compiles them into SPIR-V.
+# usage: pack_assets.py <output .pak> <directory> [<directory> ...]
+
+import os
+import struct
+import sys
+
+VERSION = 2
+DATA_ALIGNMENT = 16
+SHADER_SOURCES = (".vert", ".frag", ".comp")
+
+
+def fnv1a64(text):
+    value = 0xcbf29ce484222325
+    for byte in text.encode("utf-8"):
+        value ^= byte
+        value = (value * 0x100000001b3) & 0xffffffffffffffff
+    return value
+
+
+def align(value, alignment):
+    return (value + alignment - 1) // alignment * alignment
+
+
+def main():
+    if len(sys.argv) < 3:
+        print("usage: pack_assets.py <output .pak> <directory> [<directory> ...]")
+        return 1
+
+    output, roots = sys.argv[1], sys.argv[2:]
+
+    files = []
+    for root in roots:
+        for directory, _, names in os.walk(root):
+            for name in names:
+                if name.endswith(SHADER_SOURCES):
+                    continue
+                path = os.path.join(directory, name)
+                files.append((os.path.relpath(path, root).replace(os.sep, "/"), path))
+
+    seen = set()
+    for relative, _ in files:
+        if relative in seen:
+            print(f"{relative} is in more than one directory")
+            return 1
+        seen.add(relative)
+
+    # Paths that hash alike sit next to each other, the reader tells them apart by path
+    entries = sorted(((fnv1a64(relative), relative, path) for relative, path in files))
+    names = [relative.encode("utf-8") for _, relative, _ in entries]
+
+    path_offset = 16 + len(entries) * 32
+    offset = align(path_offset + sum(len(name) for name in names), DATA_ALIGNMENT)
+
+    table = []
+    blobs = []
+    for (key, _, path), name in zip(entries, names):
+        with open(path, "rb") as source:
+            blob = source.read()
+        table.append(struct.pack("<QQQII", key, offset, len(blob), path_offset, len(name)))
+        blobs.append((offset, blob))
+        path_offset += len(name)
+        offset = align(offset + len(blob), DATA_ALIGNMENT)
+
+    os.makedirs(os.path.dirname(os.path.abspath(output)), exist_ok=True)
+
+    with open(output, "wb") as archive:
+        archive.write(struct.pack("<4sIII", b"PAK1", VERSION, len(entries), 0))
+        archive.write(b"".join(table))
+        archive.write(b"".join(names))
+
+        for blob_offset, blob in blobs:
+            archive.write(b"\0" * (blob_offset - archive.tell()))
+            archive.write(blob)
+
+    print(f"Packed {len(entries)} files into {output}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())